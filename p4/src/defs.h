@@ -119,6 +119,7 @@ void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            sleepfortime(void*, struct spinlock*, int);  // added
+int             slicetick(void);  // added
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
@@ -129,6 +130,7 @@ int setslice(int, int);
 int getslice(int);
 int fork2(int);
 int getpinfo(struct pstat*);
+int setpolicy(int);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
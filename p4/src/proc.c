@@ -7,13 +7,38 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "pstat.h"
+#include "sched.h"
+
+#define NSLEEPQ 64  // sleep queues; channels are hashed onto them
+#define NTIMERS 64  // timer wheel slots, one tick each
+#define STRIDE1 (1 << 16)  // pass a process with one ticket gains per tick
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
-  struct queue proc_queue;
+  struct queue sleepq[NSLEEPQ];  // sleeping processes, by channel
+  struct queue timers[NTIMERS];  // processes in sleepfortime(), by wakeat
 } ptable;
 
+// Per-CPU run queue. Runnable processes wait on the queue of the CPU they
+// last ran on; a CPU with nothing on its own queue steals from the longest
+// queue of another CPU. Lock order is ptable.lock before a queue's lock,
+// and no CPU holds two queue locks at once. Under SCHED_RR the processes
+// are in a FIFO list; under SCHED_STRIDE they are in a min-heap by pass.
+struct runq {
+  struct spinlock lock;  // protects everything below
+  int policy;  // SCHED_RR or SCHED_STRIDE, which of queue and heap is used
+  struct queue queue;  // runnable processes waiting for this cpu (SCHED_RR)
+  struct proc *heap[NPROC];  // the same by pass, lowest first (SCHED_STRIDE)
+  int length;  // number of processes on queue or heap
+  uint pass;  // pass of the last process taken; a sleeper's pass is kept
+              // relative to it, so it wakes with no more than it had
+  int steals;  // processes this cpu has taken from other cpus' queues
+};
+
+static struct runq runqs[NCPU];
+static int schedpolicy = SCHED_RR;  // policy set by setpolicy()
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -26,6 +51,8 @@ void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  for (int i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
 }
 
 // Must be called with interrupts disabled
@@ -68,56 +95,338 @@ myproc(void) {
 }
 
 /**
- * Function that adds a new process to the process queue. Make sure this is
- * only called with the ptable lock acquired.
+ * Function that adds a process to the tail of a queue. Make sure this is
+ * only called with the lock protecting the queue acquired.
  *
+ * q: queue to add to
  * new_proc: process to add to queue
  */
-void
-enqueue(struct proc *new_proc) {
-    static int initialized = 0;  // static var to track if queue initialized
-
-    if (initialized == 0) {  // if uninitialized, set head and tail to 0
-        ptable.proc_queue.head = 0;
-        ptable.proc_queue.tail = 0;
-        initialized = 1;  // mark as initialized
-    } 
-
+static void
+enqueue(struct queue *q, struct proc *new_proc) {
     // check if queue empty
-    if (ptable.proc_queue.head == 0) {
+    if (q->head == 0) {
         // have head and tail point to new proc
-        ptable.proc_queue.head = new_proc;
-        ptable.proc_queue.tail = new_proc;
+        q->head = new_proc;
+        q->tail = new_proc;
     } else {  // add to tail if not empty
-        ptable.proc_queue.tail->next = new_proc;
-        ptable.proc_queue.tail = new_proc;
+        q->tail->next = new_proc;
+        q->tail = new_proc;
     }
 
-    ptable.proc_queue.tail->next = 0;  // set next to null
+    q->tail->next = 0;  // set next to null
 }
 
 /**
- * Function that returns the head of the process queue and moves the head
- * to the next process. Make sure this is only called with ptable lock acquired
+ * Function that returns the head of a queue and moves the head to the next
+ * process. Make sure this is only called with the lock protecting the queue
+ * acquired.
+ *
+ * q: queue to take from
  */
-struct proc*
-dequeue() {
+static struct proc*
+dequeue(struct queue *q) {
     // if head is null, return
-    if (ptable.proc_queue.head == 0) {
+    if (q->head == 0) {
         return 0;
     }
 
-    struct proc *temp= ptable.proc_queue.head;  // get head
-    ptable.proc_queue.head = ptable.proc_queue.head->next;  // move head to next
-    
+    struct proc *temp = q->head;  // get head
+    q->head = q->head->next;  // move head to next
+
     // if new head is null, list is empty so set tail to null
-    if (ptable.proc_queue.head == 0) {
-        ptable.proc_queue.tail = 0;
+    if (q->head == 0) {
+        q->tail = 0;
     }
 
     return temp;  // return old head
-}    
+}
+
+/**
+ * Function that unlinks a process from a queue. Make sure this is only
+ * called with the lock protecting the queue acquired.
+ *
+ * q: queue holding the process
+ * prev: process before it on the queue, or 0 if it is the head
+ * p: process to unlink
+ */
+static void
+queue_unlink(struct queue *q, struct proc *prev, struct proc *p) {
+    if (prev == 0) {
+        q->head = p->next;
+    } else {
+        prev->next = p->next;
+    }
+    if (q->tail == p) {
+        q->tail = prev;
+    }
+    p->next = 0;
+}
+
+/**
+ * Function that returns how much pass a process gains per tick it runs. Its
+ * tickets are its timeslice, so a longer slice means a larger share. The
+ * stride is at least 1, so slices above STRIDE1 all get the largest share
+ * rather than a pass that never grows and keeps the cpu forever.
+ */
+static uint
+stride(struct proc *p) {
+    uint step = STRIDE1 / p->timeslice;
+    return step > 0 ? step : 1;
+}
+
+/**
+ * Function that checks whether pass a comes before pass b. Passes wrap
+ * around, so they are compared by their difference.
+ */
+static int
+passbefore(uint a, uint b) {
+    return (int)(a - b) < 0;
+}
+
+/**
+ * Function that adds a process to a run queue's heap. Make sure this is only
+ * called with the queue's lock acquired, and that length is incremented
+ * afterwards.
+ *
+ * rq: run queue to add to
+ * p: process to add
+ */
+static void
+heap_push(struct runq *rq, struct proc *p) {
+    int i = rq->length;  // hole at the end of the heap
 
+    // move parents with a higher pass down into the hole
+    while (i > 0 && passbefore(p->pass, rq->heap[(i - 1) / 2]->pass)) {
+        rq->heap[i] = rq->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    rq->heap[i] = p;
+}
+
+/**
+ * Function that removes the process with the lowest pass from a run queue's
+ * heap. Make sure this is only called with the queue's lock acquired, on a
+ * non-empty heap, and that length is decremented afterwards.
+ *
+ * rq: run queue to take from
+ * Return: the process with the lowest pass
+ */
+static struct proc*
+heap_pop(struct runq *rq) {
+    struct proc *top = rq->heap[0];  // process to return
+    struct proc *last = rq->heap[rq->length - 1];  // fills the hole at the top
+    int n = rq->length - 1;  // size of the heap without top
+    int i = 0;  // hole left by top
+
+    // move children with a lower pass than last up into the hole
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n && passbefore(rq->heap[child + 1]->pass,
+                rq->heap[child]->pass)) {
+            child++;  // the lower of the two children
+        }
+        if (!passbefore(rq->heap[child]->pass, last->pass)) {
+            break;
+        }
+        rq->heap[i] = rq->heap[child];
+        i = child;
+    }
+    rq->heap[i] = last;
+    return top;
+}
+
+/**
+ * Function that puts a process on the run queue of the cpu it belongs to.
+ *
+ * p: runnable process that is on no queue and not running
+ */
+static void
+runq_add(struct proc *p) {
+    struct runq *rq = &runqs[p->cpu];
+
+    acquire(&rq->lock);
+    if (rq->policy == SCHED_STRIDE) {
+        heap_push(rq, p);
+    } else {
+        enqueue(&rq->queue, p);
+    }
+    rq->length++;
+    release(&rq->lock);
+}
+
+/**
+ * Function that takes the next process to run off a run queue: the head of
+ * the list, or the process with the lowest pass.
+ *
+ * rq: run queue to take from
+ * Return: the process, now on no queue, or 0 if the queue is empty
+ */
+static struct proc*
+runq_take(struct runq *rq) {
+    struct proc *p = 0;
+
+    acquire(&rq->lock);
+    if (rq->length > 0) {
+        if (rq->policy == SCHED_STRIDE) {
+            p = heap_pop(rq);
+            if (passbefore(rq->pass, p->pass)) {  // the queue's pass only grows
+                rq->pass = p->pass;
+            }
+        } else {
+            p = dequeue(&rq->queue);
+        }
+        rq->length--;
+    }
+    release(&rq->lock);
+    return p;
+}
+
+/**
+ * Function that checks whether a process waiting on a cpu's run queue should
+ * run before the one running there, which under SCHED_RR is never until the
+ * running one's slice is up.
+ *
+ * p: process running on its cpu
+ * Return: 1 if a waiting process has a lower pass than p, else 0
+ */
+static int
+runq_preempts(struct proc *p) {
+    struct runq *rq = &runqs[p->cpu];
+    int preempt = 0;
+
+    acquire(&rq->lock);
+    if (rq->policy == SCHED_STRIDE && rq->length > 0) {
+        preempt = passbefore(rq->heap[0]->pass, p->pass);
+    }
+    release(&rq->lock);
+    return preempt;
+}
+
+/**
+ * Function that moves the processes on a run queue from the list to the heap
+ * or back when the policy changes.
+ *
+ * rq: run queue to convert
+ * policy: SCHED_RR or SCHED_STRIDE
+ */
+static void
+runq_convert(struct runq *rq, int policy) {
+    struct proc *procs[NPROC];  // processes taken off in order
+    int n = 0;
+
+    acquire(&rq->lock);
+    if (rq->policy != policy) {
+        // take processes off in the order the old policy would run them
+        while (rq->length > 0) {
+            if (rq->policy == SCHED_STRIDE) {
+                procs[n++] = heap_pop(rq);
+            } else {
+                procs[n++] = dequeue(&rq->queue);
+            }
+            rq->length--;
+        }
+
+        // put them back, starting a stride apart from the queue's pass
+        rq->policy = policy;
+        for (int i = 0; i < n; i++) {
+            if (policy == SCHED_STRIDE) {
+                procs[i]->pass = rq->pass + stride(procs[i]);
+                heap_push(rq, procs[i]);
+            } else {
+                enqueue(&rq->queue, procs[i]);
+            }
+            rq->length++;
+        }
+    }
+    release(&rq->lock);
+}
+
+/**
+ * Function that returns the sleep queue processes sleeping on chan are on.
+ */
+static struct queue*
+sleepq(void *chan) {
+    return &ptable.sleepq[((uint)chan >> 4) % NSLEEPQ];
+}
+
+/**
+ * Function that returns the timer wheel slot of processes that wake at the
+ * given tick. A slot holds processes due on every NTIMERS ticks, so only
+ * those whose wakeat has come are taken when the slot comes round.
+ */
+static struct queue*
+timer_slot(uint wakeat) {
+    return &ptable.timers[wakeat % NTIMERS];
+}
+
+/**
+ * Function that takes a sleeping process off its sleep queue or timer wheel
+ * slot. Make sure this is only called with the ptable lock acquired.
+ *
+ * p: sleeping process
+ */
+static void
+sleepq_remove(struct proc *p) {
+    struct queue *q = p->sleepfor > 0 ? timer_slot(p->wakeat) : sleepq(p->chan);
+    struct proc *prev = 0;  // process before p on the queue
+
+    for (struct proc *cur = q->head; cur != p; cur = cur->next) {
+        prev = cur;
+    }
+    queue_unlink(q, prev, p);
+}
+
+/**
+ * Function that makes a process taken off its sleep queue runnable. The
+ * process is credited with the ticks it slept, both as sleep ticks and as
+ * compensation ticks for its next slice. Make sure this is only called with
+ * the ptable lock acquired.
+ *
+ * p: sleeping process that is on no queue
+ */
+static void
+wake(struct proc *p) {
+    uint slept = ticks - p->sleepstart;  // ticks since sleep()
+
+    p->sleepticks += slept;
+    p->currentcomp += slept;
+    p->pass += runqs[p->cpu].pass;  // kept relative to it while asleep
+    p->state = RUNNABLE;
+    runq_add(p);
+}
+
+/**
+ * Function that takes a runnable process from the longest run queue of
+ * another cpu. Lengths are read without the queues' locks, so the choice
+ * of queue is only a hint.
+ *
+ * self: index of the cpu that is stealing
+ * Return: the process, now on no queue, or 0 if none was found
+ */
+static struct proc*
+runq_steal(int self) {
+    struct runq *busiest = 0;
+
+    for (int i = 0; i < ncpu; i++) {
+        if (i != self && runqs[i].length > 0 &&
+                (busiest == 0 || runqs[i].length > busiest->length)) {
+            busiest = &runqs[i];
+        }
+    }
+    if (busiest == 0) {
+        return 0;
+    }
+
+    struct proc *p = runq_take(busiest);
+    if (p != 0) {
+        runqs[self].steals++;  // only this cpu updates its own count
+        p->pass += runqs[self].pass - busiest->pass;  // same lead on this cpu
+    }
+    return p;
+}
 
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
@@ -211,9 +520,12 @@ userinit(void)
   p->schedticks = 0;
   p->sleepticks = 0;
   p->switches = 0;
+  p->cpu = cpuid();
+  p->migrations = 0;
+  p->pass = runqs[p->cpu].pass + stride(p);
 
   p->state = RUNNABLE;
-  enqueue(p);  // add p to queue
+  runq_add(p);  // add p to this cpu's queue
 
   release(&ptable.lock);
 }
@@ -288,9 +600,12 @@ fork(void)
   np->schedticks = 0;
   np->sleepticks = 0;
   np->switches = 0;
+  np->cpu = cpuid();
+  np->migrations = 0;
+  np->pass = runqs[np->cpu].pass + stride(np);
 
   np->state = RUNNABLE;
-  enqueue(np);  // add p to queue
+  runq_add(np);  // add p to this cpu's queue
 
   release(&ptable.lock);
 
@@ -399,61 +714,39 @@ void
 scheduler(void)
 {
     struct cpu *c = mycpu();  // get cpu
+    int self = c - cpus;  // index of this cpu's run queue
 
     for (;;) {  // infinite loop
         sti();  // Enable interrputs on this processor.
-        acquire(&ptable.lock);  // get lock 
-        struct proc *p = c->proc;  // get current proc
-
-        // check if there is a previous process to run again
-        if (p != 0 && p->state == RUNNABLE &&
-                p->runticks < p->timeslice + p->currentcomp) {
-            // increment run and scheduled ticks
-            p->runticks++;
-            p->schedticks++;
-
-            // check if compensation slices will be used
-            if (p->runticks > p->timeslice) {
-                p->compticks++;  // increment if so
-            }
-        } else {
-            // if process did existi and ran previously, reset runticks
-            //  and currentcomp, then enqueue
-            if (p != 0) {
-                p->runticks = 0;
-                p->currentcomp = 0;
-                enqueue(p);
-            }
 
-            p = dequeue();  // get process from queue
-            int sleep_check = 0;  // checks how many times while loop has run
-        
-            // go through queue until runnable process found or loop has run over
-            // all possible processes
-            while (p != 0 && p->state != RUNNABLE && sleep_check < NPROC) {
-                // add sleeping processes to end of queue
-                if (p->state == SLEEPING) {
-                    enqueue(p);
-                    sleep_check++;
-                }
-                p = dequeue();  // get next process from queue
-            }
+        // get a process from this cpu's queue, or steal one if it is empty
+        struct proc *p = runq_take(&runqs[self]);
+        if (p == 0 && ncpu > 1) {
+            p = runq_steal(self);
+        }
+        if (p == 0) {  // no runnable processes in any queue
+            continue;  // skip incrementing or executing since not runnable
+        }
 
-            if (p == 0 || p->state != RUNNABLE) {  // no runnable processes in queue
-                // enqueue p if sleeping
-                if (p != 0 && p->state == SLEEPING) {
-                    enqueue(p);
-                    c->proc = 0;  // clear proc to avoid double resets
-                }
-                release(&ptable.lock);  // release lock
-                continue;  // skip incrementing or executing since not runnable
-            }
+        // p is on no queue, so nothing but this cpu can run it and it
+        // stays runnable
+        acquire(&ptable.lock);  // get lock
 
-            // mark this runnable process as switched to, increment run and
-            // scheduled ticks
-            p->switches++;
-            p->runticks++;
-            p->schedticks++;
+        // moving keeps runticks and currentcomp, so p gets the rest of
+        // its slice and compensation on this cpu
+        if (p->cpu != self) {
+            p->cpu = self;
+            p->migrations++;
+        }
+
+        // mark this runnable process as switched to, increment run and
+        // scheduled ticks; later ticks of the slice are counted by
+        // slicetick() without coming back here
+        p->switches++;
+        p->runticks++;
+        p->schedticks++;
+        if (runqs[self].policy == SCHED_STRIDE) {
+            p->pass += stride(p);  // charge for the tick it will run
         }
 
         // switch to chosen process
@@ -463,6 +756,24 @@ scheduler(void)
         swtch(&(c->scheduler), p->context);
 
         switchkvm();  // return from process
+
+        // p used up its slice or blocked: reset its slice and put it back on
+        // the queue if it is runnable. Sleeping processes are on a sleep
+        // queue already, and zombies go on no queue, so wait() can free them
+        // while this cpu moves on.
+        c->proc = 0;
+        if (p->state == RUNNABLE) {
+            p->runticks = 0;
+            p->currentcomp = 0;
+            runq_add(p);
+        } else if (p->state == SLEEPING) {
+            // keep only the lead p has over the queue's pass while it sleeps,
+            // so sleeping earns it no extra share when it wakes
+            p->pass -= runqs[self].pass;
+            if ((int)p->pass < 0) {
+                p->pass = 0;
+            }
+        }
         release(&ptable.lock);  // release lock after running
     }
 }
@@ -493,6 +804,46 @@ sched(void)
   mycpu()->intena = intena;
 }
 
+/**
+ * Function that charges the current process for a timer tick. A process with
+ * ticks left in its slice and compensation keeps the cpu, so the tick costs
+ * no trip through scheduler(). Under SCHED_STRIDE the slice is one tick, and
+ * the process keeps the cpu until a waiting process has a lower pass. Only
+ * called from trap() for a running process, and the fields it updates are
+ * only written by the cpu running the process, so no lock is needed.
+ *
+ * Return: 1 if the slice is used up and the process should yield, else 0
+ */
+int
+slicetick(void) {
+    struct proc *p = myproc();  // get current process
+
+    if (runqs[p->cpu].policy == SCHED_STRIDE) {
+        if (runq_preempts(p)) {
+            return 1;
+        }
+        p->runticks++;
+        p->schedticks++;
+        p->pass += stride(p);  // charge for the next tick
+        return 0;
+    }
+
+    // check if the slice and compensation are used up
+    if (p->runticks >= p->timeslice + p->currentcomp) {
+        return 1;
+    }
+
+    // increment run and scheduled ticks
+    p->runticks++;
+    p->schedticks++;
+
+    // check if compensation slices will be used
+    if (p->runticks > p->timeslice) {
+        p->compticks++;  // increment if so
+    }
+    return 0;
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
@@ -553,6 +904,8 @@ sleep(void *chan, struct spinlock *lk)
   p->currentcomp = 0;
   p->runticks = 0;
   p->sleepfor = 0;  // clear sleep timer (it is not used in regular sleep)
+  p->sleepstart = ticks;
+  enqueue(sleepq(chan), p);  // wait on chan's queue, not the run queue
 
   sched();
 
@@ -568,7 +921,8 @@ sleep(void *chan, struct spinlock *lk)
 
 /**
  * Function that is otherwise identical to sleep except sets a process
- * to sleep for a given amount of time.
+ * to sleep for a given amount of time. The process waits on the timer
+ * wheel and is woken by the tick its time is up on.
  *
  * chan: arbitrary channel for process to sleep on
  * lk: current lock held by the process
@@ -601,6 +955,13 @@ void sleepfortime(void *chan, struct spinlock *lk, int sleeptime) {
     p->currentcomp = 0;
     p->runticks = 0;
     p->sleepfor = sleeptime;  // set sleep timer
+    p->sleepstart = ticks;
+    if (sleeptime > 0) {  // wait on the timer wheel for the tick to wake at
+        p->wakeat = ticks + sleeptime;
+        enqueue(timer_slot(p->wakeat), p);
+    } else {
+        enqueue(sleepq(chan), p);
+    }
 
     sched();  // call scheduler
 
@@ -614,33 +975,60 @@ void sleepfortime(void *chan, struct spinlock *lk, int sleeptime) {
     }
 }
 
+/**
+ * Function that wakes the processes in sleepfortime() that are due at this
+ * tick. It is called on every tick, so each slot of the wheel is visited
+ * when its processes may be due. Make sure this is only called with the
+ * ptable lock acquired.
+ */
+static void
+timers_expire(void) {
+    struct queue *q = timer_slot(ticks);  // slot of processes due now
+    struct proc *prev = 0;  // process before p on the slot
+    struct proc *p = q->head;
+
+    while (p != 0) {
+        struct proc *next = p->next;
+
+        // leave processes due in a later turn of the wheel
+        if ((int)(ticks - p->wakeat) >= 0) {
+            queue_unlink(q, prev, p);
+            wake(p);
+        } else {
+            prev = p;
+        }
+        p = next;
+    }
+}
+
 //PAGEBREAK!
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
 static void
 wakeup1(void *chan)
 {
-    struct proc *p;  // process used for iterating over ptable
-
-    // iterate over ptable
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-        // wakeup1(&ticks) is called on every tick, so increment sleepticks and
-        // compensation ticks for all processes
-        if (chan == &ticks && p->state == SLEEPING) {
-            p->currentcomp++;
-            p->sleepticks++;
-
-            // decrement sleeptime ticks for processes put to sleep by syscall
-            if (p->chan == &ticks) {
-                p->sleepfor--;
-            }
-        }
+    struct queue *q = sleepq(chan);  // queue processes on chan are on
+    struct proc *prev = 0;  // process before p on the queue
+    struct proc *p = q->head;
+
+    // wakeup1(&ticks) is called on every tick, so wake the timed sleepers
+    // that are due; sleep and compensation ticks are credited by wake()
+    if (chan == &ticks) {
+        timers_expire();
+    }
+
+    // only processes on chan's queue can be sleeping on chan
+    while (p != 0) {
+        struct proc *next = p->next;
 
-        // wake all processes on the given channel who no longer need to sleep
-        // NOTE: processes not put to sleep by syscall always have sleepfor = 0
-        if (p->state == SLEEPING && p->chan == chan && p->sleepfor == 0) {
-            p->state = RUNNABLE;
+        // wake all processes on the given channel
+        if (p->chan == chan) {
+            queue_unlink(q, prev, p);
+            wake(p);
+        } else {
+            prev = p;
         }
+        p = next;
     }
 }
 
@@ -666,8 +1054,10 @@ kill(int pid)
     if(p->pid == pid){
       p->killed = 1;
       // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
+      if(p->state == SLEEPING){
+        sleepq_remove(p);
+        wake(p);
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -825,9 +1215,12 @@ fork2(int slice) {
     np->schedticks = 0;
     np->sleepticks = 0;
     np->switches = 0;
+    np->cpu = cpuid();
+    np->migrations = 0;
+    np->pass = runqs[np->cpu].pass + stride(np);
 
     np->state = RUNNABLE;
-    enqueue(np);  // add p to queue
+    runq_add(np);  // add p to this cpu's queue
 
     release(&ptable.lock);
 
@@ -864,10 +1257,49 @@ getpinfo(struct pstat *pointer) {
         pointer->compticks[p - ptable.proc] = p->compticks;
         pointer->schedticks[p - ptable.proc] = p->schedticks;
         pointer->sleepticks[p - ptable.proc] = p->sleepticks;
+        if (p->state == SLEEPING) {  // credited when it wakes, so add it here
+            pointer->sleepticks[p - ptable.proc] += ticks - p->sleepstart;
+        }
         pointer->switches[p - ptable.proc] = p->switches;
+        pointer->cpu[p - ptable.proc] = p->cpu;
+        pointer->migrations[p - ptable.proc] = p->migrations;
+        pointer->pass[p - ptable.proc] = p->pass;
+    }
+    pointer->policy = schedpolicy;
+
+    // copy per-cpu run queue info; lengths may be a tick out of date
+    pointer->ncpu = ncpu;
+    for (int i = 0; i < NCPU; i++) {
+        pointer->runqlen[i] = i < ncpu ? runqs[i].length : 0;
+        pointer->steals[i] = i < ncpu ? runqs[i].steals : 0;
     }
 
     release(&ptable.lock);
     
     return 0;  // function successful, return 0
 }
+
+/**
+ * Function that selects the scheduling policy of every cpu. Processes keep
+ * their timeslice, which SCHED_STRIDE uses as their number of tickets.
+ *
+ * policy: SCHED_RR or SCHED_STRIDE
+ * Return: -1 if policy invalid, else the policy in use before
+ */
+int
+setpolicy(int policy) {
+    // check if policy is one of the two
+    if (policy != SCHED_RR && policy != SCHED_STRIDE) {
+        return -1;  // return -1 if not
+    }
+
+    acquire(&ptable.lock);  // serialize with other setpolicy() calls
+    int old = schedpolicy;
+    schedpolicy = policy;
+    for (int i = 0; i < NCPU; i++) {
+        runq_convert(&runqs[i], policy);
+    }
+    release(&ptable.lock);
+
+    return old;
+}
@@ -51,12 +51,18 @@ struct proc {
   char name[16];               // Process name (debugging)
   int runticks;                // Number of ticks the process has run this slice
   int sleepfor;                // Number of ticks the process should sleep for
+  uint sleepstart;             // Value of ticks when the process went to sleep
+  uint wakeat;                 // Value of ticks sleepfortime() wakes it at
   int currentcomp;             // Number of current compensation ticks
   int timeslice;               // Number of ticks process will run for per slice
   int compticks;               // Number of compensation ticks process used
   int schedticks;              // Total ticks process was scheduled for
   int sleepticks;              // Total ticks process was blocked for
   int switches;                // Total number of times a process was scheduled
+  int cpu;                     // Cpu whose run queue the process is on
+  int migrations;              // Times the process was run by a different cpu
+  uint pass;                   // Stride scheduling virtual time; relative
+                               // to its cpu's run queue while sleeping
   struct proc *next;           // pointer to next node in queue
 };
 
@@ -10,6 +10,13 @@ struct pstat {
   int schedticks[NPROC];  // total number of timer ticks this process has been scheduled
   int sleepticks[NPROC]; // number of ticks during which this process was blocked
   int switches[NPROC];  // total num times this process has been scheduled
+  int cpu[NPROC]; // cpu whose run queue this process is on
+  int migrations[NPROC]; // number of times this process moved to another cpu
+  int pass[NPROC]; // stride scheduling pass value of this process
+  int policy; // scheduling policy in use (SCHED_RR or SCHED_STRIDE)
+  int ncpu; // number of cpus in use; entries below past ncpu are 0
+  int runqlen[NCPU]; // number of processes on each cpu's run queue
+  int steals[NCPU]; // number of processes each cpu took from another's queue
 };
 
 #endif
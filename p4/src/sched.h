@@ -0,0 +1,8 @@
+#ifndef SCHED_h
+#define SCHED_h
+
+// scheduling policies for setpolicy()
+#define SCHED_RR 0  // compensated round-robin; timeslice is the slice length
+#define SCHED_STRIDE 1  // stride scheduling; timeslice is the ticket count
+
+#endif
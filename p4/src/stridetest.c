@@ -0,0 +1,173 @@
+///////////////////////////////////////////////////////////////////////////////
+// This File:        stridetest.c
+// Other Files:      schedtest.c, tickbench.c
+//
+//////////////////////////// 80 columns wide ///////////////////////////////////
+
+/**
+ * stridetest.c
+ * A program that compares the two scheduling policies. Under each policy it
+ * runs two CPU-bound loop processes with given timeslices, which are also
+ * their tickets under stride scheduling, alongside a process that sleeps
+ * for a tick at a time. It then prints the share of ticks each loop got
+ * against the share its timeslice entitles it to, and how many ticks late
+ * the sleeping process was run after each wake-up. Last it runs two loops
+ * with more tickets than the kernel's stride constant under stride
+ * scheduling, which must still share the cpu. Run it with CPUS=1 so all
+ * three processes share one cpu.
+ */
+
+#include "types.h"
+#include "user.h"
+#include "pstat.h"
+#include "param.h"
+#include "sched.h"
+
+/**
+ * Function that loops forever, for the CPU-bound processes.
+ */
+void spin(void) {
+    volatile int accumulator = 0;  // accumulates results of loop operation
+
+    for (int i = 0; ; i++) {
+        accumulator = accumulator * i + i;
+    }
+}
+
+/**
+ * Function that sleeps for a tick at a time until the given tick, then prints
+ * how late it ran after waking on average, in hundredths of a tick.
+ *
+ * end: tick to stop at
+ */
+void napper(int end) {
+    int naps = 0;  // number of sleeps
+    int late = 0;  // total ticks run late after them
+
+    while (uptime() < end) {
+        int before = uptime();
+        sleep(1);
+        late += uptime() - before - 1;  // it was due one tick later
+        naps++;
+    }
+
+    if (naps > 0) {
+        printf(1, "  wake-up latency: %d naps, %d.%d%d ticks late on average\n",
+            naps, late / naps, late * 10 / naps % 10, late * 100 / naps % 10);
+    }
+    exit();
+}
+
+/**
+ * Function that returns the schedticks of the process with the given pid.
+ *
+ * stats: process info from getpinfo()
+ * pid: pid of the process
+ * Return: its schedticks, or 0 if it was not found
+ */
+int schedticks(struct pstat *stats, int pid) {
+    for (int i = 0; i < NPROC; i++) {
+        if (stats->inuse[i] == 1 && stats->pid[i] == pid) {
+            return stats->schedticks[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function that runs the two loops and the sleeping process under a policy
+ * and prints the results.
+ *
+ * policy: SCHED_RR or SCHED_STRIDE
+ * sliceA: timeslice of loop A
+ * sliceB: timeslice of loop B
+ * ticks: number of ticks to run for
+ * Return: 1 if both loops were scheduled, 0 if one got no ticks
+ */
+int run(int policy, int sliceA, int sliceB, int ticks) {
+    setpolicy(policy);
+    printf(1, "%s:\n", policy == SCHED_STRIDE ? "stride" : "round-robin");
+
+    int end = uptime() + ticks;  // tick the run ends on
+    int pidA = fork2(sliceA);  // create loop A with given timeslice
+    if (pidA == 0) {
+        spin();
+    }
+    int pidB = fork2(sliceB);  // create loop B with given timeslice
+    if (pidB == 0) {
+        spin();
+    }
+    int pidN = fork2(1);  // create the sleeping process
+    if (pidN == 0) {
+        napper(end);
+    }
+    if (pidA < 0 || pidB < 0 || pidN < 0) {
+        printf(2, "stridetest: fork2 failed.\n");
+        exit();
+    }
+
+    // count ticks from after all three have started
+    struct pstat stats;
+    getpinfo(&stats);
+    int startA = schedticks(&stats, pidA);
+    int startB = schedticks(&stats, pidB);
+
+    sleep(ticks);  // go to sleep while they run
+    getpinfo(&stats);
+    int ranA = schedticks(&stats, pidA) - startA;  // ticks A was scheduled
+    int ranB = schedticks(&stats, pidB) - startB;  // ticks B was scheduled
+
+    kill(pidA);
+    kill(pidB);
+    wait();
+    wait();
+    wait();
+
+    if (ranA + ranB > 0) {
+        printf(1, "  loop A: %d%% of ticks, entitled to %d%%\n",
+            ranA * 100 / (ranA + ranB), sliceA * 100 / (sliceA + sliceB));
+        printf(1, "  loop B: %d%% of ticks, entitled to %d%%\n",
+            ranB * 100 / (ranA + ranB), sliceB * 100 / (sliceA + sliceB));
+    }
+    return ranA > 0 && ranB > 0;
+}
+
+/**
+ * Main function of the program. Parses arguments, then runs the loops under
+ * round-robin and then stride scheduling, then runs two loops with huge
+ * timeslices under stride scheduling, failing if one of them gets no ticks,
+ * and restores the policy in use before.
+ *
+ * argc: number of command line arguments
+ * argv: array of command line arguments in string form
+ */
+int main(int argc, char *argv[]) {
+    // if there are not 4 arguments (program name, sliceA, sliceB, ticks),
+    // print an error and exit the program
+    if (argc != 4) {
+        printf(2, "stridetest: Invalid command line.\n");
+        printf(2, "proper usage: stridetest <sliceA> <sliceB> <ticks>\n");
+        exit();
+    }
+
+    int sliceA = atoi(argv[1]);  // get timeslice for loop A
+    int sliceB = atoi(argv[2]);  // get timeslice for loop B
+    int ticks = atoi(argv[3]);  // get number of ticks to run for
+    if (sliceA < 1 || sliceB < 1 || ticks < 1) {
+        printf(2, "stridetest: arguments must be positive.\n");
+        exit();
+    }
+
+    int old = setpolicy(SCHED_RR);  // remember the policy in use
+    run(SCHED_RR, sliceA, sliceB, ticks);
+    run(SCHED_STRIDE, sliceA, sliceB, ticks);
+
+    // slices above STRIDE1 (1 << 16) in proc.c still get a stride of 1, so
+    // two such loops must share the cpu
+    int shared = run(SCHED_STRIDE, 100000, 100000, ticks);
+    setpolicy(old);
+    if (!shared) {
+        printf(2, "stridetest: loops with huge timeslices did not share the cpu.\n");
+    }
+    exit();
+}
@@ -109,6 +109,7 @@ extern int sys_setslice(void);
 extern int sys_getslice(void);
 extern int sys_fork2(void);
 extern int sys_getpinfo(void);
+extern int sys_setpolicy(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -138,6 +139,7 @@ static int (*syscalls[])(void) = {
 [SYS_getslice] sys_getslice,
 [SYS_fork2] sys_fork2,
 [SYS_getpinfo] sys_getpinfo,
+[SYS_setpolicy] sys_setpolicy,
 };
 
 void
@@ -24,3 +24,4 @@
 #define SYS_getslice 23
 #define SYS_fork2 24
 #define SYS_getpinfo 25
+#define SYS_setpolicy 26
@@ -175,3 +175,22 @@ sys_getpinfo(void) {
     // call and return value of getpinfo()
     return getpinfo((struct pstat*)struct_pointer);
 }
+
+/**
+ * Function that selects the scheduling policy. Gets argument from kernel,
+ * then calls setpolicy() from proc.c
+ *
+ * Return: -1 if unable to fetch argument, else the value of
+ *         setpolicy(policy)
+ */
+int
+sys_setpolicy(void) {
+    int policy;  // policy to switch to
+
+    // get policy
+    if (argint(0, &policy) < 0) {
+        return -1;  // return -1 if unable
+    }
+
+    return setpolicy(policy);  // call and return value of setpolicy()
+}
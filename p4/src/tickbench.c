@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////////////
+// This File:        tickbench.c
+// Other Files:      loop.c, schedtest.c
+//
+//////////////////////////// 80 columns wide ///////////////////////////////////
+
+/**
+ * tickbench.c
+ * A benchmark of what timer ticks cost a CPU-bound process. A child runs a
+ * loop for a given number of ticks, once with a timeslice of 1, so every tick
+ * ends its slice and goes through the scheduler, and once with a timeslice
+ * as long as the run, so no tick does. The difference in loop iterations per
+ * tick is the cost of the trips through the scheduler.
+ */
+
+#include "types.h"
+#include "user.h"
+#include "pstat.h"
+#include "param.h"
+
+#define CHUNK 10000  // loop iterations between checks of the clock
+
+/**
+ * Function that runs a CPU-bound loop in a child with the given timeslice
+ * and prints how much of the loop it got through per tick.
+ *
+ * slice: timeslice of the child
+ * ticks: number of ticks the child loops for
+ */
+void run(int slice, int ticks) {
+    int pid = fork2(slice);  // create child with given timeslice
+    if (pid < 0) {
+        printf(2, "tickbench: fork2 failed.\n");
+        exit();
+    }
+
+    if (pid == 0) {  // child: loop until the ticks are up
+        volatile int accumulator = 0;  // accumulates results of loop operation
+        int iterations = 0;  // loop iterations done so far
+        int start = uptime();  // tick the run started on
+
+        while (uptime() - start < ticks) {
+            for (int i = 0; i < CHUNK; i++) {
+                accumulator = accumulator * i + i;
+            }
+            iterations += CHUNK;
+        }
+
+        // get number of times this child was switched to
+        struct pstat stats;
+        int switches = 0;
+        if (getpinfo(&stats) == 0) {
+            for (int i = 0; i < NPROC; i++) {
+                if (stats.inuse[i] == 1 && stats.pid[i] == getpid()) {
+                    switches = stats.switches[i];
+                }
+            }
+        }
+
+        printf(1, "slice %d: %d iterations/tick, %d switches in %d ticks\n",
+            slice, iterations / ticks, switches, ticks);
+        exit();
+    }
+
+    wait();  // wait for the child to print its results
+}
+
+/**
+ * Main function of the program. Runs the loop with a timeslice of 1, then
+ * with a timeslice covering the whole run.
+ *
+ * argc: number of command line arguments
+ * argv: array of command line arguments in string form
+ */
+int main(int argc, char *argv[]) {
+    // check number of arguments is correct (should be 2)
+    if (argc != 2) {
+        printf(2, "tickbench: Invalid command line.\n");
+        printf(2, "proper usage: tickbench <# of ticks>\n");
+        exit();
+    }
+
+    int ticks = atoi(argv[1]);  // get the number of ticks to run for
+    if (ticks < 1) {
+        printf(2, "tickbench: # of ticks must be positive.\n");
+        exit();
+    }
+
+    run(1, ticks);  // every tick ends the slice
+    run(ticks + 1, ticks);  // no tick ends the slice
+    exit();
+}
@@ -30,6 +30,7 @@ int setslice(int, int);
 int getslice(int);
 int fork2(int);
 int getpinfo(struct pstat*);
+int setpolicy(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -0,0 +1,277 @@
+//
+// cache.c: Sharded cache of open static files for the web server.
+//
+// Paths hash to one of CACHE_SHARDS shards, each with its own lock, hash
+// chains, byte budget and CLOCK ring, so workers serving different files
+// rarely contend. An entry holds the open fd, both variants of the response
+// header and the size/mtime it was opened with; at most once every
+// CACHE_CHECK_MS a hit re-stats the file and drops the entry if it changed,
+// and forgets that the file had no .gz sibling.
+// Entries are reference counted so one can be evicted while a worker is
+// still sending from its fd.
+//
+
+#include "helper.h"
+#include "cache.h"
+
+#define CACHE_SHARDS 16  // independent locks/tables
+#define CACHE_BUCKETS 64  // hash chains per shard
+#define CACHE_SLOTS 128  // most entries a shard can hold
+#define CACHE_CHECK_MS 1000  // how often a hit revalidates against the file
+
+// one independently locked part of the cache
+typedef struct {
+    pthread_mutex_t lock;  // protects everything below
+    cache_entry *buckets[CACHE_BUCKETS];  // hash chains
+    cache_entry *slots[CACHE_SLOTS];  // CLOCK ring, NULL for free slots
+    int hand;  // next slot the CLOCK hand looks at
+    long used;  // bytes of files in the shard
+} cache_shard;
+
+static cache_shard shards[CACHE_SHARDS];
+static long shard_budget;  // byte limit of each shard, 0 if the cache is off
+
+/**
+ * Function that returns a monotonic timestamp in milliseconds.
+ */
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Function that hashes a path (djb2).
+ */
+static unsigned hash_path(char *path) {
+    unsigned hash = 5381;
+    for (char *c = path; *c != '\0'; c++) {
+        hash = hash * 33 + (unsigned char) *c;
+    }
+    return hash;
+}
+
+/**
+ * Function that finds the chain a path belongs to.
+ *
+ * path: path to look up
+ * shard: set to the shard the path belongs to
+ * Return: head of the path's hash chain
+ */
+static cache_entry **chain_of(char *path, cache_shard **shard) {
+    unsigned hash = hash_path(path);
+    *shard = &shards[hash % CACHE_SHARDS];
+    return &(*shard)->buckets[(hash / CACHE_SHARDS) % CACHE_BUCKETS];
+}
+
+/**
+ * Function that searches a chain for a path.
+ */
+static cache_entry *chain_find(cache_entry *head, char *path) {
+    for (cache_entry *entry = head; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Function that removes an entry from its shard. Caller holds the shard
+ * lock and must drop the table's reference afterwards.
+ */
+static void shard_unlink(cache_shard *shard, cache_entry *entry) {
+    cache_shard *owner;
+    cache_entry **link = chain_of(entry->path, &owner);
+
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    shard->slots[entry->slot] = NULL;
+    shard->used -= entry->size;
+}
+
+/**
+ * Function that frees an entry once nobody references it.
+ */
+static void entry_free(cache_entry *entry) {
+    Close(entry->fd);
+    free(entry->path);
+    free(entry->header[0]);
+    free(entry->header[1]);
+    free(entry);
+}
+
+/**
+ * Function that turns the cache on.
+ *
+ * bytes: most bytes of file data the cache may hold open
+ * Return: 0 on success, -1 if bytes is too small to split across the shards
+ */
+int cache_init(long bytes) {
+    if (bytes < CACHE_SHARDS) {
+        return -1;
+    }
+
+    for (int index = 0; index < CACHE_SHARDS; index++) {
+        pthread_mutex_init(&shards[index].lock, NULL);
+    }
+    shard_budget = bytes / CACHE_SHARDS;
+    return 0;
+}
+
+/**
+ * Function that checks whether cache_init() has been called.
+ *
+ * Return: 1 if the cache is on, else 0
+ */
+int cache_enabled() {
+    return shard_budget > 0;
+}
+
+/**
+ * Function that drops one reference to an entry.
+ *
+ * entry: entry returned by cache_get() or cache_put()
+ */
+void cache_release(cache_entry *entry) {
+    if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        entry_free(entry);
+    }
+}
+
+/**
+ * Function that looks up a file, revalidating it against the filesystem if
+ * it has not been checked for CACHE_CHECK_MS.
+ *
+ * path: filename being requested
+ * tracker: worker's shared memory entry, for the hit/miss counters
+ * Return: the entry with a reference the caller must release, or NULL
+ */
+cache_entry *cache_get(char *path, shm_entry *tracker) {
+    cache_shard *shard;
+    cache_entry **chain = chain_of(path, &shard);
+
+    pthread_mutex_lock(&shard->lock);
+    cache_entry *entry = chain_find(*chain, path);
+    if (entry != NULL) {
+        __atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+        entry->referenced = 1;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (entry == NULL) {
+        tracker->cache_misses++;
+        return NULL;
+    }
+
+    long long now = now_ms();
+    if (now - __atomic_load_n(&entry->checked_ms, __ATOMIC_RELAXED) >= CACHE_CHECK_MS) {
+        struct stat sbuf;
+        if (stat(path, &sbuf) < 0 || sbuf.st_size != entry->size || sbuf.st_ino != entry->ino ||
+                sbuf.st_mtim.tv_sec != entry->mtime.tv_sec ||
+                    sbuf.st_mtim.tv_nsec != entry->mtime.tv_nsec) {
+            // file changed or is gone, forget the entry
+            pthread_mutex_lock(&shard->lock);
+            int cached = (shard->slots[entry->slot] == entry);
+            if (cached) {
+                shard_unlink(shard, entry);
+            }
+            pthread_mutex_unlock(&shard->lock);
+            if (cached) {
+                cache_release(entry);  // table's reference
+            }
+            cache_release(entry);  // ours
+            tracker->cache_misses++;
+            return NULL;
+        }
+        __atomic_store_n(&entry->checked_ms, now, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->gz_sibling, 1, __ATOMIC_RELAXED);  // look again
+    }
+
+    tracker->cache_hits++;
+    return entry;
+}
+
+/**
+ * Function that adds an open file to the cache, evicting entries that have
+ * not been hit since the CLOCK hand last passed them until it fits.
+ *
+ * path: filename the file was opened as
+ * fd: open file; owned by the cache if the call succeeds
+ * sbuf: stat of the file
+ * header: response headers without and with keep-alive, copied
+ * tracker: worker's shared memory entry, for the eviction counter
+ * Return: the entry with a reference the caller must release, or NULL if
+ *         the file is too large to cache (fd is left to the caller)
+ */
+cache_entry *cache_put(char *path, int fd, struct stat *sbuf, char *header[2],
+        shm_entry *tracker) {
+    if (sbuf->st_size > shard_budget) {
+        return NULL;
+    }
+
+    cache_entry *entry = malloc(sizeof(cache_entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->path = strdup(path);
+    entry->header[0] = strdup(header[0]);
+    entry->header[1] = strdup(header[1]);
+    if (entry->path == NULL || entry->header[0] == NULL || entry->header[1] == NULL) {
+        free(entry->path);
+        free(entry->header[0]);
+        free(entry->header[1]);
+        free(entry);
+        return NULL;
+    }
+    entry->fd = fd;
+    entry->size = sbuf->st_size;
+    entry->mtime = sbuf->st_mtim;
+    entry->ino = sbuf->st_ino;
+    entry->checked_ms = now_ms();
+    entry->gz_sibling = 1;
+    entry->refs = 2;  // table and caller
+    entry->referenced = 1;
+
+    cache_shard *shard;
+    cache_entry **chain = chain_of(path, &shard);
+
+    pthread_mutex_lock(&shard->lock);
+    cache_entry *existing = chain_find(*chain, path);
+    if (existing != NULL) {  // another worker cached it first, use theirs
+        __atomic_add_fetch(&existing->refs, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&shard->lock);
+        entry_free(entry);  // closes fd
+        return existing;
+    }
+
+    // sweep until there is a free slot and room for the file
+    while (1) {
+        int index = shard->hand;
+        cache_entry *victim = shard->slots[index];
+        shard->hand = (shard->hand + 1) % CACHE_SLOTS;
+
+        if (victim != NULL) {
+            if (victim->referenced) {  // second chance
+                victim->referenced = 0;
+                continue;
+            }
+            shard_unlink(shard, victim);
+            cache_release(victim);  // table's reference
+            tracker->cache_evictions++;
+        }
+        if (shard->used + entry->size <= shard_budget) {
+            entry->slot = index;
+            break;
+        }
+    }
+
+    shard->slots[entry->slot] = entry;
+    entry->next = *chain;
+    *chain = entry;
+    shard->used += entry->size;
+    pthread_mutex_unlock(&shard->lock);
+    return entry;
+}
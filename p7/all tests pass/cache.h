@@ -0,0 +1,33 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+//
+// cache.h: cache of open static files used with -c. Each entry keeps the
+// file open along with its pre-built response headers, so a hit is served
+// without stat(), open() or building a header.
+//
+
+// one cached file, shared by the table and every worker serving it
+typedef struct cache_entry {
+    char *path;  // filename the entry was looked up by
+    int fd;  // open file, sent with sendfile()
+    off_t size;  // file size when opened
+    struct timespec mtime;  // modification time when opened
+    ino_t ino;  // inode, part of the ETag
+    char *header[2];  // response headers, [1] for keep-alive connections
+    long long checked_ms;  // when size/mtime were last compared with the file
+    int gz_sibling;  // 0 once no usable .gz sibling was found, until the next check
+    int refs;  // one for the table plus one per worker using the entry
+    int referenced;  // CLOCK bit, set on every hit
+    int slot;  // index in the shard's clock
+    struct cache_entry *next;  // hash chain
+} cache_entry;
+
+int cache_init(long bytes);
+int cache_enabled();
+cache_entry *cache_get(char *path, shm_entry *tracker);
+cache_entry *cache_put(char *path, int fd, struct stat *sbuf, char *header[2],
+    shm_entry *tracker);
+void cache_release(cache_entry *entry);
+
+#endif
@@ -0,0 +1,154 @@
+//
+// cgi_bench.c: Microbenchmark for serving dynamic requests.
+//
+// Runs output.cgi with QUERY_STRING=0 (no spinning) the way the server does:
+// once with a fork and exec per request, and once through the persistent
+// CGI pool used with -g. Each request's "client" is one end of a socketpair
+// that is read until the program closes it. Reports requests per second and
+// the median and 99th percentile request latency.
+//
+// To run:
+//  cgi_bench [requests] [threads] [procs]
+//
+
+#include "helper.h"
+#include "cgipool.h"
+
+#define MODE_FORK 0  // fork + exec per request
+#define MODE_POOL 1  // persistent processes
+
+int mode;  // MODE_* being benchmarked
+int requests;  // requests per thread
+long long *latency;  // per-request latency (ns)
+
+/**
+ * Function that returns a monotonic timestamp in nanoseconds.
+ */
+long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Function that serves one request and reads the response until EOF.
+ *
+ * Return: 0 on success, -1 if no response came back
+ */
+int one_request() {
+    int sv[2];
+    char buf[MAXBUF], *argv[] = {"./output.cgi", NULL};
+    ssize_t n, total = 0;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        unix_error("socketpair error");
+    }
+
+    if (mode == MODE_POOL) {
+        if (cgi_pool_serve(argv[0], "0", sv[0]) != 0) {
+            app_error("cgi_pool_serve failed");
+        }
+        Close(sv[0]);
+    } else {
+        pid_t pid = Fork();
+        if (pid == 0) {
+            Setenv("QUERY_STRING", "0", 1);
+            Dup2(sv[0], STDOUT_FILENO);
+            Execve(argv[0], argv, environ);
+        }
+        Close(sv[0]);
+        waitpid(pid, NULL, 0);
+    }
+
+    while ((n = read(sv[1], buf, sizeof(buf))) > 0) {
+        total += n;
+    }
+    Close(sv[1]);
+    return total > 0 ? 0 : -1;
+}
+
+/**
+ * Thread that sends its share of the requests back to back.
+ *
+ * arg: index of the thread
+ * Return: 0 to end thread
+ */
+void *client(void *arg) {
+    long long *mine = latency + (long) arg * requests;
+
+    for (int index = 0; index < requests; index++) {
+        long long start = now_ns();
+        if (one_request() != 0) {
+            app_error("empty response");
+        }
+        mine[index] = now_ns() - start;
+    }
+    return 0;
+}
+
+/**
+ * Function used by qsort to order latencies.
+ */
+int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long*) a;
+    long long y = *(const long long*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Main function of the benchmark.
+ *
+ * argc: number of command line arguments
+ * argv: array of command line arguments as strings
+ * Return: 0
+ */
+int main(int argc, char *argv[]) {
+    int threads = 4, procs = 4;
+
+    requests = 500;
+    if (argc > 1) {
+        requests = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        threads = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        procs = atoi(argv[3]);
+    }
+    if (requests <= 0 || threads <= 0 || procs <= 0) {
+        fprintf(stderr, "Usage: %s [requests] [threads] [procs]\n", argv[0]);
+        exit(1);
+    }
+    if (access("./output.cgi", X_OK) != 0) {
+        fprintf(stderr, "Run from the directory holding output.cgi.\n");
+        exit(1);
+    }
+
+    if (cgi_pool_init(procs) != 0) {
+        app_error("cgi_pool_init failed");
+    }
+    latency = malloc(sizeof(long long) * requests * threads);
+
+    printf("%-6s %10s %12s %12s\n", "mode", "req/s", "p50_us", "p99_us");
+    char *names[] = {"fork", "pool"};
+    for (mode = MODE_FORK; mode <= MODE_POOL; mode++) {
+        pthread_t pool[threads];
+        int total = requests * threads;
+
+        long long start = now_ns();
+        for (long index = 0; index < threads; index++) {
+            pthread_create(&pool[index], NULL, client, (void*) index);
+        }
+        for (int index = 0; index < threads; index++) {
+            pthread_join(pool[index], NULL);
+        }
+        long long elapsed = now_ns() - start;
+
+        qsort(latency, total, sizeof(long long), compare_ll);
+        printf("%-6s %10.0f %12.1f %12.1f\n", names[mode], total / (elapsed / 1e9),
+            latency[total / 2] / 1000.0, latency[(int) (total * 0.99)] / 1000.0);
+    }
+
+    free(latency);
+    return 0;
+}
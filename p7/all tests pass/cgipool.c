@@ -0,0 +1,351 @@
+//
+// cgipool.c: Persistent CGI processes for the web server.
+//
+// Each CGI program gets up to <procs> long-lived processes, started on
+// demand with CGI_PERSISTENT set and one end of a SOCK_SEQPACKET socketpair
+// as fd CGI_SOCKET_FD. A request is one packet holding QUERY_STRING, with
+// the client socket attached as SCM_RIGHTS; the process writes the rest of
+// the response straight to the client, closes it and sends back a one byte
+// packet. A pool thread waits on every process socket with epoll, puts
+// processes that finished back on their program's idle list and notices
+// processes that died.
+//
+
+#include "helper.h"
+#include "cgipool.h"
+#include <sys/epoll.h>
+
+// one long-lived CGI process
+typedef struct cgi_proc {
+    pid_t pid;  // process id
+    int sock;  // server end of the socketpair
+    struct cgi_program *program;  // program the process runs
+    int *inflight;  // counter of the worker whose request is running, NULL if idle
+    struct cgi_proc *next;  // idle list
+} cgi_proc;
+
+// the processes of one CGI program
+typedef struct cgi_program {
+    char *path;  // filename as requested, e.g. "./output.cgi"
+    int procs;  // processes running
+    cgi_proc *idle;  // processes waiting for a request
+    struct cgi_program *next;  // list of programs
+} cgi_program;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;  // protects the pool
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;  // a process or in-flight slot freed
+static cgi_program *programs;  // every program seen so far
+static int max_procs;  // processes per program, 0 if the pool is off
+static int pool_epfd;  // epoll instance watching every process socket
+static __thread int inflight;  // requests this worker has dispatched and not seen finish
+
+/**
+ * Function that starts a persistent process of a program. Caller holds
+ * pool_lock.
+ *
+ * program: program to start
+ * Return: the new process, or NULL on failure
+ */
+static cgi_proc *proc_spawn(cgi_program *program) {
+    int sv[2];
+    char *argv[] = {program->path, NULL};
+    struct epoll_event ev;
+
+    cgi_proc *proc = malloc(sizeof(cgi_proc));
+    if (proc == NULL) {
+        return NULL;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        free(proc);
+        return NULL;
+    }
+
+    // build the environment before forking so the child only calls
+    // async-signal-safe functions
+    int count = 0;
+    while (environ[count] != NULL) {
+        count++;
+    }
+    char **envp = malloc(sizeof(char*) * (count + 2));
+    if (envp == NULL) {
+        Close(sv[0]);
+        Close(sv[1]);
+        free(proc);
+        return NULL;
+    }
+    memcpy(envp, environ, sizeof(char*) * count);
+    envp[count] = CGI_PERSISTENT_ENV "=1";
+    envp[count + 1] = NULL;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // child: socket on CGI_SOCKET_FD and nothing else of the server's,
+        // so it never holds a client connection open after the server
+        // closes it
+        dup2(sv[1], CGI_SOCKET_FD);
+        close_range(3, ~0U, 0);
+        execve(program->path, argv, envp);
+        _exit(127);
+    }
+    free(envp);
+    Close(sv[1]);
+    if (pid < 0) {
+        Close(sv[0]);
+        free(proc);
+        return NULL;
+    }
+
+    proc->pid = pid;
+    proc->sock = sv[0];
+    proc->program = program;
+    proc->inflight = NULL;
+    proc->next = NULL;
+    program->procs++;
+
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = proc;
+    if (epoll_ctl(pool_epfd, EPOLL_CTL_ADD, proc->sock, &ev) < 0) {
+        unix_error("epoll_ctl error");
+    }
+    return proc;
+}
+
+/**
+ * Function that forgets a process that exited. Only the pool thread calls
+ * it, so no worker can be using the process. Caller holds pool_lock.
+ *
+ * proc: process to remove
+ */
+static void proc_remove(cgi_proc *proc) {
+    cgi_proc **link = &proc->program->idle;
+
+    while (*link != NULL && *link != proc) {  // unlink if it died while idle
+        link = &(*link)->next;
+    }
+    if (*link == proc) {
+        *link = proc->next;
+    }
+    if (proc->inflight != NULL) {
+        (*proc->inflight)--;
+    }
+    proc->program->procs--;
+    Close(proc->sock);  // also removes it from epoll
+    kill(proc->pid, SIGKILL);
+    waitpid(proc->pid, NULL, 0);
+    free(proc);
+    pthread_cond_broadcast(&pool_cond);
+}
+
+/**
+ * Function run by the pool thread. Returns processes that finished a
+ * request to their idle list and removes processes that exited.
+ *
+ * arg: unused
+ * Return: 0 (never reached)
+ */
+static void *pool_thread(void *arg) {
+    struct epoll_event events[16];
+
+    while (1) {
+        int n = epoll_wait(pool_epfd, events, 16, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            unix_error("epoll_wait error");
+        }
+
+        for (int index = 0; index < n; index++) {
+            cgi_proc *proc = events[index].data.ptr;
+            char done;
+            ssize_t rc = recv(proc->sock, &done, 1, MSG_DONTWAIT);
+
+            if (rc < 0 && (errno == EAGAIN || errno == EINTR)) {
+                continue;
+            }
+            pthread_mutex_lock(&pool_lock);
+            if (rc == 1 && proc->inflight != NULL) {  // request finished, process is idle again
+                (*proc->inflight)--;
+                proc->inflight = NULL;
+                proc->next = proc->program->idle;
+                proc->program->idle = proc;
+                pthread_cond_broadcast(&pool_cond);
+            } else if (rc <= 0) {  // process exited or crashed
+                proc_remove(proc);
+            }
+            pthread_mutex_unlock(&pool_lock);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Function that turns the pool on.
+ *
+ * procs: most persistent processes per CGI program
+ * Return: 0 on success, -1 on failure
+ */
+int cgi_pool_init(int procs) {
+    pthread_t thread;
+
+    if (procs <= 0) {
+        return -1;
+    }
+    if ((pool_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        return -1;
+    }
+    if (pthread_create(&thread, NULL, pool_thread, NULL) != 0) {
+        Close(pool_epfd);
+        return -1;
+    }
+    max_procs = procs;
+    return 0;
+}
+
+/**
+ * Function that checks whether cgi_pool_init() has been called.
+ *
+ * Return: 1 if the pool is on, else 0
+ */
+int cgi_pool_enabled() {
+    return max_procs > 0;
+}
+
+/**
+ * Function that hands a dynamic request to a persistent process of its
+ * program, starting one if the program has fewer than <procs>. Waits while
+ * the calling worker already has CGI_MAX_INFLIGHT requests running or every
+ * process of the program is busy. The caller has sent the status line and
+ * may close its copy of clientfd as soon as this returns.
+ *
+ * filename: CGI program
+ * cgiargs: QUERY_STRING
+ * clientfd: client socket the process writes the response to
+ * Return: 0 if the request was handed off, -1 if it must be served some
+ *         other way
+ */
+int cgi_pool_serve(char *filename, char *cgiargs, int clientfd) {
+    cgi_program *program;
+    cgi_proc *proc = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    while (inflight >= CGI_MAX_INFLIGHT) {
+        pthread_cond_wait(&pool_cond, &pool_lock);
+    }
+
+    for (program = programs; program != NULL; program = program->next) {
+        if (strcmp(program->path, filename) == 0) {
+            break;
+        }
+    }
+    if (program == NULL) {  // first request for this program
+        program = calloc(1, sizeof(cgi_program));
+        if (program == NULL || (program->path = strdup(filename)) == NULL) {
+            free(program);
+            pthread_mutex_unlock(&pool_lock);
+            return -1;
+        }
+        program->next = programs;
+        programs = program;
+    }
+
+    while (program->idle == NULL && program->procs >= max_procs) {
+        pthread_cond_wait(&pool_cond, &pool_lock);
+    }
+    if (program->idle != NULL) {
+        proc = program->idle;
+        program->idle = proc->next;
+    } else if ((proc = proc_spawn(program)) == NULL) {
+        pthread_mutex_unlock(&pool_lock);
+        return -1;
+    }
+    proc->inflight = &inflight;
+    inflight++;
+
+    // one packet: the query string, with the client socket attached
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { cgiargs, strlen(cgiargs) + 1 };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &clientfd, sizeof(int));
+
+    // the process is idle so its socket has room; sending under the lock
+    // means the pool thread never frees a process a worker is still using
+    ssize_t rc;
+    while ((rc = sendmsg(proc->sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0 &&
+            errno == EINTR) {
+    }
+    if (rc < 0) {  // process is gone, the pool thread will remove it
+        inflight--;
+        proc->inflight = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return rc < 0 ? -1 : 0;
+}
+
+/**
+ * Function that waits until every request the calling worker handed to the
+ * pool has finished. A worker calls it before its thread exits, since the
+ * processes serving those requests count them in its thread-local inflight.
+ */
+void cgi_pool_drain() {
+    pthread_mutex_lock(&pool_lock);
+    while (inflight > 0) {
+        pthread_cond_wait(&pool_cond, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/**
+ * Function used by a persistent CGI program to wait for its next request.
+ *
+ * sock: the pool socket (CGI_SOCKET_FD)
+ * query: filled in with QUERY_STRING
+ * maxlen: size of query
+ * clientfd: set to the client socket to write the response to
+ * Return: 1 if a request arrived, 0 if the server went away
+ */
+int cgi_recv_request(int sock, char *query, int maxlen, int *clientfd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { query, maxlen - 1 };
+    struct msghdr msg = { 0 };
+    ssize_t n;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    query[n] = '\0';
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS) {
+        return 0;
+    }
+    memcpy(clientfd, CMSG_DATA(cmsg), sizeof(int));
+    return 1;
+}
+
+/**
+ * Function used by a persistent CGI program to report that it has finished
+ * a request and closed the client socket.
+ *
+ * sock: the pool socket (CGI_SOCKET_FD)
+ * Return: 0 on success, -1 if the server went away
+ */
+int cgi_send_done(int sock) {
+    char done = 1;
+    return send(sock, &done, 1, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
@@ -0,0 +1,26 @@
+#ifndef __CGIPOOL_H__
+#define __CGIPOOL_H__
+
+//
+// cgipool.h: pool of persistent CGI processes used with -g. Instead of a
+// fork and exec per dynamic request, a worker passes QUERY_STRING and the
+// client socket to an idle long-lived process of the requested program over
+// a Unix socket, and goes back to serving while the process answers.
+//
+
+#define CGI_MAX_INFLIGHT 4  // most dispatched but unfinished requests per worker
+
+// environment variable set for programs started by the pool; such a program
+// reads requests from the Unix socket on fd CGI_SOCKET_FD instead of
+// exiting after one response
+#define CGI_PERSISTENT_ENV "CGI_PERSISTENT"
+#define CGI_SOCKET_FD 0
+
+int cgi_pool_init(int procs);
+int cgi_pool_enabled();
+int cgi_pool_serve(char *filename, char *cgiargs, int clientfd);
+void cgi_pool_drain();
+int cgi_recv_request(int sock, char *query, int maxlen, int *clientfd);
+int cgi_send_done(int sock);
+
+#endif
@@ -7,6 +7,34 @@
  * Sends one HTTP request to the specified HTTP server.
  * Prints out the HTTP response.
  *
+ * Load generation mode, for measuring the server:
+ *      client <host> <port> -u weight:uri [-u weight:uri ...] [-t threads]
+ *             [-c connections] [-d seconds] [-r rate] [-k 0|1] [-z 0|1]
+ *             [-p server_pid]
+ *
+ *  -u: a URI to request, picked with probability proportional to its weight
+ *      (e.g. -u 9:/home.html -u 1:/output.cgi?0). Repeat for a mix.
+ *  -t: threads sending requests (default 1); each drives its share of the
+ *      connections with epoll.
+ *  -c: connections kept open (default 1), each with one request in flight.
+ *  -d: seconds to run (default 10).
+ *  -r: open-loop mode: start rate requests per second in total on a fixed
+ *      schedule, whether or not earlier responses have come back. Latency
+ *      is measured from when a request was due, not from when it could be
+ *      sent, so a stalled server is charged for the requests it delayed
+ *      (no coordinated omission). Without -r the client runs closed-loop:
+ *      each connection sends its next request as soon as the last response
+ *      arrives.
+ *  -k: 1 (default) to reuse a connection when the server keeps it alive,
+ *      0 to send "Connection: close" and open a connection per request.
+ *  -z: 1 to send "Accept-Encoding: gzip", 0 (default) not to.
+ *  -p: pid of the server, when it runs on this machine: its CPU time over
+ *      the run is reported per request.
+ *
+ * Prints throughput every second, then the throughput, bytes received per
+ * response, error count and latency percentiles of each URI and an
+ * HDR-style percentile distribution of all latencies.
+ *
  * CS537: For testing your server, you will want to modify this client.  
  * For example:
  * 
@@ -22,6 +50,7 @@
  */
 
 #include "helper.h"
+#include <sys/epoll.h>
 
 /*
  * Send an HTTP request for the specified file 
@@ -71,12 +100,544 @@ void clientPrint(int fd)
   }
 }
 
+/**********************
+ * Load generation mode
+ **********************/
+
+#define LOAD_MAX_URIS 16   /* most -u options */
+#define LOAD_DRAIN_NS 2000000000LL  /* how long to wait for late responses */
+#define HIST_SUB_BITS 6    /* 64 sub-buckets per power of two: < 1.6% error */
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 40    /* latencies up to 2^40 us */
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/* Log-linear histogram of latencies in microseconds, like HdrHistogram */
+typedef struct {
+  long long counts[HIST_BUCKETS];
+  long long total;
+  long long sum;
+  long long max;
+} histogram;
+
+/* A URI of the request mix */
+typedef struct {
+  char *path;
+  int weight;
+} load_uri;
+
+/* One connection and the request it has in flight */
+typedef struct {
+  int fd;              /* -1 if not connected */
+  int busy;            /* a request has been sent and not fully answered */
+  int used;            /* responses already read on this connection */
+  int uri;             /* index of the URI requested */
+  long long due;       /* when the request was (or the next one is) due, ns */
+  char buf[MAXBUF];    /* response header */
+  int len;             /* bytes in buf */
+  int header;          /* 1 once the whole header has been read */
+  int status;          /* HTTP status code */
+  int keep;            /* server will keep the connection open */
+  long long remaining; /* body bytes still to come, -1 to read until EOF */
+} load_conn;
+
+/* One sending thread and what it measured */
+typedef struct {
+  pthread_t thread;
+  load_conn *conns;    /* the thread's connections */
+  int count;           /* number of connections */
+  unsigned seed;       /* rand_r state for picking URIs */
+  histogram hist[LOAD_MAX_URIS];  /* latencies of successful requests */
+  long long errors[LOAD_MAX_URIS];  /* failed requests */
+  long long bytes;     /* response bytes read */
+} load_thread;
+
+load_uri uris[LOAD_MAX_URIS];
+int num_uris, total_weight;
+char *load_host;
+struct sockaddr_in load_addr;
+int load_keep = 1;           /* -k */
+int load_gzip;               /* -z */
+pid_t load_pid;              /* -p, 0 if not given */
+double load_rate;            /* -r, 0 for closed-loop */
+long long load_period;       /* open loop: ns between requests on one connection */
+long long load_start, load_end;  /* when to start and stop sending, ns */
+long long completed, failed; /* responses so far, updated atomically */
+
+long long now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Histogram bucket of a value: exact below HIST_SUB, then HIST_SUB buckets
+ * per power of two
+ */
+int hist_index(long long value)
+{
+  int exp;
+
+  if (value >= (1LL << HIST_MAX_EXP))
+    value = (1LL << HIST_MAX_EXP) - 1;
+  if (value < HIST_SUB)
+    return value;
+  exp = 63 - __builtin_clzll(value);
+  return (exp - HIST_SUB_BITS + 1) * HIST_SUB + (value >> (exp - HIST_SUB_BITS)) - HIST_SUB;
+}
+
+/*
+ * Highest value that falls in a histogram bucket
+ */
+long long hist_value(int index)
+{
+  int exp, sub;
+
+  if (index < HIST_SUB)
+    return index;
+  exp = index / HIST_SUB + HIST_SUB_BITS - 1;
+  sub = index % HIST_SUB + HIST_SUB;
+  return ((long long) (sub + 1) << (exp - HIST_SUB_BITS)) - 1;
+}
+
+void hist_record(histogram *h, long long value)
+{
+  h->counts[hist_index(value)]++;
+  h->total++;
+  h->sum += value;
+  if (value > h->max)
+    h->max = value;
+}
+
+void hist_merge(histogram *dst, histogram *src)
+{
+  for (int index = 0; index < HIST_BUCKETS; index++)
+    dst->counts[index] += src->counts[index];
+  dst->total += src->total;
+  dst->sum += src->sum;
+  if (src->max > dst->max)
+    dst->max = src->max;
+}
+
+/*
+ * Smallest latency that at least percentile % of the values do not exceed
+ */
+long long hist_percentile(histogram *h, double percentile)
+{
+  long long want = (long long) (percentile / 100.0 * h->total + 0.5), seen = 0;
+
+  if (want < 1)
+    want = 1;
+  for (int index = 0; index < HIST_BUCKETS; index++) {
+    seen += h->counts[index];
+    if (seen >= want)
+      return hist_value(index) < h->max ? hist_value(index) : h->max;
+  }
+  return h->max;
+}
+
+/*
+ * Print the distribution the way HdrHistogram does: twice as many rows for
+ * every halving of the tail, down to the largest value
+ */
+void hist_print(histogram *h)
+{
+  printf("%12s %12s %12s %16s\n", "Value(us)", "Percentile", "TotalCount", "1/(1-Percentile)");
+  for (double tail = 1.0; ; tail *= 0.840896415) {  /* 4 rows per halving */
+    double percentile = 100.0 * (1.0 - tail);
+    long long value = hist_percentile(h, percentile), count = 0;
+
+    for (int index = 0; index < HIST_BUCKETS && hist_value(index) <= value; index++)
+      count += h->counts[index];
+    if (count >= h->total || tail * h->total < 1) {
+      printf("%12lld %12.6f %12lld %16s\n", h->max, 1.0, h->total, "inf");
+      break;
+    }
+    printf("%12lld %12.6f %12lld %16.2f\n", value, percentile / 100, count, 1 / tail);
+  }
+  printf("#[Mean = %.1f, Max = %lld, Total count = %lld]\n",
+         h->total ? (double) h->sum / h->total : 0.0, h->max, h->total);
+}
+
+/*
+ * Close a connection so the next request opens a new one
+ */
+void load_disconnect(load_conn *conn)
+{
+  if (conn->fd >= 0)
+    close(conn->fd);  /* also removes it from epoll */
+  conn->fd = -1;
+  conn->used = 0;
+}
+
+/*
+ * Send the request conn->uri on conn, connecting first if needed.
+ * Returns 0 on success, -1 if the server could not be reached.
+ */
+int load_send(load_conn *conn, int epfd)
+{
+  char buf[MAXLINE];
+  int len;
+  struct epoll_event ev;
+
+  if (conn->fd < 0) {
+    if ((conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+      return -1;
+    if (connect(conn->fd, (struct sockaddr *) &load_addr, sizeof(load_addr)) < 0) {
+      load_disconnect(conn);
+      return -1;
+    }
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+  }
+
+  len = sprintf(buf, "GET %s HTTP/1.1\r\nHost: %s\r\n%s%s\r\n", uris[conn->uri].path,
+                load_host, load_keep ? "" : "Connection: close\r\n",
+                load_gzip ? "Accept-Encoding: gzip\r\n" : "");
+  if (send(conn->fd, buf, len, MSG_NOSIGNAL) != len) {
+    load_disconnect(conn);
+    return -1;
+  }
+  conn->busy = 1;
+  conn->len = 0;
+  conn->header = 0;
+  return 0;
+}
+
+/*
+ * Record the outcome of the request in flight on conn and get the
+ * connection ready for the next one
+ */
+void load_finish(load_thread *self, load_conn *conn, int ok)
+{
+  long long latency = (now_ns() - conn->due) / 1000;
+
+  if (ok && conn->status == 200) {
+    hist_record(&self->hist[conn->uri], latency);
+  } else {
+    self->errors[conn->uri]++;
+    __atomic_add_fetch(&failed, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_add_fetch(&completed, 1, __ATOMIC_RELAXED);
+
+  conn->busy = 0;
+  conn->used++;
+  if (!ok || !conn->keep || conn->remaining != 0 || !load_keep)
+    load_disconnect(conn);
+  if (load_rate > 0)
+    conn->due += load_period;
+}
+
+/*
+ * Parse a complete response header in conn->buf
+ */
+void load_parse_header(load_conn *conn, char *end)
+{
+  char *field;
+  long long length = -1;
+
+  *end = '\0';
+  conn->status = 0;
+  sscanf(conn->buf, "HTTP/%*s %d", &conn->status);
+  if ((field = strcasestr(conn->buf, "\r\nContent-Length:")) != NULL)
+    length = atoll(field + 17);
+  conn->keep = strcasestr(conn->buf, "\r\nConnection: keep-alive") != NULL;
+  conn->remaining = length < 0 ? -1 : length - (conn->len - (end + 4 - conn->buf));
+  conn->header = 1;
+}
+
+/*
+ * Read what has arrived on conn
+ */
+void load_read(load_thread *self, load_conn *conn, int epfd, char *scratch)
+{
+  ssize_t n;
+  char *end;
+
+  if (!conn->header) {
+    n = read(conn->fd, conn->buf + conn->len, MAXBUF - 1 - conn->len);
+  } else {
+    n = read(conn->fd, scratch, MAXBUF);
+  }
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+  if (n > 0)
+    self->bytes += n;
+
+  if (n <= 0) {
+    if (!conn->header && conn->len == 0 && conn->used > 0) {
+      /* the server closed an idle keep-alive connection; try a new one */
+      load_disconnect(conn);
+      if (load_send(conn, epfd) < 0)
+        load_finish(self, conn, 0);
+    } else if (conn->header && conn->remaining == -1 && n == 0) {
+      conn->remaining = 0;  /* body ended with the connection */
+      conn->keep = 0;
+      load_finish(self, conn, 1);
+    } else {
+      load_finish(self, conn, 0);
+    }
+    return;
+  }
+
+  if (!conn->header) {
+    conn->len += n;
+    conn->buf[conn->len] = '\0';
+    if ((end = strstr(conn->buf, "\r\n\r\n")) == NULL) {
+      if (conn->len == MAXBUF - 1)
+        load_finish(self, conn, 0);  /* header too large */
+      return;
+    }
+    load_parse_header(conn, end);
+  } else if (conn->remaining > 0) {
+    conn->remaining -= n;
+  }
+  if (conn->remaining == 0)
+    load_finish(self, conn, 1);
+  else if (conn->remaining < -1)
+    load_finish(self, conn, 0);  /* more body than Content-Length said */
+}
+
+/*
+ * Thread that drives its connections until load_end, then waits up to
+ * LOAD_DRAIN_NS for the responses still in flight
+ */
+void *load_worker(void *arg)
+{
+  load_thread *self = arg;
+  struct epoll_event events[64];
+  char scratch[MAXBUF];
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  if (epfd < 0)
+    unix_error("epoll_create1 error");
+
+  while (1) {
+    long long now = now_ns(), next = load_end + LOAD_DRAIN_NS;
+    int busy = 0;
+
+    for (int index = 0; index < self->count; index++) {
+      load_conn *conn = &self->conns[index];
+
+      if (!conn->busy && now < load_end) {
+        if (load_rate > 0 && conn->due > now) {
+          next = conn->due < next ? conn->due : next;  /* not due yet */
+          continue;
+        }
+        if (load_rate == 0)
+          conn->due = now;
+        conn->uri = 0;
+        for (int pick = rand_r(&self->seed) % total_weight;
+             pick >= uris[conn->uri].weight; conn->uri++)
+          pick -= uris[conn->uri].weight;
+        if (load_send(conn, epfd) < 0)
+          load_finish(self, conn, 0);
+      }
+      busy += conn->busy;
+    }
+    if (now >= load_end && (busy == 0 || now >= load_end + LOAD_DRAIN_NS))
+      break;
+    if (load_rate == 0 || next > load_end + LOAD_DRAIN_NS)
+      next = now + 100000000LL;  /* wake up at least every 100 ms */
+
+    struct timespec timeout = { 0, next > now ? next - now : 0 };
+    if (timeout.tv_nsec >= 1000000000LL)
+      timeout.tv_nsec = 999999999;
+    int n = epoll_pwait2(epfd, events, 64, &timeout, NULL);
+    for (int index = 0; index < n; index++)
+      load_read(self, events[index].data.ptr, epfd, scratch);
+  }
+
+  for (int index = 0; index < self->count; index++)
+    if (self->conns[index].busy) {  /* never answered */
+      self->conns[index].busy = 0;
+      self->errors[self->conns[index].uri]++;
+    }
+  for (int index = 0; index < self->count; index++)
+    load_disconnect(&self->conns[index]);
+  Close(epfd);
+  return NULL;
+}
+
+/*
+ * CPU time a process has used so far, in seconds, or -1 if unknown
+ */
+double load_cpu(pid_t pid)
+{
+  char path[64], buf[MAXLINE], *end;
+  unsigned long utime, stime;
+  FILE *file;
+
+  sprintf(path, "/proc/%d/stat", (int) pid);
+  if ((file = fopen(path, "r")) == NULL)
+    return -1;
+  end = fgets(buf, sizeof(buf), file) ? strrchr(buf, ')') : NULL;  /* after the name */
+  fclose(file);
+  if (end == NULL ||
+      sscanf(end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+    return -1;
+  return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+void load_usage(char *prog)
+{
+  fprintf(stderr, "Usage: %s <host> <port> -u weight:uri [-u weight:uri ...] [-t threads] "
+          "[-c connections] [-d seconds] [-r rate] [-k 0|1] [-z 0|1] [-p server_pid]\n", prog);
+  exit(1);
+}
+
+/*
+ * Run the load generator and print its report
+ */
+int load_main(int argc, char *argv[])
+{
+  int threads = 1, conns = 1, seconds = 10;
+  struct addrinfo hints = { 0 }, *addr;
+  load_thread *pool;
+  load_conn *all;
+  histogram *total;
+  long long errors = 0, bytes = 0, prev = 0;
+  double cpu = -1;
+
+  load_host = argv[1];
+  if (argc % 2 != 1)
+    load_usage(argv[0]);
+  for (int index = 3; index < argc; index += 2) {
+    char *flag = argv[index], *value = argv[index + 1], *colon;
+
+    if (!strcmp(flag, "-u")) {  /* weight:uri */
+      if (num_uris == LOAD_MAX_URIS || (colon = strchr(value, ':')) == NULL ||
+          atoi(value) <= 0 || colon[1] != '/')
+        load_usage(argv[0]);
+      uris[num_uris].weight = atoi(value);
+      uris[num_uris].path = colon + 1;
+      total_weight += uris[num_uris++].weight;
+    } else if (!strcmp(flag, "-t")) {
+      threads = atoi(value);
+    } else if (!strcmp(flag, "-c")) {
+      conns = atoi(value);
+    } else if (!strcmp(flag, "-d")) {
+      seconds = atoi(value);
+    } else if (!strcmp(flag, "-r")) {
+      load_rate = atof(value);
+    } else if (!strcmp(flag, "-k")) {
+      load_keep = atoi(value);
+    } else if (!strcmp(flag, "-z")) {
+      load_gzip = atoi(value);
+    } else if (!strcmp(flag, "-p")) {
+      load_pid = atoi(value);
+    } else {
+      load_usage(argv[0]);
+    }
+  }
+  if (num_uris == 0 || threads <= 0 || conns < threads || seconds <= 0 || load_rate < 0)
+    load_usage(argv[0]);
+
+  /* resolve once; gethostbyname is not thread-safe */
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(load_host, argv[2], &hints, &addr) != 0)
+    app_error("could not resolve host");
+  memcpy(&load_addr, addr->ai_addr, sizeof(load_addr));
+  freeaddrinfo(addr);
+
+  pool = calloc(threads, sizeof(load_thread));
+  all = calloc(conns, sizeof(load_conn));
+  total = calloc(num_uris + 1, sizeof(histogram));
+  if (pool == NULL || all == NULL || total == NULL)
+    app_error("out of memory");
+
+  /* open loop: each connection sends every conns/rate seconds, staggered */
+  if (load_pid > 0)
+    cpu = load_cpu(load_pid);
+  load_start = now_ns();
+  load_end = load_start + seconds * 1000000000LL;
+  if (load_rate > 0)
+    load_period = (long long) (conns * 1e9 / load_rate);
+  for (int index = 0; index < conns; index++) {
+    all[index].fd = -1;
+    all[index].due = load_start + (long long) (index * 1e9 / (load_rate > 0 ? load_rate : 1));
+  }
+  for (int index = 0, first = 0; index < threads; index++) {
+    pool[index].conns = all + first;
+    pool[index].count = conns / threads + (index < conns % threads);
+    pool[index].seed = index + 1;
+    first += pool[index].count;
+    pthread_create(&pool[index].thread, NULL, load_worker, &pool[index]);
+  }
+
+  for (int second = 1; second <= seconds; second++) {
+    long long wake = load_start + second * 1000000000LL, now = now_ns();
+    if (wake > now)
+      usleep((wake - now) / 1000);
+    long long done = __atomic_load_n(&completed, __ATOMIC_RELAXED);
+    printf("%4ds %10lld req/s %8lld errors\n", second, done - prev,
+           __atomic_load_n(&failed, __ATOMIC_RELAXED));
+    fflush(stdout);
+    prev = done;
+  }
+
+  for (int index = 0; index < threads; index++) {
+    pthread_join(pool[index].thread, NULL);
+    for (int uri = 0; uri < num_uris; uri++) {
+      hist_merge(&total[uri], &pool[index].hist[uri]);
+      hist_merge(&total[num_uris], &pool[index].hist[uri]);
+      errors += pool[index].errors[uri];
+    }
+    bytes += pool[index].bytes;
+  }
+  if (cpu >= 0 && load_cpu(load_pid) >= 0)
+    cpu = load_cpu(load_pid) - cpu;
+  else
+    cpu = -1;
+
+  printf("\n%s, %d threads, %d connections, %s, %d s\n",
+         load_rate > 0 ? "open loop" : "closed loop", threads, conns,
+         load_keep ? "keep-alive" : "connection per request", seconds);
+  if (load_rate > 0)
+    printf("target %.1f req/s\n", load_rate);
+  printf("%.1f req/s, %.2f MB/s, %lld ok, %lld errors\n",
+         total[num_uris].total / (double) seconds, bytes / 1e6 / seconds,
+         total[num_uris].total, errors);
+  printf("%.0f bytes/response%s\n", completed ? (double) bytes / completed : 0.0,
+         load_gzip ? " (gzip accepted)" : "");
+  if (cpu >= 0)
+    printf("server CPU %.2f s, %.1f us/request\n", cpu,
+           completed ? cpu * 1e6 / completed : 0.0);
+  printf("\n");
+
+  printf("%-32s %9s %9s %9s %9s %9s %10s %10s\n", "uri", "ok", "errors", "p50_us",
+         "p90_us", "p99_us", "p99.9_us", "max_us");
+  for (int uri = 0; uri <= num_uris; uri++) {
+    long long uri_errors = 0;
+    for (int index = 0; index < threads && uri < num_uris; index++)
+      uri_errors += pool[index].errors[uri];
+    printf("%-32s %9lld %9lld %9lld %9lld %9lld %10lld %10lld\n",
+           uri < num_uris ? uris[uri].path : "all", total[uri].total,
+           uri < num_uris ? uri_errors : errors, hist_percentile(&total[uri], 50),
+           hist_percentile(&total[uri], 90), hist_percentile(&total[uri], 99),
+           hist_percentile(&total[uri], 99.9), total[uri].max);
+  }
+
+  printf("\n");
+  hist_print(&total[num_uris]);
+
+  free(pool);
+  free(all);
+  free(total);
+  return errors > 0;
+}
+
 int main(int argc, char *argv[])
 {
   char *host, *filename;
   int port;
   int clientfd;
 
+  if (argc > 4 || (argc == 4 && argv[3][0] == '-'))
+    exit(load_main(argc, argv));
   if (argc != 4) {
     fprintf(stderr, "Usage: %s <host> <port> <filename>\n", argv[0]);
     exit(1);
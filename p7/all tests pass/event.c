@@ -0,0 +1,774 @@
+//
+// event.c: epoll readiness loop with HTTP keep-alive for the web server.
+//
+// The event thread owns every connection that is not being served: new
+// connections and idle keep-alive connections sit in epoll (one-shot) with
+// a deadline on the loop's timer wheel (see timer.c): idle_ms to start a
+// request, and with a header timeout header_ms to finish one once its first
+// bytes have arrived, so a client trickling a header cannot hold its
+// connection open for longer. Expired connections are closed by the event
+// thread; no worker ever waits for them. When a connection becomes readable
+// its bytes are read into its rio_t buffer without blocking; once a full
+// request header is buffered the connection is handed to the workers.
+// Workers give keep-alive connections back through a return list and an
+// eventfd, so only the event thread ever parks, re-arms or expires them.
+// A connection whose CGI process is still running is handed over with the
+// process's pidfd; the event thread reaps the process and closes the
+// connection when the pidfd becomes readable, so no worker blocks in wait.
+// Several loops can run at once (one per acceptor shard); they share the
+// fd-indexed connection table but nothing else.
+//
+// With -u a loop runs on io_uring instead (uring_run()): one multishot
+// accept on the listening socket, one receive per parked connection that
+// takes a buffer from the loop's provided-buffer ring only when data
+// arrives, a multishot poll on the eventfd, a poll on each pidfd and an
+// absolute timeout for the wheel's next deadline. Every operation queued
+// in a pass goes to the kernel with the wait for the next completion, in a
+// single io_uring_enter(). Workers and their return/reap hand-offs are the
+// same as with epoll.
+//
+
+#include "helper.h"
+#include "event.h"
+#include "parser.h"
+#include "uring.h"
+#include <poll.h>
+#include <limits.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/pidfd.h>
+
+#define MAX_EVENTS 64  // events handled per epoll_wait
+#define URING_ENTRIES 256  // submission queue size of a loop's ring
+#define URING_BUFFERS 256  // provided receive buffers per loop
+#define URING_BUFFER_SIZE 4096  // bytes per provided buffer
+#define URING_GROUP 0  // buffer group of the provided buffers
+
+// io_uring completions say what they are for in the low bits of user_data;
+// the rest is the connection, if any (malloc'd, so 16-byte aligned)
+#define TAG_NONE 0  // nothing to do
+#define TAG_ACCEPT 1  // multishot accept
+#define TAG_WAKE 2  // multishot poll of the eventfd
+#define TAG_TIMER 3  // timeout for the next deadline
+#define TAG_RECV 4  // receive on a parked connection
+#define TAG_CHILD 5  // poll of a CGI process's pidfd
+#define TAG_CLOSE 6  // close of a connection, which is then freed
+#define TAG_MASK 7
+
+// sent before closing a connection whose request does not fit the buffer
+static char too_large[] = "HTTP/1.0 431 Request Header Fields Too Large\r\n"
+    "Content-Length: 0\r\n\r\n";
+
+static int max_conns;  // size of conn_table (fd limit)
+static conn_t **conn_table;  // connection state indexed by fd
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;  // allocates conn_table
+
+/**
+ * Function that returns a monotonic timestamp in milliseconds.
+ */
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Function that stops a parked connection's deadline.
+ */
+static void idle_remove(conn_t *conn) {
+    timer_cancel(&conn->loop->wheel, &conn->timer);
+}
+
+/**
+ * Function that works out when a parked connection is to be closed: after
+ * idle_ms without a request, or header_ms after part of one has arrived.
+ *
+ * conn: connection being parked
+ * Return: ms timestamp of the deadline
+ */
+static long long conn_deadline(conn_t *conn) {
+    event_loop *loop = conn->loop;
+
+    if (loop->header_ms > 0 && conn->rio.rio_cnt > 0) {
+        return now_ms() + loop->header_ms;
+    }
+    return now_ms() + loop->idle_ms;
+}
+
+/**
+ * Function that starts the header deadline of a connection whose request
+ * has just begun to arrive, in place of its idle deadline. Later parts of
+ * the request do not move it.
+ *
+ * conn: connection that has received the first part of a request
+ */
+static void header_begun(conn_t *conn) {
+    if (conn->loop->header_ms > 0) {
+        idle_remove(conn);
+        timer_add(&conn->loop->wheel, &conn->timer, conn_deadline(conn));
+    }
+}
+
+/**
+ * Function that checks whether the unread part of a connection's rio buffer
+ * holds a complete request header. Parsing resumes where the last call
+ * stopped, so a header that arrives over many reads is scanned once; the
+ * worker's requestHandle() carries on from the same state. A malformed
+ * header also counts, so that a worker answers it with an error.
+ *
+ * conn: connection to check
+ * Return: 1 if a full header is buffered, else 0
+ */
+int request_ready(conn_t *conn) {
+    return http_parse(&conn->req, conn->rio.rio_bufptr, conn->rio.rio_cnt) != 0;
+}
+
+/**
+ * Function that moves the unread bytes of a connection's rio buffer to its
+ * front to make room for more.
+ *
+ * conn: connection about to be read from
+ * Return: bytes free after the unread ones
+ */
+static int conn_room(conn_t *conn) {
+    rio_t *rp = &conn->rio;
+
+    if (rp->rio_cnt < 0) {  // rio_read leaves -1 behind after an error
+        rp->rio_cnt = 0;
+    }
+    if (rp->rio_bufptr != rp->rio_buf) {  // move unread bytes to the front
+        memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+        rp->rio_bufptr = rp->rio_buf;
+    }
+    return RIO_BUFSIZE - rp->rio_cnt;
+}
+
+/**
+ * Function that reads whatever is available on a connection into its rio
+ * buffer without blocking.
+ *
+ * conn: connection to read from
+ * Return: 1 if a full request is buffered, 0 if more bytes are needed, -1 if
+ *         the connection should be closed (EOF or error), -2 if the header
+ *         does not fit in the buffer
+ */
+static int conn_fill(conn_t *conn) {
+    rio_t *rp = &conn->rio;
+    int room = conn_room(conn);
+
+    if (room == 0) {  // header does not fit in the buffer
+        return -2;
+    }
+
+    ssize_t n = recv(conn->fd, rp->rio_buf + rp->rio_cnt, room, MSG_DONTWAIT);
+    if (n == 0) {  // client closed the connection
+        return -1;
+    }
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+
+    rp->rio_cnt += n;
+    if (request_ready(conn)) {
+        return 1;
+    }
+    return rp->rio_cnt == RIO_BUFSIZE ? -2 : 0;
+}
+
+/**
+ * Function that looks up the state of a dispatched connection.
+ *
+ * fd: connection fd taken from the connection buffer
+ * Return: the connection
+ */
+conn_t *event_conn(int fd) {
+    return conn_table[fd];
+}
+
+/**
+ * Function that closes a connection and frees its state. Called by the
+ * worker that owns it, or by the event thread for parked connections.
+ *
+ * conn: connection to close
+ */
+void event_close(conn_t *conn) {
+    conn_table[conn->fd] = NULL;
+    Close(conn->fd);  // also removes it from epoll
+    free(conn);
+}
+
+/**
+ * Function used by a worker to give a keep-alive connection back to the
+ * event thread once its response has been sent.
+ *
+ * conn: connection to park until its next request
+ */
+void event_return(conn_t *conn) {
+    event_loop *loop = conn->loop;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&loop->return_lock);
+    conn->next = loop->returned;
+    loop->returned = conn;
+    pthread_mutex_unlock(&loop->return_lock);
+
+    if (write(loop->wakefd, &one, sizeof(one)) < 0) {  // wake the event thread
+        unix_error("eventfd write error");
+    }
+}
+
+/**
+ * Function used by a worker to hand over a connection whose CGI process is
+ * still writing the response. The event thread closes the connection once
+ * the process exits; if the process cannot be watched the worker waits.
+ *
+ * conn: connection the CGI process writes to
+ * child: pid of the CGI process
+ */
+void event_reap(conn_t *conn, pid_t child) {
+    struct epoll_event ev;
+    int pidfd = pidfd_open(child, 0);  // close-on-exec by default
+
+    if (pidfd < 0 || pidfd >= max_conns) {  // no pidfd (old kernel) or no room
+        if (pidfd >= 0) {
+            Close(pidfd);
+        }
+        Waitpid(child, NULL, 0);
+        event_close(conn);
+        return;
+    }
+
+    conn->child = child;
+    conn->pidfd = pidfd;
+    conn_table[pidfd] = conn;
+    if (conn->loop->engine == EVENT_URING) {  // only the event thread uses the ring
+        event_return(conn);
+        return;
+    }
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = pidfd;
+    if (epoll_ctl(conn->loop->epfd, EPOLL_CTL_ADD, pidfd, &ev) < 0) {
+        unix_error("epoll_ctl error");
+    }
+}
+
+/**
+ * Function that reaps the CGI process of a connection handed over with
+ * event_reap() and closes the connection.
+ */
+static void child_exited(conn_t *conn) {
+    Waitpid(conn->child, NULL, 0);
+    conn_table[conn->pidfd] = NULL;
+    Close(conn->pidfd);  // also removes it from epoll
+    conn->pidfd = -1;
+    event_close(conn);
+}
+
+/**
+ * Function that queues a receive for a parked connection (io_uring). The
+ * kernel picks a provided buffer once data arrives, so idle connections hold
+ * no buffer; at most the free part of the rio buffer is received.
+ */
+static void uring_arm_recv(conn_t *conn) {
+    int room = conn_room(conn);  // never 0: full buffers are dispatched or dropped
+    struct io_uring_sqe *sqe = uring_sqe(conn->loop->ring);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->len = room < URING_BUFFER_SIZE ? room : URING_BUFFER_SIZE;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_GROUP;
+    sqe->user_data = (unsigned long) conn | TAG_RECV;
+}
+
+/**
+ * Function that arms a connection for its next read event and starts its
+ * deadline.
+ *
+ * conn: connection to park
+ * op: EPOLL_CTL_ADD for new connections, EPOLL_CTL_MOD to re-arm (epoll)
+ */
+static void conn_park(conn_t *conn, int op) {
+    struct epoll_event ev;
+
+    if (conn->loop->engine == EVENT_URING) {
+        uring_arm_recv(conn);
+    } else {
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.fd = conn->fd;
+        if (epoll_ctl(conn->loop->epfd, op, conn->fd, &ev) < 0) {
+            unix_error("epoll_ctl error");
+        }
+    }
+    timer_add(&conn->loop->wheel, &conn->timer, conn_deadline(conn));
+}
+
+/**
+ * Function that closes a connection the event thread owns, after a send of
+ * error if not NULL. With io_uring the close is queued on the ring, after
+ * the send (hard linked, so the close happens even if the send fails), and
+ * the connection is freed when the close completes; if a receive is still
+ * pending it is cancelled and the connection is freed when that completes
+ * instead.
+ *
+ * conn: connection to close, without a pending deadline
+ * error: response to send first, or NULL
+ * pending: 1 if a receive is queued for conn (io_uring only)
+ */
+static void conn_drop(conn_t *conn, char *error, int pending) {
+    uring_t *ring = conn->loop->ring;
+    struct io_uring_sqe *sqe;
+
+    if (conn->loop->engine != EVENT_URING) {
+        if (error != NULL) {  // small enough for the empty socket buffer
+            send(conn->fd, error, strlen(error), MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+        event_close(conn);
+        return;
+    }
+
+    conn_table[conn->fd] = NULL;
+    if (pending) {
+        sqe = uring_sqe(ring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = (unsigned long) conn | TAG_RECV;
+        sqe->user_data = TAG_NONE;
+        conn->closing = 1;
+    }
+    if (error != NULL) {
+        if (ring->sq_entries - (ring->sqe_tail - *ring->sq_head) < 2) {
+            uring_submit(ring, 0);  // keep the send and the close in one submission
+        }
+        sqe = uring_sqe(ring);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->fd;
+        sqe->addr = (unsigned long) error;
+        sqe->len = strlen(error);
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->flags = IOSQE_IO_HARDLINK;
+        sqe->user_data = TAG_NONE;
+    }
+    sqe = uring_sqe(ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = conn->fd;
+    sqe->user_data = pending ? TAG_NONE : (unsigned long) conn | TAG_CLOSE;
+}
+
+/**
+ * Function that sets up the state of a newly accepted connection and parks
+ * it until its first request.
+ *
+ * loop: loop that accepted the connection
+ * connfd: the connection
+ */
+static void conn_accepted(event_loop *loop, int connfd) {
+    if (connfd >= max_conns) {  // no room in the table
+        Close(connfd);
+        return;
+    }
+
+    conn_t *conn = malloc(sizeof(conn_t));
+    if (conn == NULL) {
+        Close(connfd);
+        return;
+    }
+    if (loop->write_ms > 0) {  // a client that stops reading gives up its worker
+        struct timeval timeout = { loop->write_ms / 1000, loop->write_ms % 1000 * 1000 };
+        setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    conn->fd = connfd;
+    conn->loop = loop;
+    conn->timer.prev = NULL;  // no deadline yet
+    conn->child = 0;
+    conn->pidfd = -1;
+    conn->closing = 0;
+    conn->admitted = 0;
+    rio_readinitb(&conn->rio, connfd);
+    http_init(&conn->req);
+    conn_table[connfd] = conn;
+    conn_park(conn, EPOLL_CTL_ADD);
+    if (loop->stats != NULL) {
+        __atomic_fetch_add(&loop->stats->accepted, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Function that accepts every pending connection on the listening socket.
+ */
+static void accept_all(event_loop *loop) {
+    while (1) {
+        int connfd = accept4(loop->listenfd, NULL, NULL, SOCK_CLOEXEC);
+        if (connfd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {  // backlog drained
+                return;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            unix_error("Accept error");
+        }
+        conn_accepted(loop, connfd);
+    }
+}
+
+/**
+ * Function that parks every connection returned by the workers, or sends it
+ * straight back if its next request is already buffered (pipelining).
+ */
+static void drain_returned(event_loop *loop) {
+    uint64_t count;
+
+    if (read(loop->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        unix_error("eventfd read error");
+    }
+
+    pthread_mutex_lock(&loop->return_lock);
+    conn_t *conn = loop->returned;
+    loop->returned = NULL;
+    pthread_mutex_unlock(&loop->return_lock);
+
+    while (conn != NULL) {
+        conn_t *next = conn->next;
+        if (conn->pidfd >= 0) {  // io_uring: handed over by event_reap()
+            struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = conn->pidfd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = (unsigned long) conn | TAG_CHILD;
+        } else if (request_ready(conn)) {
+            loop->dispatch(loop->arg, conn->fd);
+        } else {
+            conn_park(conn, EPOLL_CTL_MOD);
+        }
+        conn = next;
+    }
+}
+
+/**
+ * Function that closes every parked connection whose deadline has passed,
+ * counting it as a header timeout if part of a request had arrived.
+ *
+ * Return: ms until the wheel next needs to be checked, or -1 if nothing is
+ *         parked
+ */
+static int expire_idle(event_loop *loop) {
+    long long now = now_ms();
+    timer_node *node;
+
+    while ((node = timer_expire(&loop->wheel, now)) != NULL) {
+        conn_t *conn = (conn_t*) ((char*) node - offsetof(conn_t, timer));
+        if (loop->stats != NULL) {
+            __atomic_fetch_add(conn->rio.rio_cnt > 0 ? &loop->stats->header_timeouts :
+                &loop->stats->idle_timeouts, 1, __ATOMIC_RELAXED);
+        }
+        conn_drop(conn, NULL, 1);
+    }
+
+    long long next = timer_next(&loop->wheel);
+    return next < 0 ? -1 : (int) (next > now ? next - now : 0);
+}
+
+/**
+ * Function that queues a multishot accept on a loop's listening socket.
+ */
+static void uring_arm_accept(event_loop *loop) {
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = TAG_ACCEPT;
+}
+
+/**
+ * Function that queues a multishot poll of a loop's eventfd.
+ */
+static void uring_arm_wake(event_loop *loop) {
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = loop->wakefd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = TAG_WAKE;
+}
+
+/**
+ * Function that queues a timeout for when the timer wheel next has work,
+ * unless one that fires no later is pending already. Cancelled deadlines
+ * leave their timeouts pending; they fire for nothing.
+ */
+static void uring_arm_timer(event_loop *loop) {
+    long long next = timer_next(&loop->wheel);
+
+    if (next < 0 || (loop->timers_armed > 0 && loop->timer_at <= next)) {
+        return;
+    }
+    loop->timer.tv_sec = next / 1000;  // copied by the kernel when submitted
+    loop->timer.tv_nsec = next % 1000 * 1000000;
+    loop->timer_at = next;
+    loop->timers_armed++;
+
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (unsigned long) &loop->timer;
+    sqe->len = 1;
+    sqe->timeout_flags = IORING_TIMEOUT_ABS;  // CLOCK_MONOTONIC, as now_ms()
+    sqe->user_data = TAG_TIMER;
+}
+
+/**
+ * Function that handles the completion of a receive on a parked connection.
+ *
+ * conn: connection the receive was for
+ * cqe: its completion
+ */
+static void uring_received(conn_t *conn, struct io_uring_cqe *cqe) {
+    event_loop *loop = conn->loop;
+    rio_t *rp = &conn->rio;
+    int begun = rp->rio_cnt <= 0;  // nothing of a request had arrived
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe->res > 0 && !conn->closing) {
+            memcpy(rp->rio_buf + rp->rio_cnt, uring_buffer(loop->ring, bid), cqe->res);
+            rp->rio_cnt += cqe->res;
+        }
+        uring_recycle_buffer(loop->ring, bid);
+    }
+
+    if (conn->closing) {  // expired, the close is already queued
+        free(conn);
+    } else if (cqe->res == -ENOBUFS || cqe->res == -EINTR) {  // try again
+        uring_arm_recv(conn);
+    } else if (cqe->res <= 0) {  // client closed the connection, or an error
+        idle_remove(conn);
+        conn_drop(conn, NULL, 0);
+    } else if (request_ready(conn)) {
+        idle_remove(conn);
+        loop->dispatch(loop->arg, conn->fd);  // a worker owns the connection from here
+    } else if (rp->rio_cnt == RIO_BUFSIZE) {  // header does not fit in the buffer
+        idle_remove(conn);
+        conn_drop(conn, too_large, 0);
+    } else {  // partial header, wait for the rest
+        if (begun) {
+            header_begun(conn);
+        }
+        uring_arm_recv(conn);
+    }
+}
+
+/**
+ * Main loop of an event thread using io_uring. Never returns.
+ *
+ * loop: loop created by event_create() with EVENT_URING
+ */
+static void uring_run(event_loop *loop) {
+    uring_t *ring = loop->ring;
+    struct io_uring_cqe *cqe;
+
+    uring_arm_accept(loop);
+    uring_arm_wake(loop);
+    while (1) {
+        uring_arm_timer(loop);
+        if (uring_submit(ring, 1) < 0 && errno != EBUSY) {
+            unix_error("io_uring_enter error");
+        }
+
+        while ((cqe = uring_cqe(ring)) != NULL) {
+            struct io_uring_cqe done = *cqe;
+            uring_cqe_seen(ring);  // handlers may queue more work
+
+            conn_t *conn = (conn_t*) (unsigned long) (done.user_data & ~(__u64) TAG_MASK);
+            switch (done.user_data & TAG_MASK) {
+            case TAG_ACCEPT:
+                if (done.res >= 0) {
+                    conn_accepted(loop, done.res);
+                }
+                if (!(done.flags & IORING_CQE_F_MORE)) {  // multishot ended
+                    uring_arm_accept(loop);
+                }
+                break;
+            case TAG_WAKE:
+                drain_returned(loop);
+                if (!(done.flags & IORING_CQE_F_MORE)) {
+                    uring_arm_wake(loop);
+                }
+                break;
+            case TAG_TIMER:
+                // which one fired is unknown, so the next pass queues
+                // another for the wheel's next deadline
+                loop->timers_armed--;
+                loop->timer_at = LLONG_MAX;
+                expire_idle(loop);
+                break;
+            case TAG_RECV:
+                uring_received(conn, &done);
+                break;
+            case TAG_CHILD:
+                child_exited(conn);
+                break;
+            case TAG_CLOSE:
+                free(conn);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Function that sizes the shared connection table by the fd limit.
+ */
+static void table_init() {
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur == RLIM_INFINITY) {
+        limit.rlim_cur = 65536;
+    }
+    max_conns = limit.rlim_cur;
+    conn_table = calloc(max_conns, sizeof(conn_t*));
+    if (conn_table == NULL) {
+        app_error("Unable to allocate connection table");
+    }
+}
+
+/**
+ * Function that sets up an event loop on a listening socket.
+ *
+ * listenfd: listening socket
+ * idle_ms: how long a connection may sit without a request
+ * header_ms: how long a request may take to arrive once its first bytes
+ *            have, or 0 to allow the rest of idle_ms
+ * write_ms: send timeout for the workers serving connections, 0 for none
+ * engine: EVENT_EPOLL or EVENT_URING; falls back to epoll if io_uring is
+ *         not available
+ * dispatch: called with arg and a connection fd that has a full request
+ *           buffered
+ * arg: passed to dispatch
+ * stats: shard counters of accepted and timed out connections, or NULL
+ * Return: the new loop
+ */
+event_loop *event_create(int listenfd, int idle_ms, int header_ms, int write_ms, int engine,
+        void (*dispatch)(void *arg, int connfd), void *arg, shm_shard *stats) {
+    struct epoll_event ev;
+
+    pthread_once(&table_once, table_init);
+
+    event_loop *loop = malloc(sizeof(event_loop));
+    if (loop == NULL) {
+        app_error("Unable to allocate event loop");
+    }
+    loop->listenfd = listenfd;
+    loop->idle_ms = idle_ms;
+    loop->header_ms = header_ms;
+    loop->write_ms = write_ms;
+    loop->dispatch = dispatch;
+    loop->arg = arg;
+    loop->stats = stats;
+    timer_init(&loop->wheel, now_ms());
+    loop->returned = NULL;
+    pthread_mutex_init(&loop->return_lock, NULL);
+    loop->engine = EVENT_EPOLL;
+    loop->epfd = -1;
+    loop->ring = NULL;
+    loop->timers_armed = 0;
+    loop->timer_at = LLONG_MAX;
+
+    if ((loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        unix_error("eventfd error");
+    }
+
+    if (engine == EVENT_URING) {
+        loop->ring = malloc(sizeof(uring_t));
+        if (loop->ring != NULL && uring_init(loop->ring, URING_ENTRIES) == 0 &&
+                uring_provide_buffers(loop->ring, URING_BUFFERS, URING_BUFFER_SIZE,
+                    URING_GROUP) == 0) {
+            loop->engine = EVENT_URING;
+            return loop;  // the listening socket stays blocking
+        }
+        fprintf(stderr, "io_uring not available, using epoll\n");
+        free(loop->ring);  // an fd from a failed uring_init is left to exit
+        loop->ring = NULL;
+    }
+
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        unix_error("epoll_create1 error");
+    }
+
+    // the listening socket and the eventfd stay armed (level triggered)
+    fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+    ev.events = EPOLLIN;
+    ev.data.fd = listenfd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0) {
+        unix_error("epoll_ctl error");
+    }
+    ev.data.fd = loop->wakefd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) < 0) {
+        unix_error("epoll_ctl error");
+    }
+    return loop;
+}
+
+/**
+ * Main loop of an event thread. Never returns.
+ *
+ * loop: loop created by event_create()
+ */
+void event_run(event_loop *loop) {
+    struct epoll_event events[MAX_EVENTS];
+
+    if (loop->engine == EVENT_URING) {
+        uring_run(loop);
+    }
+
+    while (1) {
+        int timeout = expire_idle(loop);  // sleep until the next idle deadline
+        int n = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            unix_error("epoll_wait error");
+        }
+
+        for (int index = 0; index < n; index++) {
+            int fd = events[index].data.fd;
+
+            if (fd == loop->listenfd) {
+                accept_all(loop);
+            } else if (fd == loop->wakefd) {
+                drain_returned(loop);
+            } else {
+                conn_t *conn = conn_table[fd];
+                if (fd == conn->pidfd) {  // CGI process finished
+                    child_exited(conn);
+                    continue;
+                }
+
+                int begun = conn->rio.rio_cnt <= 0;  // nothing of a request had arrived
+                int ready = conn_fill(conn);
+
+                if (ready == 0) {  // partial header, wait for the rest
+                    if (begun && conn->rio.rio_cnt > 0) {
+                        header_begun(conn);
+                    }
+                    struct epoll_event rearm;
+                    rearm.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+                    rearm.data.fd = fd;
+                    epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &rearm);
+                    continue;
+                }
+
+                idle_remove(conn);
+                if (ready < 0) {
+                    conn_drop(conn, ready == -2 ? too_large : NULL, 0);
+                } else {
+                    loop->dispatch(loop->arg, fd);  // a worker owns the connection from here
+                }
+            }
+        }
+    }
+}
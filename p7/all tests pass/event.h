@@ -0,0 +1,68 @@
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include <linux/time_types.h>
+#include "timer.h"
+#include "parser.h"
+
+//
+// event.h: epoll readiness loop used with -e. The loop accepts without
+// blocking, parks idle keep-alive connections, and hands a connection to
+// the worker pool only once a complete request header is buffered. CGI
+// processes started by a worker are reaped by the loop, not the worker.
+// With -u the same loop runs on io_uring instead of epoll.
+//
+
+// how a loop waits for connections and requests
+#define EVENT_EPOLL 0  // epoll readiness, -e
+#define EVENT_URING 1  // io_uring completions, -u
+
+struct event_loop;
+struct uring;
+
+// per-connection state, owned by the event thread while parked and by one
+// worker while dispatched
+typedef struct conn {
+    int fd;  // connection socket
+    struct event_loop *loop;  // loop the connection returns to
+    timer_node timer;  // when a parked conn is closed: idle or header deadline
+    pid_t child;  // CGI process still writing the response, see event_reap()
+    int pidfd;  // pidfd of child, -1 if none
+    int closing;  // io_uring: closed with a receive pending, freed when it completes
+    int admitted;  // a worker has served a request, so admission control lets it be
+    struct conn *next;  // link in the return list
+    rio_t rio;  // read buffer kept across requests so pipelined bytes survive
+    http_request req;  // how far the request at the front of rio has been parsed
+} conn_t;
+
+// state of one event thread; with -a each acceptor shard runs its own
+typedef struct event_loop {
+    int listenfd;  // listening socket owned by this loop
+    int idle_ms;  // how long a connection may sit without a complete request
+    int header_ms;  // how long a request may take to arrive once begun, 0 for idle_ms
+    int write_ms;  // send timeout set on every connection, 0 for none
+    void (*dispatch)(void *arg, int connfd);  // queues a ready connection
+    void *arg;  // passed to dispatch
+    shm_shard *stats;  // counters of accepted and timed out connections, or NULL
+    int engine;  // EVENT_EPOLL or EVENT_URING
+    int epfd;  // epoll instance (EVENT_EPOLL)
+    struct uring *ring;  // io_uring instance (EVENT_URING)
+    int timers_armed;  // io_uring: timeouts pending
+    long long timer_at;  // io_uring: earliest pending timeout, if known
+    struct __kernel_timespec timer;  // io_uring: when the last timeout queued fires
+    int wakefd;  // eventfd signalled when a worker returns a connection
+    timer_wheel wheel;  // deadlines of the parked connections
+    conn_t *returned;  // connections handed back by workers
+    pthread_mutex_t return_lock;  // protects returned
+} event_loop;
+
+event_loop *event_create(int listenfd, int idle_ms, int header_ms, int write_ms, int engine,
+    void (*dispatch)(void *arg, int connfd), void *arg, shm_shard *stats);
+void event_run(event_loop *loop);
+conn_t *event_conn(int fd);
+void event_return(conn_t *conn);
+void event_close(conn_t *conn);
+void event_reap(conn_t *conn, pid_t child);
+int request_ready(conn_t *conn);
+
+#endif
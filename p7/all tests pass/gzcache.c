@@ -0,0 +1,275 @@
+//
+// gzcache.c: Cache of gzip-compressed static files for the web server.
+//
+// Entries are keyed by path and remember the inode, size and mtime of the
+// file they were made from; a lookup that finds an older version drops it
+// and compresses the file again. A file is compressed by the worker that
+// misses, outside the lock, so two workers may compress the same file at
+// once; the second to finish uses the first one's entry. Files that do not
+// shrink by at least GZ_MIN_SAVING are remembered as such so they are not
+// compressed again. The cache holds at most its byte budget of compressed
+// data and evicts the least recently used entries to make room; entries
+// are reference counted so one can be evicted while it is being sent.
+//
+
+#include "helper.h"
+#include "gzcache.h"
+#include <zlib.h>
+
+#define GZ_BUCKETS 256  // hash chains
+#define GZ_MAX_SHARE 8  // files over budget / GZ_MAX_SHARE are not compressed
+#define GZ_MIN_SAVING 10  // percent a file must shrink by to be sent compressed
+#define GZ_LEVEL 6  // zlib compression level
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;  // protects everything below
+static gz_entry *buckets[GZ_BUCKETS];  // hash chains
+static gz_entry lru;  // sentinel of the LRU list
+static long budget;  // byte limit, 0 if the cache is off
+static long used;  // bytes charged to the entries in the table
+
+/**
+ * Function that hashes a path (djb2).
+ */
+static unsigned hash_path(char *path) {
+    unsigned hash = 5381;
+    for (char *c = path; *c != '\0'; c++) {
+        hash = hash * 33 + (unsigned char) *c;
+    }
+    return hash;
+}
+
+/**
+ * Function that searches a chain for a path.
+ */
+static gz_entry *chain_find(gz_entry *head, char *path) {
+    for (gz_entry *entry = head; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Function that returns what an entry counts against the budget.
+ */
+static long entry_cost(gz_entry *entry) {
+    return sizeof(gz_entry) + strlen(entry->path) + 1 + entry->len;
+}
+
+/**
+ * Function that frees an entry once nobody references it.
+ */
+static void entry_free(gz_entry *entry) {
+    free(entry->path);
+    free(entry->data);
+    free(entry);
+}
+
+/**
+ * Function that removes an entry from the table. Caller holds the lock and
+ * must drop the table's reference afterwards.
+ */
+static void table_unlink(gz_entry *entry) {
+    gz_entry **link = &buckets[hash_path(entry->path) % GZ_BUCKETS];
+
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    entry->lru_prev->lru_next = entry->lru_next;
+    entry->lru_next->lru_prev = entry->lru_prev;
+    used -= entry_cost(entry);
+}
+
+/**
+ * Function that moves an entry to the recently used end of the LRU list.
+ * Caller holds the lock.
+ */
+static void lru_touch(gz_entry *entry) {
+    if (entry->lru_next != NULL) {  // unlink if already listed
+        entry->lru_prev->lru_next = entry->lru_next;
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    entry->lru_prev = lru.lru_prev;
+    entry->lru_next = &lru;
+    lru.lru_prev->lru_next = entry;
+    lru.lru_prev = entry;
+}
+
+/**
+ * Function that checks whether an entry was made from the file as it is.
+ */
+static int entry_current(gz_entry *entry, struct stat *sbuf) {
+    return entry->ino == sbuf->st_ino && entry->size == sbuf->st_size &&
+        entry->mtime.tv_sec == sbuf->st_mtim.tv_sec &&
+        entry->mtime.tv_nsec == sbuf->st_mtim.tv_nsec;
+}
+
+/**
+ * Function that compresses a file into a gzip stream.
+ *
+ * path: file to compress
+ * size: size of the file
+ * len: set to the length of the stream
+ * Return: the malloc'd stream, or NULL if the file could not be read or
+ *         would not shrink by GZ_MIN_SAVING percent
+ */
+static char *compress_file(char *path, off_t size, int *len) {
+    char *in = malloc(size > 0 ? size : 1), *out = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    z_stream zs;
+
+    if (in == NULL || fd < 0 || rio_readn(fd, in, size) != size) {
+        goto done;
+    }
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, GZ_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        goto done;  // 15 + 16: largest window, gzip wrapper
+    }
+    uLong bound = deflateBound(&zs, size);
+    if ((out = malloc(bound)) != NULL) {
+        zs.next_in = (Bytef*) in;
+        zs.avail_in = size;
+        zs.next_out = (Bytef*) out;
+        zs.avail_out = bound;
+        if (deflate(&zs, Z_FINISH) != Z_STREAM_END ||
+                zs.total_out * 100 > (uLong) size * (100 - GZ_MIN_SAVING)) {
+            free(out);
+            out = NULL;
+        } else {
+            *len = zs.total_out;
+        }
+    }
+    deflateEnd(&zs);
+
+done:
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(in);
+    return out;
+}
+
+/**
+ * Function that turns the cache on.
+ *
+ * bytes: most bytes of compressed data the cache may hold
+ * Return: 0 on success, -1 if bytes is not positive
+ */
+int gz_cache_init(long bytes) {
+    if (bytes <= 0) {
+        return -1;
+    }
+    lru.lru_prev = &lru;
+    lru.lru_next = &lru;
+    budget = bytes;
+    return 0;
+}
+
+/**
+ * Function that checks whether gz_cache_init() has been called.
+ *
+ * Return: 1 if the cache is on, else 0
+ */
+int gz_cache_enabled() {
+    return budget > 0;
+}
+
+/**
+ * Function that drops one reference to an entry.
+ *
+ * entry: entry returned by gz_cache_get()
+ */
+void gz_cache_release(gz_entry *entry) {
+    if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        entry_free(entry);
+    }
+}
+
+/**
+ * Function that looks up the compressed version of a file, compressing
+ * the file if it is not cached.
+ *
+ * path: filename of a readable regular file
+ * sbuf: stat of the file
+ * Return: the entry with a reference the caller must release, or NULL if
+ *         the file is too large or does not compress well
+ */
+gz_entry *gz_cache_get(char *path, struct stat *sbuf) {
+    gz_entry **chain = &buckets[hash_path(path) % GZ_BUCKETS];
+    gz_entry *entry, *stale = NULL;
+
+    if (sbuf->st_size > budget / GZ_MAX_SHARE) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&lock);
+    entry = chain_find(*chain, path);
+    if (entry != NULL && !entry_current(entry, sbuf)) {  // file changed since
+        table_unlink(entry);
+        stale = entry;
+        entry = NULL;
+    }
+    if (entry != NULL) {
+        lru_touch(entry);
+        __atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&lock);
+    if (stale != NULL) {
+        gz_cache_release(stale);  // table's reference
+    }
+    if (entry != NULL) {
+        if (entry->data == NULL) {  // known not to compress
+            gz_cache_release(entry);
+            return NULL;
+        }
+        return entry;
+    }
+
+    // miss: compress without holding the lock
+    if ((entry = calloc(1, sizeof(gz_entry))) == NULL) {
+        return NULL;
+    }
+    if ((entry->path = strdup(path)) == NULL) {
+        free(entry);
+        return NULL;
+    }
+    entry->ino = sbuf->st_ino;
+    entry->size = sbuf->st_size;
+    entry->mtime = sbuf->st_mtim;
+    entry->data = compress_file(path, sbuf->st_size, &entry->len);
+    entry->refs = 2;  // table and caller
+
+    pthread_mutex_lock(&lock);
+    gz_entry *existing = chain_find(*chain, path);
+    if (existing != NULL && entry_current(existing, sbuf)) {  // another worker won
+        __atomic_add_fetch(&existing->refs, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&lock);
+        entry_free(entry);
+        entry = existing;
+    } else {
+        if (existing != NULL) {  // an older version, compressed meanwhile
+            table_unlink(existing);
+            gz_cache_release(existing);  // table's reference
+        }
+        // make room, least recently used first
+        while (used + entry_cost(entry) > budget && lru.lru_next != &lru) {
+            gz_entry *victim = lru.lru_next;
+            table_unlink(victim);
+            gz_cache_release(victim);  // table's reference
+        }
+        entry->next = *chain;
+        *chain = entry;
+        lru_touch(entry);
+        used += entry_cost(entry);
+        pthread_mutex_unlock(&lock);
+    }
+
+    if (entry->data == NULL) {
+        gz_cache_release(entry);
+        return NULL;
+    }
+    return entry;
+}
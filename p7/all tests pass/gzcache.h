@@ -0,0 +1,30 @@
+#ifndef __GZCACHE_H__
+#define __GZCACHE_H__
+
+//
+// gzcache.h: memory cache of gzip-compressed static files used with -z.
+// A file without a precompressed .gz sibling is compressed the first time
+// a client that accepts gzip asks for it; later requests for the same
+// version of the file are served from memory.
+//
+
+// one compressed file, shared by the table and every worker sending it
+typedef struct gz_entry {
+    char *path;  // filename the entry was looked up by
+    ino_t ino;  // inode, size and mtime of the file that was compressed
+    off_t size;
+    struct timespec mtime;
+    char *data;  // gzip stream, NULL if the file did not compress well
+    int len;  // bytes of data
+    int refs;  // one for the table plus one per worker using the entry
+    struct gz_entry *next;  // hash chain
+    struct gz_entry *lru_prev;  // least recently used list, oldest first
+    struct gz_entry *lru_next;
+} gz_entry;
+
+int gz_cache_init(long bytes);
+int gz_cache_enabled();
+gz_entry *gz_cache_get(char *path, struct stat *sbuf);
+void gz_cache_release(gz_entry *entry);
+
+#endif
@@ -82,6 +82,21 @@ pid_t Wait(int *status)
 }
 /* $end wait */
 
+/*
+ * Waitpid - wait for one particular child, so a thread never reaps a child
+ *     started by another thread
+ */
+pid_t Waitpid(pid_t pid, int *status, int options) 
+{
+  pid_t rc;
+
+  while ((rc = waitpid(pid, status, options)) < 0 && errno == EINTR)
+    ;
+  if (rc < 0)
+    unix_error("Waitpid error");
+  return rc;
+}
+
 /********************************
  * Wrappers for Unix I/O routines
  ********************************/
@@ -310,6 +325,100 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_sendmore - rio_writen for a response header that is about to be
+ *     followed by a body. MSG_MORE keeps the bytes in the socket until the
+ *     body arrives, so header and body leave in the same segments without a
+ *     pair of TCP_CORK setsockopt calls. Falls back to write() if fd is not
+ *     a socket.
+ */
+ssize_t rio_sendmore(int fd, void *usrbuf, size_t n) 
+{
+  size_t nleft = n;
+  ssize_t nwritten;
+  char *bufp = usrbuf;
+
+  while (nleft > 0) {
+    if ((nwritten = send(fd, bufp, nleft, MSG_MORE)) <= 0) {
+      if (errno == EINTR)  /* interrupted by sig handler return */
+        nwritten = 0;    /* and call send() again */
+      else if (errno == ENOTSOCK)
+        return rio_writen(fd, bufp, nleft) < 0 ? -1 : n;
+      else
+        return -1;       /* errno set by send() */
+    }
+    nleft -= nwritten;
+    bufp += nwritten;
+  }
+  return n;
+}
+
+/*
+ * rio_splice - move n bytes of infd starting at offset to outfd through a
+ *     pipe, for the cases sendfile() refuses. The pipe is per thread and
+ *     kept for the life of the thread.
+ */
+static ssize_t rio_splice(int outfd, int infd, off_t offset, size_t n) 
+{
+  static __thread int pipefd[2] = {-1, -1};
+  size_t nleft = n;
+  ssize_t nin, nout;
+
+  if (pipefd[0] < 0 && pipe2(pipefd, O_CLOEXEC) < 0)
+    return -1;
+
+  while (nleft > 0) {
+    if ((nin = splice(infd, &offset, pipefd[1], NULL, nleft, SPLICE_F_MOVE)) <= 0) {
+      if (nin < 0 && errno == EINTR)
+        continue;
+      if (nin == 0)
+        errno = EIO;     /* file shorter than n */
+      return -1;
+    }
+    while (nin > 0) {    /* drain the pipe into the socket */
+      if ((nout = splice(pipefd[0], NULL, outfd, NULL, nin, 
+                         SPLICE_F_MOVE | (nleft > (size_t) nin ? SPLICE_F_MORE : 0))) <= 0) {
+        if (nout < 0 && errno == EINTR)
+          continue;
+        close(pipefd[0]);  /* pipe may still hold data, start over next time */
+        close(pipefd[1]);
+        pipefd[0] = pipefd[1] = -1;
+        return -1;
+      }
+      nin -= nout;
+      nleft -= nout;
+    }
+  }
+  return n;
+}
+
+/*
+ * rio_sendfile - robustly send n bytes of infd, starting at offset, to
+ *     outfd straight from the page cache. Uses sendfile() and falls back to
+ *     splice() if the kernel cannot sendfile this pair of descriptors.
+ *     Returns n, or -1 and sets errno on error; errno is EIO if the file
+ *     turned out shorter than n, e.g. truncated since it was stat'd.
+ */
+ssize_t rio_sendfile(int outfd, int infd, off_t offset, size_t n) 
+{
+  size_t nleft = n;
+  ssize_t nsent;
+
+  while (nleft > 0) {
+    if ((nsent = sendfile(outfd, infd, &offset, nleft)) <= 0) {
+      if (nsent < 0 && errno == EINTR)
+        continue;
+      if (nsent < 0 && (errno == EINVAL || errno == ENOSYS) && nleft == n)
+        return rio_splice(outfd, infd, offset, n);
+      if (nsent == 0)
+        errno = EIO;     /* file shorter than n */
+      return -1;
+    }
+    nleft -= nsent;
+  }
+  return n;
+}
+
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -413,6 +522,34 @@ ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
 }
 /* $end rio_readlineb */
 
+/*
+ * rio_fill - move the unread bytes of rp to the front of its buffer and
+ *    read more after them, so that a request split across reads ends up in
+ *    one piece. Returns the number of bytes read, 0 on EOF or if the buffer
+ *    is already full, and -1 on error.
+ */
+ssize_t rio_fill(rio_t *rp)
+{
+  ssize_t n;
+
+  if (rp->rio_cnt < 0)  /* rio_read leaves -1 behind after an error */
+    rp->rio_cnt = 0;
+  if (rp->rio_bufptr != rp->rio_buf) {
+    memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+    rp->rio_bufptr = rp->rio_buf;
+  }
+  if (rp->rio_cnt == RIO_BUFSIZE)
+    return 0;
+
+  while ((n = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+                   RIO_BUFSIZE - rp->rio_cnt)) < 0) {
+    if (errno != EINTR) /* interrupted by sig handler return */
+      return -1;
+  }
+  rp->rio_cnt += n;
+  return n;
+}
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -425,12 +562,57 @@ ssize_t Rio_readn(int fd, void *ptr, size_t nbytes)
   return n;
 }
 
+/* errno of the first failed send to a peer since it was last cleared */
+__thread int rio_send_errno;
+
+/*
+ * rio_abort - gives up on the response being sent on fd. Records err in
+ *     rio_send_errno, and shuts the socket down so the rest of the response
+ *     fails at once and the client sees it end early, rather than wait for
+ *     bytes that will never come on a connection that is kept alive.
+ */
+void rio_abort(int fd, int err)
+{
+  if (rio_send_errno == 0)
+    rio_send_errno = err;
+  shutdown(fd, SHUT_WR);
+}
+
+/*
+ * peer_error - the peer reset the connection or stopped reading for longer
+ *     than the socket's send timeout. Aborts the response and returns 1, or
+ *     returns 0 for any other error.
+ */
+static int peer_error(int fd)
+{
+  if (errno != EPIPE && errno != ECONNRESET && errno != EAGAIN && errno != EWOULDBLOCK)
+    return 0;
+  rio_abort(fd, errno);
+  return 1;
+}
+
 void Rio_writen(int fd, void *usrbuf, size_t n) 
 {
-  if (rio_writen(fd, usrbuf, n) != n)
+  if (rio_writen(fd, usrbuf, n) != n && !peer_error(fd))
     unix_error("Rio_writen error");
 }
 
+void Rio_sendmore(int fd, void *usrbuf, size_t n) 
+{
+  if (rio_sendmore(fd, usrbuf, n) != n && !peer_error(fd))
+    unix_error("Rio_sendmore error");
+}
+
+void Rio_sendfile(int outfd, int infd, off_t offset, size_t n) 
+{
+  if (rio_sendfile(outfd, infd, offset, n) == n)
+    return;
+  if (errno == EIO)      /* the file, not the server, is at fault */
+    rio_abort(outfd, EIO);
+  else if (!peer_error(outfd))
+    unix_error("Rio_sendfile error");
+}
+
 void Rio_readinitb(rio_t *rp, int fd)
 {
   rio_readinitb(rp, fd);
@@ -495,6 +677,19 @@ int open_clientfd(char *hostname, int port)
  */
 /* $begin open_listenfd */
 int open_listenfd(int port) 
+{
+  return open_listenfd_shared(port, 0);
+}
+/* $end open_listenfd */
+
+/*  
+ * open_listenfd_shared - open_listenfd, but if reuseport is set the socket
+ *     is bound with SO_REUSEPORT so several listening sockets (one per
+ *     acceptor thread) can share the port and the kernel spreads incoming
+ *     connections across them.
+ *     Returns -1 and sets errno on Unix error.
+ */
+int open_listenfd_shared(int port, int reuseport) 
 {
   int listenfd, optval=1;
   struct sockaddr_in serveraddr;
@@ -512,6 +707,12 @@ int open_listenfd(int port)
     return -1;
   }
 
+  if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+           (const void *)&optval , sizeof(int)) < 0) {
+    fprintf(stderr, "setsockopt failed\n");
+    return -1;
+  }
+
   /* Listenfd will be an endpoint for all requests to port
      on any IP address for this host */
   bzero((char *) &serveraddr, sizeof(serveraddr));
@@ -530,7 +731,6 @@ int open_listenfd(int port)
   }
   return listenfd;
 }
-/* $end open_listenfd */
 
 /******************************************
  * Wrappers for the client/server helper routines 
@@ -556,3 +756,12 @@ int Open_listenfd(int port)
     unix_error("Open_listenfd error");
   return rc;
 }
+
+int Open_listenfd_shared(int port, int reuseport) 
+{
+  int rc;
+
+  if ((rc = open_listenfd_shared(port, reuseport)) < 0)
+    unix_error("Open_listenfd error");
+  return rc;
+}
@@ -1,6 +1,10 @@
 #ifndef __HELPER_H__
 #define __HELPER_H__
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* accept4, strcasestr, sendfile and friends */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -23,6 +27,7 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/sendfile.h>
 
 
 /* Default file permissions are DEF_MODE & ~DEF_UMASK */
@@ -47,14 +52,64 @@ typedef struct {
 } rio_t;
 /* $end rio_t */
 
-// struct for writing to shared memory
+// histogram buckets; bucket i counts requests that took [2^i, 2^(i+1))
+// microseconds (bucket 0 also holds anything under 1us)
+#define LATENCY_BUCKETS 32
+
+// struct for writing to shared memory. Each worker owns one entry, padded
+// to whole cache lines so workers never share a line. The worker updates a
+// private copy while it serves a request and then publishes it under the
+// seqlock; readers copy the entry and retry if seq was odd or changed.
 typedef struct {
+    _Alignas(64) unsigned seq;  // seqlock, odd while the entry is being written
     pthread_t thread_ID;
     int total_reqs;
     int static_reqs;
     int dynamic_reqs;
+    int shard;  // acceptor shard the worker takes connections from
+    int cache_hits;  // static requests served from the file cache (-c)
+    int cache_misses;  // static requests the cache could not serve
+    int cache_evictions;  // files this worker pushed out of the cache
+    int errors;  // error responses sent (4xx/5xx)
+    int log_drops;  // log records dropped because the logger fell behind
+    int not_modified;  // 304 responses to If-None-Match/If-Modified-Since
+    int partial;  // 206 responses with a single range
+    int multipart;  // 206 responses with several ranges (multipart/byteranges)
+    int unsatisfiable;  // 416 responses to ranges past the end of the file
+    int local_reqs;  // connections taken from the worker's own queue (-p)
+    int stolen_reqs;  // connections taken from the tail of another worker's queue (-p)
+    int header_timeouts;  // connections given up waiting for a request header (-t, blocking)
+    int write_timeouts;  // responses given up on a client that stopped reading (-t)
+    long long bytes_sent;  // response bytes written by the server (not CGI output)
+    int wait_hist[LATENCY_BUCKETS];  // time queued before a worker took the request
+    int service_hist[LATENCY_BUCKETS];  // time from being taken to being answered
+    int latency_hist[LATENCY_BUCKETS];  // response latency, queued to answered
 } shm_entry;
 
+// start of the shared memory region, written once by the server before any
+// worker starts. num_entries shm_entry structs follow it, then num_shards
+// shm_shard structs, so readers need not guess the layout from their own
+// arguments.
+typedef struct {
+    _Alignas(64) int num_entries;  // worker entries (the server's most workers)
+    int num_shards;  // acceptor shards
+} shm_header;
+
+// per-shard counters, stored in shared memory after the shm_entry structs,
+// one for each acceptor shard
+typedef struct {
+    int workers;  // worker threads in the shard
+    int accepted;  // connections accepted by the shard's listening socket
+    int queued;  // requests put in the shard's connection buffer
+    int dequeued;  // requests taken from the buffer by the shard's workers
+    int policy;  // scheduling policy of the shard's buffer (POLICY_*)
+    int max_depth;  // most requests waiting in the buffer at once
+    int wait_avg;  // moving average of the buffer wait of taken requests (us)
+    int shed;  // new connections turned away with a 503 by admission control
+    int idle_timeouts;  // parked connections closed after idle_ms without a request
+    int header_timeouts;  // connections closed before the rest of a request arrived
+} shm_shard;
+
 
 /* External variables */
 extern int h_errno;    /* defined by BIND for DNS errors */ 
@@ -76,6 +131,7 @@ void app_error(char *msg);
 pid_t Fork(void);
 void Execve(const char *filename, char *const argv[], char *const envp[]);
 pid_t Wait(int *status);
+pid_t Waitpid(pid_t pid, int *status, int options);
 
 int Gethostname(char *name, size_t len) ;
 int Setenv(const char *name, const char *value, int overwrite);
@@ -111,13 +167,22 @@ struct hostent *Gethostbyaddr(const char *addr, int len, int type);
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
+ssize_t rio_sendmore(int fd, void *usrbuf, size_t n);
+ssize_t rio_sendfile(int outfd, int infd, off_t offset, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t rio_fill(rio_t *rp);
 
-/* Wrappers for Rio package */
+/* Wrappers for Rio package; a send to a peer that hung up or stopped
+   reading (SO_SNDTIMEO), or of a file that came up short, records errno in
+   rio_send_errno instead of exiting */
+extern __thread int rio_send_errno;
+void rio_abort(int fd, int err);
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
 void Rio_writen(int fd, void *usrbuf, size_t n);
+void Rio_sendmore(int fd, void *usrbuf, size_t n);
+void Rio_sendfile(int outfd, int infd, off_t offset, size_t n);
 void Rio_readinitb(rio_t *rp, int fd); 
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
@@ -125,12 +190,11 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
 /* Client/server helper functions */
 int open_clientfd(char *hostname, int portno);
 int open_listenfd(int portno);
+int open_listenfd_shared(int portno, int reuseport);
 
 /* Wrappers for client/server helper functions */
 int Open_clientfd(char *hostname, int port);
 int Open_listenfd(int port); 
-
-// added calls
-int Getfull(int[], int*);
+int Open_listenfd_shared(int port, int reuseport);
 
 #endif /* __HELPER_H__ */
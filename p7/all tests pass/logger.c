@@ -0,0 +1,314 @@
+//
+// logger.c: Asynchronous log for the web server.
+//
+// Every thread that logs gets a single-producer ring of LOG_RING_SIZE bytes
+// the first time it does. log_printf() formats the record on the caller's
+// stack and copies it into the ring if there is room, or counts it as
+// dropped if there is not; it never blocks and only makes a system call to
+// wake the logger thread after it has been idle for a while. The logger
+// thread gathers the unwritten bytes of every ring (at most two segments
+// each) into one writev() call, then frees the space. While records keep
+// arriving it naps LOG_FLUSH_MS between batches instead of being woken for
+// each one; after LOG_IDLE_NAPS empty naps it sleeps on a futex until a
+// producer finds it asleep. Dropped records are reported in the log itself
+// and, per worker, through log_dropped(). A thread that exits calls
+// log_release(), and the logger frees its ring once it has written it out.
+//
+
+#include "helper.h"
+#include "logger.h"
+#include <limits.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define LOG_RING_SIZE 65536  // bytes buffered per thread
+#define LOG_MAX_RECORD 2048  // longest record, longer ones are cut short
+#define LOG_MAX_RINGS 1024  // most threads that can log
+#define LOG_FLUSH_MS 10  // nap between batches while busy
+#define LOG_IDLE_NAPS 100  // empty naps before sleeping until woken
+
+// one thread's records, written by that thread and read by the logger
+typedef struct {
+    _Alignas(64) atomic_ulong head;  // bytes ever written into the ring
+    _Alignas(64) atomic_ulong tail;  // bytes ever written out by the logger
+    atomic_llong dropped;  // records that did not fit
+    atomic_int released;  // 1 once the thread will log no more
+    char data[LOG_RING_SIZE];
+} log_ring;
+
+static int log_level;  // records above this level are not logged
+static int log_fd;  // file the logger writes to
+static log_ring *rings[LOG_MAX_RINGS];  // every thread's ring
+static atomic_int ring_count;  // rings in use
+static atomic_int sleeping;  // 1 while the logger waits to be woken
+static atomic_llong unregistered;  // records dropped for want of a ring
+static long long released_dropped;  // drops counted by rings since freed, logger only
+static pthread_mutex_t register_lock = PTHREAD_MUTEX_INITIALIZER;  // guards adding rings
+static __thread log_ring *my_ring;  // calling thread's ring, NULL until it logs
+
+/**
+ * Function that parks the calling thread while *word still equals value.
+ */
+static void futex_wait(atomic_int *word, int value) {
+    syscall(SYS_futex, (int*) word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+/**
+ * Function that wakes up to count threads parked on word.
+ */
+static void futex_wake(atomic_int *word, int count) {
+    syscall(SYS_futex, (int*) word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/**
+ * Function that gives the calling thread a ring the first time it logs.
+ *
+ * Return: the thread's ring, or NULL if no more threads can log
+ */
+static log_ring *ring_get() {
+    if (my_ring != NULL) {
+        return my_ring;
+    }
+
+    pthread_mutex_lock(&register_lock);
+    int count = atomic_load(&ring_count);
+    if (count < LOG_MAX_RINGS && (my_ring = calloc(1, sizeof(log_ring))) != NULL) {
+        rings[count] = my_ring;
+        atomic_store(&ring_count, count + 1);  // publishes rings[count]
+    }
+    pthread_mutex_unlock(&register_lock);
+    return my_ring;
+}
+
+/**
+ * Function that checks whether any ring holds records not yet written or
+ * is waiting to be freed.
+ */
+static int rings_pending() {
+    int count = atomic_load(&ring_count);
+    for (int index = 0; index < count; index++) {
+        if (atomic_load(&rings[index]->head) != atomic_load(&rings[index]->tail) ||
+                atomic_load(&rings[index]->released)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function run by the logger thread that frees the rings of threads that
+ * released them once everything in them has been written, moving the last
+ * ring into each freed place.
+ */
+static void rings_reap() {
+    int count = atomic_load(&ring_count);
+
+    for (int index = count - 1; index >= 0; index--) {
+        log_ring *ring = rings[index];
+        if (!atomic_load_explicit(&ring->released, memory_order_acquire) ||
+                atomic_load(&ring->head) != atomic_load(&ring->tail)) {
+            continue;
+        }
+        released_dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        pthread_mutex_lock(&register_lock);  // ring_get() may be appending
+        count = atomic_load(&ring_count) - 1;
+        rings[index] = rings[count];
+        atomic_store(&ring_count, count);
+        pthread_mutex_unlock(&register_lock);
+        free(ring);
+    }
+}
+
+/**
+ * Function that writes out an array of buffers completely, retrying after
+ * partial writes. Records are discarded if the log cannot be written.
+ *
+ * iov: buffers to write, modified
+ * count: number of buffers
+ */
+static void write_all(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(log_fd, iov, count > IOV_MAX ? IOV_MAX : count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (count > 0 && n >= (ssize_t) iov->iov_len) {  // skip what was written
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/**
+ * Function run by the logger thread. Writes out the rings in batches.
+ *
+ * arg: unused
+ * Return: 0 (never reached)
+ */
+static void *logger_thread(void *arg) {
+    static struct iovec iov[2 * LOG_MAX_RINGS + 1];
+    static unsigned long heads[LOG_MAX_RINGS];
+    long long reported = 0;  // drops already reported in the log
+    char notice[128];
+    int naps = 0;
+
+    while (1) {
+        rings_reap();
+        int count = atomic_load(&ring_count), used = 0;
+        long long dropped = atomic_load(&unregistered) + released_dropped;
+
+        for (int index = 0; index < count; index++) {
+            log_ring *ring = rings[index];
+            unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            heads[index] = atomic_load_explicit(&ring->head, memory_order_acquire);
+            dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+
+            // the unwritten bytes are one segment, or two if they wrap
+            unsigned long start = tail % LOG_RING_SIZE, len = heads[index] - tail;
+            if (len == 0) {
+                continue;
+            }
+            unsigned long first = len < LOG_RING_SIZE - start ? len : LOG_RING_SIZE - start;
+            iov[used++] = (struct iovec) { ring->data + start, first };
+            if (first < len) {
+                iov[used++] = (struct iovec) { ring->data, len - first };
+            }
+        }
+        if (dropped != reported) {
+            int len = sprintf(notice, "log: %lld records dropped\n", dropped - reported);
+            iov[used++] = (struct iovec) { notice, len };
+            reported = dropped;
+        }
+
+        if (used > 0) {
+            write_all(iov, used);
+            for (int index = 0; index < count; index++) {  // free the space written
+                atomic_store_explicit(&rings[index]->tail, heads[index], memory_order_release);
+            }
+            naps = 0;
+        } else if (++naps > LOG_IDLE_NAPS) {
+            // announce the sleep before the last look so that a producer
+            // either sees it and wakes us or its record is seen here
+            atomic_store(&sleeping, 1);
+            if (!rings_pending()) {
+                futex_wait(&sleeping, 1);
+            }
+            atomic_store(&sleeping, 0);
+            naps = 0;
+            continue;
+        }
+
+        struct timespec nap = { 0, LOG_FLUSH_MS * 1000000L };
+        nanosleep(&nap, NULL);
+    }
+
+    return 0;
+}
+
+/**
+ * Function that starts the logger thread.
+ *
+ * level: most verbose level to log (LOG_*)
+ * path: file to append the log to, or NULL for stdout
+ * Return: 0 on success, -1 if the file cannot be opened or the thread started
+ */
+int logger_init(int level, char *path) {
+    pthread_t thread;
+
+    log_fd = STDOUT_FILENO;
+    if (path != NULL &&
+            (log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0) {
+        return -1;
+    }
+    if (level > LOG_OFF && pthread_create(&thread, NULL, logger_thread, NULL) != 0) {
+        return -1;
+    }
+    log_level = level;
+    return 0;
+}
+
+/**
+ * Function that adds a record to the calling thread's ring. Never blocks;
+ * the record is dropped if the ring is full.
+ *
+ * level: LOG_* level of the record
+ * format: printf format of the record, which should end with a newline
+ */
+void log_printf(int level, const char *format, ...) {
+    char record[LOG_MAX_RECORD];
+    va_list args;
+
+    if (level > log_level) {
+        return;
+    }
+    log_ring *ring = ring_get();
+    if (ring == NULL) {
+        atomic_fetch_add_explicit(&unregistered, 1, memory_order_relaxed);
+        return;
+    }
+
+    va_start(args, format);
+    int len = vsnprintf(record, sizeof(record), format, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    if (len >= (int) sizeof(record)) {
+        len = sizeof(record) - 1;
+    }
+
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head + len - tail > LOG_RING_SIZE) {  // logger is behind, drop the record
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    unsigned long start = head % LOG_RING_SIZE;
+    int first = len < LOG_RING_SIZE - start ? len : LOG_RING_SIZE - start;
+    memcpy(ring->data + start, record, first);
+    memcpy(ring->data, record + first, len - first);
+    atomic_store(&ring->head, head + len);  // publish, then check for a sleeper
+
+    if (atomic_load(&sleeping)) {
+        atomic_store(&sleeping, 0);
+        futex_wake(&sleeping, 1);
+    }
+}
+
+/**
+ * Function that returns how many of the calling thread's records have been
+ * dropped because its ring was full.
+ */
+long long log_dropped() {
+    return my_ring == NULL ? 0 : atomic_load_explicit(&my_ring->dropped, memory_order_relaxed);
+}
+
+/**
+ * Function that gives up the calling thread's ring before the thread exits.
+ * The logger writes out what is left in it and then frees it, so its place
+ * can go to a thread started later.
+ */
+void log_release() {
+    if (my_ring == NULL) {
+        return;
+    }
+    atomic_store(&my_ring->released, 1);  // publish, then check for a sleeper
+    my_ring = NULL;
+
+    if (atomic_load(&sleeping)) {
+        atomic_store(&sleeping, 0);
+        futex_wake(&sleeping, 1);
+    }
+}
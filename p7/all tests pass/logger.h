@@ -0,0 +1,22 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+//
+// logger.h: asynchronous logging for the web server. A thread that logs
+// formats the line into its own ring buffer and goes on; a logger thread
+// writes the rings out in batches, so no worker ever waits on stdio or on
+// the log file while it owns a client.
+//
+
+// verbosity levels selectable with -l; each includes the ones before it
+#define LOG_OFF 0  // nothing
+#define LOG_ERRORS 1  // one line per error response
+#define LOG_ACCESS 2  // one line per request (default)
+#define LOG_HEADERS 3  // the headers and bodies of error responses too
+
+int logger_init(int level, char *path);
+void log_printf(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+long long log_dropped();
+void log_release();
+
+#endif
@@ -1,4 +1,5 @@
 #include "helper.h"
+#include "cgipool.h"
 #include <sys/time.h>
 #include <assert.h>
 #include <unistd.h>
@@ -8,16 +9,21 @@
 // This program is intended to help you test your web server.
 // You can use it to test that you are correctly having multiple threads
 // handling http requests.
+//
+// When started by the server's CGI pool (-g), CGI_PERSISTENT is set and the
+// program stays running, taking one request after another from the pool
+// socket and writing each response to the client socket passed with it.
 // 
 
 double spinfor = 5.0;
 
-void getargs()
+void getargs(char *buf)
 {
-  char *buf, *p;
+  char *p;
 
   /* Extract the four arguments */
-  if ((buf = getenv("QUERY_STRING")) != NULL) {
+  spinfor = 5.0;
+  if (buf != NULL) {
     p = strtok(buf, "&");
     if (p == NULL) 
       return;
@@ -34,12 +40,11 @@ double Time_GetSeconds() {
 }
 
 
-int main(int argc, char *argv[])
+// spin for the requested time, then write the rest of the response to fd
+void respond(int fd)
 {
   char content[MAXBUF];
 
-  getargs();
-
   double t1 = Time_GetSeconds();
   while ((Time_GetSeconds() - t1) < spinfor)
     sleep(1);
@@ -50,11 +55,32 @@ int main(int argc, char *argv[])
   sprintf(content, "%s<p>My only purpose is to waste time on the server!</p>\r\n", content);
   sprintf(content, "%s<p>I spun for %.2f seconds</p>\r\n", content, t2 - t1);
   
-  /* Generate the HTTP response */
-  printf("Content-length: %lu\r\n", strlen(content));
-  printf("Content-type: text/html\r\n\r\n");
-  printf("%s", content);
-  fflush(stdout);
+  /* Generate the HTTP response, in one write */
+  dprintf(fd, "Content-length: %lu\r\nContent-type: text/html\r\n\r\n%s", 
+          strlen(content), content);
+}
+
+
+int main(int argc, char *argv[])
+{
+  char query[MAXLINE];
+  int clientfd;
+
+  if (getenv(CGI_PERSISTENT_ENV) == NULL) {
+    getargs(getenv("QUERY_STRING"));
+    respond(STDOUT_FILENO);
+    exit(0);
+  }
+
+  /* Persistent: serve requests from the pool until the server goes away */
+  signal(SIGPIPE, SIG_IGN);  /* a client that hung up must not kill us */
+  while (cgi_recv_request(CGI_SOCKET_FD, query, MAXLINE, &clientfd)) {
+    getargs(query);
+    respond(clientfd);
+    close(clientfd);
+    if (cgi_send_done(CGI_SOCKET_FD) < 0)
+      break;
+  }
 
   exit(0);
 }
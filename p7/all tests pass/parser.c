@@ -0,0 +1,270 @@
+//
+// parser.c: Incremental HTTP request header parser.
+//
+// http_parse() is a single pass state machine over the bytes of one request.
+// It never copies: the method, URI, version and the headers the server acts
+// on are recorded as offsets into the caller's buffer. If the buffer ends in
+// the middle of the request it returns 0 and the caller reads more and calls
+// it again with the longer buffer; parsing resumes where it stopped, so a
+// request split across any number of reads is only examined once. Offsets
+// stay valid if the caller moves the request within its buffer between
+// calls. Lines may end in CRLF or a bare LF, as the old line-based reader
+// allowed.
+//
+
+#include <string.h>
+#include <strings.h>
+#include "parser.h"
+
+// parser states
+#define PARSE_METHOD 0  // in the method, or skipping blank lines before it
+#define PARSE_URI_START 1  // spaces before the URI
+#define PARSE_URI 2  // in the URI
+#define PARSE_VERSION_START 3  // spaces before the version
+#define PARSE_VERSION 4  // in the version
+#define PARSE_LINE_END 5  // anything after the version, up to LF
+#define PARSE_HDR_START 6  // start of a header line or the blank line
+#define PARSE_HDR_NAME 7  // in a header name
+#define PARSE_HDR_OWS 8  // spaces between the colon and the value
+#define PARSE_HDR_VALUE 9  // in a header value
+#define PARSE_HDR_LF 10  // CR seen at the end of a header line
+#define PARSE_END_LF 11  // CR seen on the blank line
+#define PARSE_DONE 12  // whole request parsed
+
+// headers the parser records
+#define HDR_OTHER 0
+#define HDR_CONNECTION 1
+#define HDR_RANGE 2
+#define HDR_IF_MODIFIED_SINCE 3
+#define HDR_IF_NONE_MATCH 4
+#define HDR_ACCEPT_ENCODING 5
+
+// known header names, indexed by HDR_*
+static const char *header_names[] = {NULL, "Connection", "Range", "If-Modified-Since",
+    "If-None-Match", "Accept-Encoding"};
+static const int header_lengths[] = {0, 10, 5, 17, 13, 15};
+
+/**
+ * Function that resets a request before parsing a new one.
+ *
+ * req: request to reset
+ */
+void http_init(http_request *req) {
+    memset(req, 0, sizeof(http_request));
+    req->state = PARSE_METHOD;
+}
+
+/**
+ * Function that works out which known header a name is.
+ *
+ * name: start of the name
+ * len: length of the name
+ * Return: HDR_* of the name
+ */
+static int header_id(char *name, int len) {
+    for (int id = HDR_CONNECTION; id <= HDR_ACCEPT_ENCODING; id++) {
+        if (len == header_lengths[id] && strncasecmp(name, header_names[id], len) == 0) {
+            return id;
+        }
+    }
+    return HDR_OTHER;
+}
+
+/**
+ * Function that records the value of the header line just ended.
+ *
+ * req: request being parsed
+ * end: offset of the CR or LF ending the value
+ */
+static void header_value(http_request *req, int end) {
+    str_view value = { req->mark, end - req->mark - req->trail };
+
+    if (req->name == HDR_CONNECTION) {
+        req->connection = value;
+    } else if (req->name == HDR_RANGE) {
+        req->range = value;
+    } else if (req->name == HDR_IF_MODIFIED_SINCE) {
+        req->if_modified_since = value;
+    } else if (req->name == HDR_IF_NONE_MATCH) {
+        req->if_none_match = value;
+    } else if (req->name == HDR_ACCEPT_ENCODING) {
+        req->accept_encoding = value;
+    }
+}
+
+/**
+ * Function that parses as much of a request as has arrived.
+ *
+ * req: parser state, from http_init() or an earlier call on the same request
+ * buf: start of the request
+ * len: bytes of the request available, at least as many as last time
+ * Return: 1 if the whole header has been parsed (req->pos is then its
+ *         length), 0 if more bytes are needed, -1 if the request is malformed
+ */
+int http_parse(http_request *req, char *buf, int len) {
+    int pos = req->pos;
+
+    if (req->state == PARSE_DONE) {  // asked again, maybe with no new bytes
+        return 1;
+    }
+
+    for (; pos < len; pos++) {
+        char c = buf[pos];
+
+        switch (req->state) {
+        case PARSE_METHOD:
+            if (pos == req->mark && (c == '\r' || c == '\n')) {  // stray blank line
+                req->mark++;
+            } else if (c == ' ') {
+                if (pos == req->mark) {
+                    return -1;
+                }
+                req->method = (str_view) { req->mark, pos - req->mark };
+                req->state = PARSE_URI_START;
+            } else if (c == '\r' || c == '\n') {
+                return -1;
+            }
+            break;
+
+        case PARSE_URI_START:
+        case PARSE_VERSION_START:
+            if (c == '\r' || c == '\n') {
+                return -1;
+            } else if (c != ' ') {
+                req->mark = pos;
+                req->state++;  // into the URI or version
+            }
+            break;
+
+        case PARSE_URI:
+            if (c == ' ') {
+                req->uri = (str_view) { req->mark, pos - req->mark };
+                req->state = PARSE_VERSION_START;
+            } else if (c == '\r' || c == '\n') {
+                return -1;
+            }
+            break;
+
+        case PARSE_VERSION:
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+                req->version = (str_view) { req->mark, pos - req->mark };
+                req->state = c == '\n' ? PARSE_HDR_START : PARSE_LINE_END;
+            }
+            break;
+
+        case PARSE_LINE_END:
+            if (c == '\n') {
+                req->state = PARSE_HDR_START;
+            }
+            break;
+
+        case PARSE_HDR_START:
+            if (c == '\r') {
+                req->state = PARSE_END_LF;
+            } else if (c == '\n') {
+                req->state = PARSE_DONE;
+                req->pos = pos + 1;
+                return 1;
+            } else {
+                req->mark = pos;
+                req->state = PARSE_HDR_NAME;
+            }
+            break;
+
+        case PARSE_HDR_NAME:
+            if (c == ':') {
+                req->name = header_id(buf + req->mark, pos - req->mark);
+                req->headers++;
+                req->state = PARSE_HDR_OWS;
+            } else if (c == '\n') {  // no colon, ignored like any unknown header
+                req->headers++;
+                req->state = PARSE_HDR_START;
+            }
+            break;
+
+        case PARSE_HDR_OWS:
+            if (c == ' ' || c == '\t') {
+                break;
+            }
+            req->mark = pos;
+            req->trail = 0;
+            req->state = PARSE_HDR_VALUE;
+            // fall through: c is the first byte of the value, or ends it
+
+        case PARSE_HDR_VALUE:
+            if (c == '\r' || c == '\n') {
+                header_value(req, pos);
+                req->state = c == '\r' ? PARSE_HDR_LF : PARSE_HDR_START;
+            } else if (c == ' ' || c == '\t') {
+                req->trail++;
+            } else {
+                req->trail = 0;
+            }
+            break;
+
+        case PARSE_HDR_LF:
+        case PARSE_END_LF:
+            if (c != '\n') {
+                return -1;
+            }
+            if (req->state == PARSE_END_LF) {
+                req->state = PARSE_DONE;
+                req->pos = pos + 1;
+                return 1;
+            }
+            req->state = PARSE_HDR_START;
+            break;
+
+        }
+    }
+
+    req->pos = pos;
+    return 0;
+}
+
+/**
+ * Function that checks whether the request line has been parsed, for a
+ * client that closed the connection before ending its header.
+ *
+ * req: request being parsed
+ * Return: 1 if the method, URI and version are known, else 0
+ */
+int http_line_done(http_request *req) {
+    return req->state >= PARSE_LINE_END;
+}
+
+/**
+ * Function that turns a field into a C string by writing a NUL over the byte
+ * after it. Only call once parsing has finished, since that byte is part of
+ * the request.
+ *
+ * buf: start of the request
+ * view: field to return
+ * Return: the field, or "" if it is empty or absent
+ */
+char *http_str(char *buf, str_view view) {
+    if (view.len == 0) {
+        return "";
+    }
+    buf[view.off + view.len] = '\0';
+    return buf + view.off;
+}
+
+/**
+ * Function that searches a field for a word, ignoring case.
+ *
+ * buf: start of the request
+ * view: field to search
+ * token: word to look for
+ * Return: 1 if the field contains token, else 0
+ */
+int http_has_token(char *buf, str_view view, char *token) {
+    int len = strlen(token);
+
+    for (int index = 0; index + len <= view.len; index++) {
+        if (strncasecmp(buf + view.off + index, token, len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef __PARSER_H__
+#define __PARSER_H__
+
+//
+// parser.h: incremental HTTP request header parser. It works in place on
+// the bytes the client sent and records where each field is instead of
+// copying it, so parsing a request allocates and copies nothing.
+//
+
+// a field of the request: len bytes starting off bytes into the request
+typedef struct {
+    int off;  // offset from the start of the request
+    int len;  // length, 0 if absent
+} str_view;
+
+// parser state plus the fields found so far
+typedef struct {
+    int state;  // where the parser stopped (PARSE_* in parser.c)
+    int pos;  // bytes of the request examined so far
+    int mark;  // start of the token being read
+    int name;  // which known header the current line is (HDR_* in parser.c)
+    int trail;  // trailing spaces seen in the current header value
+    str_view method;  // e.g. "GET"
+    str_view uri;  // e.g. "/home.html"
+    str_view version;  // e.g. "HTTP/1.1"
+    str_view connection;  // value of the Connection header
+    str_view range;  // value of the Range header
+    str_view if_modified_since;  // value of the If-Modified-Since header
+    str_view if_none_match;  // value of the If-None-Match header
+    str_view accept_encoding;  // value of the Accept-Encoding header
+    int headers;  // number of header lines
+} http_request;
+
+void http_init(http_request *req);
+int http_parse(http_request *req, char *buf, int len);
+int http_line_done(http_request *req);
+char *http_str(char *buf, str_view view);
+int http_has_token(char *buf, str_view view, char *token);
+
+#endif
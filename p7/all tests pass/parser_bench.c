@@ -0,0 +1,296 @@
+//
+// parser_bench.c: Microbenchmark for parsing request headers.
+//
+// Builds a corpus of requests shaped like the ones browsers, curl and the
+// course client send (various header sets, CRLF and bare LF line endings,
+// static and CGI URIs, Range, If-Modified-Since and Connection headers) and
+// parses it three ways:
+//  readline  the old way: rio_readlineb into a line buffer, sscanf of the
+//            request line and a strncasecmp of every header line
+//  parser    http_parse() over the whole request at once
+//  split     http_parse() resumed after every <chunk> bytes, as when a
+//            request arrives over several reads
+// Before timing, every request is checked to parse the same way whole, split
+// into chunks and with the old code, and the first CHECK_ALL requests split
+// at every possible point. Reports ns per request and MB/s.
+//
+// To run:
+//  parser_bench [requests] [passes] [chunk]
+//
+
+#include "helper.h"
+#include "parser.h"
+
+#define MODE_READLINE 0  // rio_readlineb + sscanf
+#define MODE_PARSER 1  // http_parse() on the whole request
+#define MODE_SPLIT 2  // http_parse() fed chunk bytes at a time
+#define CHECK_ALL 500  // requests checked split at every byte
+
+char *corpus;  // every request, back to back
+int *offsets;  // start of each request in corpus, plus the end
+int requests;  // requests in the corpus
+int chunk;  // bytes per read in MODE_SPLIT
+long checksum;  // keeps the compiler from dropping the work
+
+// pieces the corpus is built from
+static char *paths[] = {
+    "/", "/home.html", "/favicon.ico", "/output.cgi", "/output.cgi?1",
+    "/output.cgi?250", "/images/logo.gif", "/photos/2021/06/beach.jpg",
+    "/static/css/site.min.css?v=20210611", "/docs/guide/chapter-12/section-4.html",
+};
+static char *agents[] = {
+    "Mozilla/5.0 (X11; Linux x86_64; rv:89.0) Gecko/20100101 Firefox/89.0",
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+        "Chrome/91.0.4472.114 Safari/537.36",
+    "curl/7.74.0",
+    "Python-urllib/3.9",
+};
+static char *dates[] = {
+    "Sat, 29 Oct 1994 19:43:31 GMT", "Fri, 11 Jun 2021 08:12:45 GMT",
+};
+static char *ranges[] = {
+    "bytes=0-499", "bytes=500-", "bytes=-500", "bytes=0-0,-1",
+};
+
+/**
+ * Function that returns a monotonic timestamp in nanoseconds.
+ */
+long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Function that writes one request in the style of a random kind of client.
+ *
+ * buf: where to write the request
+ * seed: state of rand_r
+ * Return: length of the request
+ */
+int make_request(char *buf, unsigned *seed) {
+    char *path = paths[rand_r(seed) % (sizeof(paths) / sizeof(paths[0]))];
+    char *eol = rand_r(seed) % 4 == 0 ? "\n" : "\r\n";
+    int kind = rand_r(seed) % 3, len;
+
+    if (kind == 0) {  // the course client
+        return sprintf(buf, "GET %s HTTP/1.1\nhost: localhost\n\r\n", path);
+    }
+
+    len = sprintf(buf, "GET %s HTTP/1.%d%s", path, rand_r(seed) % 2, eol);
+    len += sprintf(buf + len, "Host: localhost:8080%s", eol);
+    len += sprintf(buf + len, "User-Agent: %s%s",
+        agents[rand_r(seed) % (sizeof(agents) / sizeof(agents[0]))], eol);
+    if (kind == 1) {  // a browser
+        len += sprintf(buf + len, "Accept: text/html,application/xhtml+xml,"
+            "application/xml;q=0.9,image/webp,*/*;q=0.8%s", eol);
+        len += sprintf(buf + len, "Accept-Language: en-US,en;q=0.5%s", eol);
+        len += sprintf(buf + len, "Accept-Encoding: gzip, deflate, br%s", eol);
+        len += sprintf(buf + len, "Referer: http://localhost:8080/home.html%s", eol);
+        len += sprintf(buf + len, "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; "
+            "theme=dark%s", eol);
+        len += sprintf(buf + len, "Upgrade-Insecure-Requests: 1%s", eol);
+        len += sprintf(buf + len, "Cache-Control: max-age=0%s", eol);
+    } else {
+        len += sprintf(buf + len, "Accept: */*%s", eol);
+    }
+    if (rand_r(seed) % 3 == 0) {
+        len += sprintf(buf + len, "If-Modified-Since: %s%s", dates[rand_r(seed) % 2], eol);
+    }
+    if (rand_r(seed) % 4 == 0) {
+        len += sprintf(buf + len, "Range: %s%s", ranges[rand_r(seed) % 4], eol);
+    }
+    switch (rand_r(seed) % 3) {
+    case 0:
+        len += sprintf(buf + len, "Connection: keep-alive%s", eol);
+        break;
+    case 1:
+        len += sprintf(buf + len, "connection:close  %s", eol);
+        break;
+    }
+    len += sprintf(buf + len, "%s", eol);
+    return len;
+}
+
+/**
+ * Function that builds the corpus.
+ */
+void make_corpus() {
+    unsigned seed = 537;
+    char buf[MAXBUF];
+    long size = 0;
+
+    offsets = malloc(sizeof(int) * (requests + 1));
+    corpus = malloc((long) requests * MAXBUF);
+    if (offsets == NULL || corpus == NULL) {
+        app_error("out of memory");
+    }
+    for (int index = 0; index < requests; index++) {
+        int len = make_request(buf, &seed);
+        offsets[index] = size;
+        memcpy(corpus + size, buf, len);
+        size += len;
+    }
+    offsets[requests] = size;
+}
+
+/**
+ * Function that parses a request the way the server did before parser.c.
+ *
+ * rio: read buffer holding the request
+ * Return: 1 for Connection: keep-alive, 0 for close, -1 for neither
+ */
+int parse_readline(rio_t *rio) {
+    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+    int connection = -1;
+
+    Rio_readlineb(rio, buf, MAXLINE);
+    if (sscanf(buf, "%s %s %s", method, uri, version) != 3) {
+        app_error("readline: bad request line");
+    }
+    checksum += strlen(uri);
+    Rio_readlineb(rio, buf, MAXLINE);
+    while (strcmp(buf, "\r\n") && strcmp(buf, "\n")) {
+        if (!strncasecmp(buf, "Connection:", 11)) {
+            if (strcasestr(buf + 11, "keep-alive")) {
+                connection = 1;
+            } else if (strcasestr(buf + 11, "close")) {
+                connection = 0;
+            }
+        }
+        Rio_readlineb(rio, buf, MAXLINE);
+    }
+    return connection;
+}
+
+/**
+ * Function that parses a request with http_parse(), feeding it step bytes
+ * more at a time.
+ *
+ * req: filled in with the result
+ * buf: the request
+ * len: length of the request
+ * step: bytes per call
+ */
+void parse_split(http_request *req, char *buf, int len, int step) {
+    int avail = 0, rc = 0;
+
+    http_init(req);
+    while (rc == 0 && avail < len) {
+        avail = avail + step < len ? avail + step : len;
+        rc = http_parse(req, buf, avail);
+    }
+    if (rc != 1 || req->pos != len) {
+        app_error("parser: request not parsed");
+    }
+}
+
+/**
+ * Function that checks every request parses the same whole, split and with
+ * the old code.
+ */
+void check_corpus() {
+    rio_t rio;
+
+    for (int index = 0; index < requests; index++) {
+        char *buf = corpus + offsets[index];
+        int len = offsets[index + 1] - offsets[index];
+        http_request whole, split;
+
+        parse_split(&whole, buf, len, len);
+        for (int step = index < CHECK_ALL ? 1 : chunk; step < len;
+                step = index < CHECK_ALL ? step + 1 : len) {
+            parse_split(&split, buf, len, step);
+            if (memcmp(&whole, &split, sizeof(http_request)) != 0) {
+                app_error("parser: split request parsed differently");
+            }
+        }
+
+        rio_readinitb(&rio, -1);
+        memcpy(rio.rio_buf, buf, len);
+        rio.rio_cnt = len;
+        int connection = parse_readline(&rio);
+        int expect = http_has_token(buf, whole.connection, "keep-alive") ? 1 :
+            http_has_token(buf, whole.connection, "close") ? 0 : -1;
+        if (connection != expect || rio.rio_cnt != 0 || whole.method.len != 3 ||
+                whole.version.len != 8) {
+            app_error("parser: disagrees with readline");
+        }
+    }
+}
+
+/**
+ * Function that parses the whole corpus once.
+ *
+ * mode: MODE_* to parse with
+ */
+void run_pass(int mode) {
+    static rio_t rio;
+    http_request req;
+
+    for (int index = 0; index < requests; index++) {
+        char *buf = corpus + offsets[index];
+        int len = offsets[index + 1] - offsets[index];
+
+        if (mode == MODE_READLINE) {
+            // the request arrives in the rio buffer as after one read()
+            rio_readinitb(&rio, -1);
+            memcpy(rio.rio_buf, buf, len);
+            rio.rio_cnt = len;
+            checksum += parse_readline(&rio);
+        } else {
+            memcpy(rio.rio_buf, buf, len);
+            parse_split(&req, rio.rio_buf, len, mode == MODE_PARSER ? len : chunk);
+            checksum += req.uri.len + http_has_token(rio.rio_buf, req.connection, "close");
+        }
+    }
+}
+
+/**
+ * Main function of the benchmark.
+ *
+ * argc: number of command line arguments
+ * argv: array of command line arguments as strings
+ * Return: 0
+ */
+int main(int argc, char *argv[]) {
+    int passes = 20;
+
+    requests = 50000;
+    chunk = 64;
+    if (argc > 1) {
+        requests = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        passes = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        chunk = atoi(argv[3]);
+    }
+    if (requests <= 0 || passes <= 0 || chunk <= 0) {
+        fprintf(stderr, "Usage: %s [requests] [passes] [chunk]\n", argv[0]);
+        exit(1);
+    }
+
+    make_corpus();
+    check_corpus();
+    printf("%d requests, %.1f MB, %d passes\n", requests, offsets[requests] / 1e6, passes);
+
+    printf("%-9s %10s %10s\n", "mode", "ns/req", "MB/s");
+    char *names[] = {"readline", "parser", "split"};
+    for (int mode = MODE_READLINE; mode <= MODE_SPLIT; mode++) {
+        run_pass(mode);  // warm up
+        long long start = now_ns();
+        for (int pass = 0; pass < passes; pass++) {
+            run_pass(mode);
+        }
+        long long elapsed = now_ns() - start;
+
+        printf("%-9s %10.1f %10.1f\n", names[mode], (double) elapsed / passes / requests,
+            (double) offsets[requests] * passes / (elapsed / 1e9) / 1e6);
+    }
+
+    free(corpus);
+    free(offsets);
+    return 0;
+}
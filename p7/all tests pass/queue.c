@@ -0,0 +1,472 @@
+//
+// queue.c: Bounded FIFO rings used as the server's connection buffer.
+//
+// Enqueue and dequeue are O(1) regardless of the number of buffers, so the
+// time spent holding the server lock no longer grows with <buffers>. The
+// lock-free ring (mpmc_*) removes the lock altogether; it is Vyukov's
+// sequence-numbered bounded queue with two futex-backed counters on top so
+// that idle workers and a blocked producer sleep instead of spinning. The
+// heap (heap_*) orders connections by a scheduling key in O(log n).
+//
+
+#include "helper.h"
+#include "queue.h"
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/**
+ * Function that allocates the slots of a ring and marks it empty.
+ *
+ * queue: pointer to the ring to initialize
+ * capacity: maximum number of fds the ring can hold
+ * Return: 0 on success, -1 if capacity is invalid or allocation fails
+ */
+int ring_init(ring_queue *queue, int capacity) {
+    if (capacity <= 0) {  // ring must hold at least one fd
+        return -1;
+    }
+
+    queue->slots = malloc(sizeof(int) * capacity);  // allocate slots
+    if (queue->slots == NULL) {
+        return -1;
+    }
+
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->count = 0;
+    return 0;
+}
+
+/**
+ * Function that frees the slots of a ring.
+ *
+ * queue: pointer to the ring to free
+ */
+void ring_destroy(ring_queue *queue) {
+    free(queue->slots);
+    queue->slots = NULL;
+    queue->capacity = 0;
+    queue->count = 0;
+}
+
+/**
+ * Function that checks whether every slot of the ring is in use.
+ *
+ * queue: pointer to the ring
+ * Return: 1 if full, else 0
+ */
+int ring_full(ring_queue *queue) {
+    return queue->count == queue->capacity;
+}
+
+/**
+ * Function that checks whether the ring holds no fds.
+ *
+ * queue: pointer to the ring
+ * Return: 1 if empty, else 0
+ */
+int ring_empty(ring_queue *queue) {
+    return queue->count == 0;
+}
+
+/**
+ * Function that adds an fd at the tail of the ring. The caller must have
+ * checked that the ring is not full.
+ *
+ * queue: pointer to the ring
+ * fd: connection fd to add
+ */
+void ring_enqueue(ring_queue *queue, int fd) {
+    queue->slots[queue->tail] = fd;  // write into the tail slot
+    queue->tail++;  // advance tail, wrapping at capacity
+    if (queue->tail == queue->capacity) {
+        queue->tail = 0;
+    }
+    queue->count++;
+}
+
+/**
+ * Function that removes the fd at the head of the ring. The caller must have
+ * checked that the ring is not empty.
+ *
+ * queue: pointer to the ring
+ * Return: the oldest fd in the ring
+ */
+int ring_dequeue(ring_queue *queue) {
+    int fd = queue->slots[queue->head];  // read the head slot
+    queue->head++;  // advance head, wrapping at capacity
+    if (queue->head == queue->capacity) {
+        queue->head = 0;
+    }
+    queue->count--;
+    return fd;
+}
+
+/**
+ * Function that removes the fd at the tail of the ring, the one enqueued
+ * last, leaving the oldest ones to the ring's owner. The caller must have
+ * checked that the ring is not empty.
+ *
+ * queue: pointer to the ring
+ * Return: the newest fd in the ring
+ */
+int ring_steal(ring_queue *queue) {
+    queue->tail = (queue->tail == 0 ? queue->capacity : queue->tail) - 1;  // step back
+    queue->count--;
+    return queue->slots[queue->tail];
+}
+
+/**
+ * Function that allocates the slots of a heap and marks it empty.
+ *
+ * queue: pointer to the heap to initialize
+ * capacity: maximum number of fds the heap can hold
+ * Return: 0 on success, -1 if capacity is invalid or allocation fails
+ */
+int heap_init(heap_queue *queue, int capacity) {
+    if (capacity <= 0) {
+        return -1;
+    }
+
+    queue->items = malloc(sizeof(heap_item) * capacity);
+    if (queue->items == NULL) {
+        return -1;
+    }
+
+    queue->capacity = capacity;
+    queue->count = 0;
+    queue->reserved = 0;
+    queue->seq = 0;
+    return 0;
+}
+
+/**
+ * Function that frees the slots of a heap.
+ *
+ * queue: pointer to the heap to free
+ */
+void heap_destroy(heap_queue *queue) {
+    free(queue->items);
+    queue->items = NULL;
+    queue->capacity = 0;
+    queue->count = 0;
+}
+
+/**
+ * Function that checks whether every slot of the heap is in use.
+ *
+ * queue: pointer to the heap
+ * Return: 1 if full, else 0
+ */
+int heap_full(heap_queue *queue) {
+    return queue->count + queue->reserved == queue->capacity;
+}
+
+/**
+ * Function that checks whether the heap holds no fds.
+ *
+ * queue: pointer to the heap
+ * Return: 1 if empty, else 0
+ */
+int heap_empty(heap_queue *queue) {
+    return queue->count == 0;
+}
+
+/**
+ * Function that orders two heap items.
+ *
+ * Return: 1 if a must be served before b, else 0
+ */
+static int heap_before(heap_item *a, heap_item *b) {
+    if (a->key != b->key) {
+        return a->key < b->key;
+    }
+    return (int) (a->seq - b->seq) < 0;  // wraps safely
+}
+
+/**
+ * Function that adds an fd to the heap. The caller must have checked that
+ * the heap is not full.
+ *
+ * queue: pointer to the heap
+ * fd: connection fd to add
+ * key: priority of the connection, lowest is served first
+ */
+void heap_enqueue(heap_queue *queue, int fd, long long key) {
+    heap_item item = { key, queue->seq++, fd };
+    int index = queue->count++;
+
+    // sift up from the new leaf
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!heap_before(&item, &queue->items[parent])) {
+            break;
+        }
+        queue->items[index] = queue->items[parent];
+        index = parent;
+    }
+    queue->items[index] = item;
+}
+
+/**
+ * Function that removes the fd with the lowest key. The caller must have
+ * checked that the heap is not empty.
+ *
+ * queue: pointer to the heap
+ * key: where to store the fd's key, or NULL
+ * Return: the fd to serve next
+ */
+int heap_dequeue(heap_queue *queue, long long *key) {
+    int fd = queue->items[0].fd;
+    if (key != NULL) {
+        *key = queue->items[0].key;
+    }
+    heap_item last = queue->items[--queue->count];
+    int index = 0;
+
+    // sift the last item down from the root
+    while (1) {
+        int child = 2 * index + 1;
+        if (child >= queue->count) {
+            break;
+        }
+        if (child + 1 < queue->count && heap_before(&queue->items[child + 1],
+                &queue->items[child])) {
+            child++;
+        }
+        if (!heap_before(&queue->items[child], &last)) {
+            break;
+        }
+        queue->items[index] = queue->items[child];
+        index = child;
+    }
+    if (queue->count > 0) {
+        queue->items[index] = last;
+    }
+    return fd;
+}
+
+/**
+ * Function that returns the lowest key in the heap. The caller must have
+ * checked that the heap is not empty.
+ *
+ * queue: pointer to the heap
+ * Return: key of the fd heap_dequeue() would return
+ */
+long long heap_min_key(heap_queue *queue) {
+    return queue->items[0].key;
+}
+
+/**
+ * Function that keeps the slot of a dequeued fd in use, so that the fd can
+ * be put back with heap_enqueue() even if the heap has filled up meanwhile.
+ *
+ * queue: pointer to the heap
+ */
+void heap_reserve(heap_queue *queue) {
+    queue->reserved++;
+}
+
+/**
+ * Function that gives up a slot kept by heap_reserve(). Call it before
+ * putting the fd back, or once it will not be.
+ *
+ * queue: pointer to the heap
+ */
+void heap_unreserve(heap_queue *queue) {
+    queue->reserved--;
+}
+
+/**
+ * Function that parks the calling thread while *word still equals value.
+ */
+static void futex_wait(atomic_int *word, int value) {
+    syscall(SYS_futex, (int*) word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+/**
+ * Function that wakes up to count threads parked on word.
+ */
+static void futex_wake(atomic_int *word, int count) {
+    syscall(SYS_futex, (int*) word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/**
+ * Function that takes one unit from a futex-backed counter, parking the
+ * thread while the counter is zero.
+ *
+ * count: counter to take from
+ * waiters: number of threads parked on count
+ */
+static void counter_down(atomic_int *count, atomic_int *waiters) {
+    int value = atomic_load(count);
+    while (1) {
+        if (value > 0) {  // try to take a unit
+            if (atomic_compare_exchange_weak(count, &value, value - 1)) {
+                return;
+            }
+            continue;  // value was reloaded by the failed exchange
+        }
+
+        // announce ourselves before sleeping so counter_up() knows to wake us;
+        // futex_wait returns at once if a unit arrived in between
+        atomic_fetch_add(waiters, 1);
+        futex_wait(count, value);
+        atomic_fetch_sub(waiters, 1);
+        value = atomic_load(count);
+    }
+}
+
+/**
+ * Function that returns one unit to a futex-backed counter and wakes a
+ * parked thread if there is one.
+ *
+ * count: counter to add to
+ * waiters: number of threads parked on count
+ */
+static void counter_up(atomic_int *count, atomic_int *waiters) {
+    atomic_fetch_add(count, 1);
+    if (atomic_load(waiters) > 0) {  // only pay for the syscall when needed
+        futex_wake(count, 1);
+    }
+}
+
+/**
+ * Function that allocates a lock-free ring able to hold capacity fds.
+ *
+ * queue: pointer to the queue to initialize
+ * capacity: maximum number of queued fds (the <buffers> argument)
+ * Return: 0 on success, -1 if capacity is invalid or allocation fails
+ */
+int mpmc_init(mpmc_queue *queue, int capacity) {
+    if (capacity <= 0) {
+        return -1;
+    }
+
+    // cells are indexed with a mask, so round the ring up to a power of two;
+    // spaces still limits the queue to exactly capacity fds
+    unsigned size = 1;
+    while (size < (unsigned) capacity) {
+        size <<= 1;
+    }
+
+    queue->cells = malloc(sizeof(mpmc_cell) * size);
+    if (queue->cells == NULL) {
+        return -1;
+    }
+    for (unsigned index = 0; index < size; index++) {
+        atomic_init(&queue->cells[index].sequence, index);
+    }
+
+    queue->mask = size - 1;
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    atomic_init(&queue->items, 0);
+    atomic_init(&queue->item_waiters, 0);
+    atomic_init(&queue->spaces, capacity);
+    atomic_init(&queue->space_waiters, 0);
+    return 0;
+}
+
+/**
+ * Function that frees the cells of a lock-free ring.
+ *
+ * queue: pointer to the queue to free
+ */
+void mpmc_destroy(mpmc_queue *queue) {
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+/**
+ * Function that claims a free slot, parking until one is available. Every
+ * mpmc_put() must be preceded by exactly one mpmc_reserve().
+ *
+ * queue: pointer to the queue
+ */
+void mpmc_reserve(mpmc_queue *queue) {
+    counter_down(&queue->spaces, &queue->space_waiters);
+}
+
+/**
+ * Function that adds an fd to a slot claimed by mpmc_reserve() and wakes a
+ * parked worker if there is one.
+ *
+ * queue: pointer to the queue
+ * fd: connection fd to add
+ */
+void mpmc_put(mpmc_queue *queue, int fd) {
+    unsigned pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    mpmc_cell *cell;
+
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        unsigned seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        int diff = (int) (seq - pos);
+
+        if (diff == 0) {  // cell is free for this position, try to claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos,
+                    pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {  // a worker is still reading this cell
+            sched_yield();
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        } else {  // another producer took this position
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->fd = fd;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);  // publish
+    counter_up(&queue->items, &queue->item_waiters);
+}
+
+/**
+ * Function that removes the oldest fd, parking until one is available. Its
+ * slot stays claimed until mpmc_release().
+ *
+ * queue: pointer to the queue
+ * Return: the connection fd
+ */
+int mpmc_get(mpmc_queue *queue) {
+    counter_down(&queue->items, &queue->item_waiters);  // wait for a published fd
+
+    unsigned pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    mpmc_cell *cell;
+
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        unsigned seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        int diff = (int) (seq - (pos + 1));
+
+        if (diff == 0) {  // cell holds the fd for this position, try to claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos,
+                    pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {  // an earlier producer has not published yet
+            sched_yield();
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        } else {  // another worker took this position
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    int fd = cell->fd;
+    atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+    return fd;
+}
+
+/**
+ * Function that frees the slot of an fd taken with mpmc_get(), waking the
+ * producer if it is parked. Every mpmc_get() must be followed by exactly
+ * one mpmc_release().
+ *
+ * queue: pointer to the queue
+ */
+void mpmc_release(mpmc_queue *queue) {
+    counter_up(&queue->spaces, &queue->space_waiters);
+}
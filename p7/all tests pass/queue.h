@@ -0,0 +1,94 @@
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+#include <stdatomic.h>
+
+//
+// queue.h: Bounded FIFOs of accepted connection fds shared between the
+// producer (accept) thread and the worker threads.
+//
+// ring_queue does no locking; callers hold the server lock around every
+// call, exactly as they did for the old array scan. mpmc_queue is lock-free
+// and does its own blocking, parking threads on a futex only when there is
+// nothing to take or no free slot. heap_queue replaces ring_queue, under
+// the same lock, when a scheduling policy other than FIFO is in use.
+//
+
+// connection buffer implementations selectable with -q
+#define QUEUE_RING 0  // ring_queue guarded by the server lock and condvars
+#define QUEUE_LOCKFREE 1  // mpmc_queue
+
+// scheduling policies selectable with -s
+#define POLICY_FIFO 0  // oldest connection first
+#define POLICY_SFF 1  // smallest static file first, then dynamic requests
+#define POLICY_STATIC 2  // static requests before dynamic ones
+
+// ring buffer of connection fds
+typedef struct {
+    int *slots;  // storage for queued fds
+    int capacity;  // number of slots (the <buffers> argument)
+    int head;  // index of the oldest queued fd
+    int tail;  // index the next fd will be written to
+    int count;  // number of queued fds
+} ring_queue;
+
+int ring_init(ring_queue *queue, int capacity);
+void ring_destroy(ring_queue *queue);
+int ring_full(ring_queue *queue);
+int ring_empty(ring_queue *queue);
+void ring_enqueue(ring_queue *queue, int fd);
+int ring_dequeue(ring_queue *queue);
+int ring_steal(ring_queue *queue);
+
+// one queued connection of a heap_queue
+typedef struct {
+    long long key;  // priority, lowest is served first
+    unsigned seq;  // arrival order, breaks ties so equal keys stay FIFO
+    int fd;  // connection fd
+} heap_item;
+
+// binary min-heap of connection fds ordered by (key, seq)
+typedef struct {
+    heap_item *items;  // heap storage
+    int capacity;  // number of slots (the <buffers> argument)
+    int count;  // number of queued fds
+    int reserved;  // slots kept for fds taken out to be put back
+    unsigned seq;  // arrival counter
+} heap_queue;
+
+int heap_init(heap_queue *queue, int capacity);
+void heap_destroy(heap_queue *queue);
+int heap_full(heap_queue *queue);
+int heap_empty(heap_queue *queue);
+void heap_enqueue(heap_queue *queue, int fd, long long key);
+int heap_dequeue(heap_queue *queue, long long *key);
+long long heap_min_key(heap_queue *queue);
+void heap_reserve(heap_queue *queue);
+void heap_unreserve(heap_queue *queue);
+
+// one slot of the lock-free ring; sequence says whose turn the slot is
+typedef struct {
+    atomic_uint sequence;  // == position when free, position + 1 when full
+    int fd;  // connection fd stored in this slot
+} mpmc_cell;
+
+// sequence-numbered multi-producer/multi-consumer ring
+typedef struct {
+    mpmc_cell *cells;  // ring storage, a power of two in size
+    unsigned mask;  // number of cells - 1
+    _Alignas(64) atomic_uint enqueue_pos;  // next position to write
+    _Alignas(64) atomic_uint dequeue_pos;  // next position to read
+    _Alignas(64) atomic_int items;  // futex word: fds ready for workers
+    atomic_int item_waiters;  // workers parked on items
+    _Alignas(64) atomic_int spaces;  // futex word: free slots out of <buffers>
+    atomic_int space_waiters;  // producers parked on spaces
+} mpmc_queue;
+
+int mpmc_init(mpmc_queue *queue, int capacity);
+void mpmc_destroy(mpmc_queue *queue);
+void mpmc_reserve(mpmc_queue *queue);
+void mpmc_put(mpmc_queue *queue, int fd);
+int mpmc_get(mpmc_queue *queue);
+void mpmc_release(mpmc_queue *queue);
+
+#endif
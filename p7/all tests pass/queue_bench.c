@@ -0,0 +1,303 @@
+//
+// queue_bench.c: Microbenchmark for the server's connection buffer.
+//
+// Runs one producer and several consumer threads over the old array-scan
+// buffer, the ring queue and the lock-free ring for 16 to 16384 buffers,
+// then reports the average time the lock is held per operation (0 for the
+// lock-free ring) and the accept-to-dispatch latency (time from enqueue to
+// a worker taking the item).
+//
+// To run:
+//  queue_bench [items] [workers] [work_ns]
+//
+
+#include "helper.h"
+#include "queue.h"
+
+#define FREE_SLOT -2  // legacy buffer: slot is free
+#define BUSY_SLOT -1  // legacy buffer: slot is reserved or being handled
+
+#define IMPL_SCAN 0  // the server's original array scan
+#define IMPL_RING 1  // ring_queue under the lock
+#define IMPL_LOCKFREE 2  // mpmc_queue
+
+pthread_mutex_t lock;  // lock protecting the buffer under test
+pthread_cond_t cons;  // condition variable for consumers
+pthread_cond_t prod;  // condition variable for producer
+
+int impl;  // IMPL_* being benchmarked
+int buffers;  // number of buffers for the current run
+int items;  // number of items pushed through per run
+int work_ns;  // simulated request handling time per item
+
+int *legacy_buf;  // legacy buffer array
+int num_full;  // legacy: number of full entries
+int num_empty;  // legacy: number of empty entries
+ring_queue ring;  // ring under test
+mpmc_queue lockfree;  // lock-free ring under test
+
+long long *enqueued_at;  // per-item enqueue timestamps (ns)
+long long *latency;  // per-item accept-to-dispatch latency (ns)
+long long hold_ns;  // total lock hold time, protected by lock
+long long hold_count;  // number of critical sections timed, protected by lock
+int consumed;  // number of items taken so far, protected by lock
+
+/**
+ * Function that returns a monotonic timestamp in nanoseconds.
+ */
+long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Function that spins for the given number of nanoseconds to stand in for
+ * request handling outside the lock.
+ */
+void spin_ns(int ns) {
+    long long end = now_ns() + ns;
+    while (now_ns() < end) {
+    }
+}
+
+// copies of the server's original get_full()/get_empty() scans
+int legacy_get_full(int *index_ptr) {
+    for (int index = 0; index < buffers; index++) {
+        if (legacy_buf[index] != FREE_SLOT && legacy_buf[index] != BUSY_SLOT) {
+            *index_ptr = index;
+            int temp = legacy_buf[index];
+            legacy_buf[index] = BUSY_SLOT;
+            num_full--;
+            return temp;
+        }
+    }
+    return -1;
+}
+
+int legacy_get_empty() {
+    for (int index = 0; index < buffers; index++) {
+        if (legacy_buf[index] == FREE_SLOT) {
+            legacy_buf[index] = BUSY_SLOT;
+            num_empty--;
+            return index;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Consumer thread. Takes items until all have been consumed, recording
+ * dispatch latency and lock hold time.
+ *
+ * arg: unused
+ * Return: 0 to end thread
+ */
+void *consumer(void *arg) {
+    while (impl == IMPL_LOCKFREE) {
+        int item = mpmc_get(&lockfree);
+        mpmc_release(&lockfree);  // free the slot at once, like the ring
+        if (item < 0) {  // producer is done
+            return 0;
+        }
+        latency[item] = now_ns() - enqueued_at[item];
+        spin_ns(work_ns);
+    }
+
+    while (1) {
+        pthread_mutex_lock(&lock);
+        while (consumed < items && (impl == IMPL_RING ? ring_empty(&ring) : num_full == 0)) {
+            pthread_cond_wait(&cons, &lock);
+        }
+        if (consumed == items) {  // everything has been handed out
+            pthread_mutex_unlock(&lock);
+            return 0;
+        }
+
+        long long start = now_ns();  // lock is held from here
+        int item, slot = 0;
+        if (impl == IMPL_RING) {
+            item = ring_dequeue(&ring);
+            pthread_cond_signal(&prod);
+        } else {
+            item = legacy_get_full(&slot);
+        }
+        consumed++;
+        long long end = now_ns();
+        hold_ns += end - start;
+        hold_count++;
+        if (consumed == items) {  // wake idle consumers so they can exit
+            pthread_cond_broadcast(&cons);
+        }
+        pthread_mutex_unlock(&lock);
+
+        latency[item] = end - enqueued_at[item];
+        spin_ns(work_ns);  // handle the "request"
+
+        if (impl == IMPL_SCAN) {  // legacy buffer frees the slot only after handling
+            pthread_mutex_lock(&lock);
+            start = now_ns();
+            legacy_buf[slot] = FREE_SLOT;
+            num_empty++;
+            pthread_cond_signal(&prod);
+            hold_ns += now_ns() - start;
+            hold_count++;
+            pthread_mutex_unlock(&lock);
+        }
+    }
+}
+
+/**
+ * Producer loop, shaped like the server's accept loop.
+ */
+void produce(int workers) {
+    if (impl == IMPL_LOCKFREE) {
+        for (int item = 0; item < items + workers; item++) {
+            mpmc_reserve(&lockfree);
+            if (item < items) {
+                enqueued_at[item] = now_ns();
+                mpmc_put(&lockfree, item);
+            } else {
+                mpmc_put(&lockfree, -1);  // one stop marker per consumer
+            }
+        }
+        return;
+    }
+
+    for (int item = 0; item < items; item++) {
+        pthread_mutex_lock(&lock);
+        if (impl == IMPL_RING) {
+            while (ring_full(&ring)) {
+                pthread_cond_wait(&prod, &lock);
+            }
+            long long start = now_ns();
+            enqueued_at[item] = start;
+            ring_enqueue(&ring, item);
+            pthread_cond_signal(&cons);
+            hold_ns += now_ns() - start;
+            hold_count++;
+        } else {
+            while (num_empty == 0) {
+                pthread_cond_wait(&prod, &lock);
+            }
+            long long start = now_ns();
+            int slot = legacy_get_empty();
+            hold_ns += now_ns() - start;
+            hold_count++;
+            pthread_mutex_unlock(&lock);  // server accepts here
+
+            pthread_mutex_lock(&lock);
+            start = now_ns();
+            enqueued_at[item] = start;
+            legacy_buf[slot] = item;
+            num_full++;
+            pthread_cond_signal(&cons);
+            hold_ns += now_ns() - start;
+            hold_count++;
+        }
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+/**
+ * Function used by qsort to order latencies.
+ */
+int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long*) a;
+    long long y = *(const long long*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Function that runs one configuration and prints a row of results.
+ *
+ * workers: number of consumer threads
+ */
+void run(int workers) {
+    pthread_t threads[workers];
+
+    hold_ns = 0;
+    hold_count = 0;
+    consumed = 0;
+    if (impl == IMPL_RING) {
+        ring_init(&ring, buffers);
+    } else if (impl == IMPL_LOCKFREE) {
+        mpmc_init(&lockfree, buffers);
+    } else {
+        legacy_buf = malloc(sizeof(int) * buffers);
+        for (int index = 0; index < buffers; index++) {
+            legacy_buf[index] = FREE_SLOT;
+        }
+        num_full = 0;
+        num_empty = buffers;
+    }
+
+    long long start = now_ns();
+    for (int index = 0; index < workers; index++) {
+        pthread_create(&threads[index], NULL, consumer, NULL);
+    }
+    produce(workers);
+    for (int index = 0; index < workers; index++) {
+        pthread_join(threads[index], NULL);
+    }
+    long long elapsed = now_ns() - start;
+
+    qsort(latency, items, sizeof(long long), compare_ll);
+    char *names[] = {"scan", "ring", "lockfree"};
+    printf("%-8s %7d %12.1f %12.1f %12.1f %12.0f\n", names[impl], buffers,
+        hold_count ? (double) hold_ns / hold_count : 0.0, latency[items / 2] / 1000.0,
+            latency[(int) (items * 0.99)] / 1000.0, items / (elapsed / 1e9));
+
+    if (impl == IMPL_RING) {
+        ring_destroy(&ring);
+    } else if (impl == IMPL_LOCKFREE) {
+        mpmc_destroy(&lockfree);
+    } else {
+        free(legacy_buf);
+    }
+}
+
+/**
+ * Main function of the benchmark.
+ *
+ * argc: number of command line arguments
+ * argv: array of command line arguments as strings
+ * Return: 0
+ */
+int main(int argc, char *argv[]) {
+    int workers = 4;  // consumer threads
+
+    items = 200000;
+    work_ns = 2000;
+    if (argc > 1) {
+        items = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        workers = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        work_ns = atoi(argv[3]);
+    }
+    if (items <= 0 || workers <= 0 || work_ns < 0) {
+        fprintf(stderr, "Usage: %s [items] [workers] [work_ns]\n", argv[0]);
+        exit(1);
+    }
+
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&cons, NULL);
+    pthread_cond_init(&prod, NULL);
+    enqueued_at = malloc(sizeof(long long) * items);
+    latency = malloc(sizeof(long long) * items);
+
+    printf("%-8s %7s %12s %12s %12s %12s\n", "impl", "buffers", "hold_ns",
+        "p50_us", "p99_us", "items/s");
+    for (buffers = 16; buffers <= 16384; buffers *= 4) {
+        for (impl = IMPL_SCAN; impl <= IMPL_LOCKFREE; impl++) {
+            run(workers);
+        }
+    }
+
+    free(enqueued_at);
+    free(latency);
+    return 0;
+}
@@ -4,12 +4,47 @@
 
 #include "helper.h"
 #include "request.h"
-
-// requestError(      fd,    filename,        "404",    "Not found", "CS537 Server could not find this file");
-void requestError(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg) 
+#include "parser.h"
+#include "cache.h"
+#include "cgipool.h"
+#include "logger.h"
+#include "uring.h"
+#include "gzcache.h"
+#include <time.h>
+
+#define MAX_RANGES 16  // ranges served from one Range header; more and it is ignored
+
+static int header_ms;  // most a worker waits for a request header, 0 for no limit (-t)
+
+// content types by file extension, and whether they are worth compressing
+static const struct {
+  char *ext;
+  char *type;
+  int compress;
+} mime_types[] = {
+  {"html", "text/html", 1}, {"htm", "text/html", 1}, {"css", "text/css", 1},
+  {"js", "text/javascript", 1}, {"mjs", "text/javascript", 1},
+  {"json", "application/json", 1}, {"xml", "application/xml", 1},
+  {"txt", "text/plain", 1}, {"csv", "text/csv", 1}, {"md", "text/markdown", 1},
+  {"svg", "image/svg+xml", 1}, {"ico", "image/x-icon", 1}, {"wasm", "application/wasm", 1},
+  {"gif", "image/gif", 0}, {"jpg", "image/jpeg", 0}, {"jpeg", "image/jpeg", 0},
+  {"png", "image/png", 0}, {"webp", "image/webp", 0}, {"avif", "image/avif", 0},
+  {"woff", "font/woff", 0}, {"woff2", "font/woff2", 0}, {"pdf", "application/pdf", 0},
+  {"mp3", "audio/mpeg", 0}, {"mp4", "video/mp4", 0}, {"webm", "video/webm", 0},
+  {"gz", "application/gzip", 0}, {"zip", "application/zip", 0},
+};
+
+// header of one part of a multipart/byteranges body
+#define MULTIPART_HEADER "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n"
+
+// requestError(      fd,    filename,        "404",    "Not found", "CS537 Server could not find this file", tracker);
+void requestError(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg, 
+                  shm_entry *tracker) 
 {
   char buf[MAXLINE], body[MAXBUF];
 
+  log_printf(LOG_ERRORS, "%s %s: %s\n", errnum, shortmsg, cause);
+
   // Create the body of the error message
   sprintf(body, "<html><title>CS537 Error</title>");
   sprintf(body, "%s<body bgcolor=\"fffff\">\r\n", body);
@@ -20,34 +55,82 @@ void requestError(int fd, char *cause, char *errnum, char *shortmsg, char *longm
   // Write out the header information for this response
   sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
   Rio_writen(fd, buf, strlen(buf));
-  printf("%s", buf);
+  tracker->bytes_sent += strlen(buf);
+  log_printf(LOG_HEADERS, "%s", buf);
 
   sprintf(buf, "Content-Type: text/html\r\n");
   Rio_writen(fd, buf, strlen(buf));
-  printf("%s", buf);
+  tracker->bytes_sent += strlen(buf);
+  log_printf(LOG_HEADERS, "%s", buf);
 
   sprintf(buf, "Content-Length: %lu\r\n\r\n", strlen(body));
   Rio_writen(fd, buf, strlen(buf));
-  printf("%s", buf);
+  tracker->bytes_sent += strlen(buf);
+  log_printf(LOG_HEADERS, "%s", buf);
 
   // Write out the content
   Rio_writen(fd, body, strlen(body));
-  printf("%s", body);
+  log_printf(LOG_HEADERS, "%s\n", body);
+
+  tracker->errors++;
+  tracker->bytes_sent += strlen(body);
 }
 
 
 //
-// Reads and discards everything up to an empty text line
+// Sets how long requestReadhdrs() may spend reading one header; the socket's
+// receive timeout should be set to the same so a silent client is caught too
+//
+void requestSetHeaderTimeout(int ms)
+{
+  header_ms = ms;
+}
+
+//
+// Returns a monotonic timestamp in milliseconds
 //
-void requestReadhdrs(rio_t *rp)
+static long long requestNow()
 {
-  char buf[MAXLINE];
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-  Rio_readlineb(rp, buf, MAXLINE);
-  while (strcmp(buf, "\r\n")) {
-    Rio_readlineb(rp, buf, MAXLINE);
+//
+// Reads the request header into rio's buffer and parses it in place,
+// resuming from req, which is either fresh from http_init() or holds what
+// the event loop already parsed of the bytes at the front of the buffer
+// Returns 1 once the header is parsed (the parsed bytes are left in the
+// buffer and req->pos of them must be consumed), 0 if the client closed the
+// connection without sending anything, -1 if the request is malformed,
+// -3 if the header is too large for the buffer, and -2 if the header
+// timeout (-t) ran out first, between bytes or over a header trickled in
+// slowly. A client that closes the connection after the request line is
+// served as if it had ended the header.
+//
+int requestReadhdrs(rio_t *rp, http_request *req, int *eof)
+{
+  int rc;
+  long long start = header_ms > 0 ? requestNow() : 0;
+
+  *eof = 0;
+  while ((rc = http_parse(req, rp->rio_bufptr, rp->rio_cnt)) == 0) {
+    if (rp->rio_cnt == RIO_BUFSIZE)
+      return -3;
+    if (header_ms > 0 && requestNow() - start >= header_ms)
+      return -2;
+    if ((rc = rio_fill(rp)) <= 0) {
+      if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return -2;
+      *eof = 1;
+      if (http_line_done(req)) {
+        req->pos = rp->rio_cnt;
+        return 1;
+      }
+      return rp->rio_cnt > 0 ? -1 : 0;
+    }
   }
-  return;
+  return rc;
 }
 
 //
@@ -81,22 +164,87 @@ int requestParseURI(char *uri, char *filename, char *cgiargs)
 }
 
 //
-// Fills in the filetype given the filename
+// Classifies a request from the first len bytes the client sent, without
+// consuming them; used to schedule a connection before it is served
+// Returns 1 if static (size set to the file's size, 0 if it does not
+// exist), 0 if dynamic, and -1 if the request line is not all there yet
+//
+int requestClassify(char *buf, int len, off_t *size)
+{
+  char line[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+  char filename[MAXLINE], cgiargs[MAXLINE];
+  char *end = memchr(buf, '\n', len);
+  struct stat sbuf;
+
+  if (end == NULL || end - buf >= MAXLINE)
+    return -1;
+  memcpy(line, buf, end - buf);
+  line[end - buf] = '\0';
+  if (sscanf(line, "%s %s %s", method, uri, version) != 3)
+    return -1;
+
+  if (!requestParseURI(uri, filename, cgiargs))
+    return 0;
+  *size = stat(filename, &sbuf) < 0 ? 0 : sbuf.st_size;
+  return 1;
+}
+
+//
+// Fills in the filetype given the filename, from its extension
+// Returns 1 if files of the type are worth compressing, else 0
+//
+int requestGetFiletype(char *filename, char *filetype)
+{
+  char *ext = strrchr(filename, '.');
+  int index;
+
+  if (ext != NULL && strchr(ext, '/') == NULL) {
+    for (index = 0; index < sizeof(mime_types) / sizeof(mime_types[0]); index++) {
+      if (!strcasecmp(ext + 1, mime_types[index].ext)) {
+        strcpy(filetype, mime_types[index].type);
+        return mime_types[index].compress;
+      }
+    }
+  }
+  strcpy(filetype, "text/plain");
+  return 0;  // could be anything
+}
+
+//
+// Checks whether an Accept-Encoding value allows a gzip response
+// Returns 1 if gzip (or *) is listed with a q-value above 0, else 0
 //
-void requestGetFiletype(char *filename, char *filetype)
+int requestAcceptsGzip(char *value)
 {
-  if (strstr(filename, ".html")) 
-    strcpy(filetype, "text/html");
-  else if (strstr(filename, ".gif")) 
-    strcpy(filetype, "image/gif");
-  else if (strstr(filename, ".jpg")) 
-    strcpy(filetype, "image/jpeg");
-  else 
-    strcpy(filetype, "text/plain");
+  char *coding = value, *end, *param;
+  int star = 0, len;
+
+  while (*coding != '\0') {
+    coding += strspn(coding, ", \t");
+    len = strcspn(coding, ",; \t");
+    end = coding + strcspn(coding, ",");
+    param = strcasestr(coding, "q=");
+    double q = (param != NULL && param < end) ? atof(param + 2) : 1.0;
+
+    if ((len == 4 && !strncasecmp(coding, "gzip", 4)) ||
+        (len == 6 && !strncasecmp(coding, "x-gzip", 6)))
+      return q > 0;
+    if (len == 1 && coding[0] == '*')
+      star = q > 0;
+    coding = end;
+  }
+  return star;
 }
 
-void requestServeDynamic(int fd, char *filename, char *cgiargs)
+//
+// Runs a CGI program on the connection
+// child: if not NULL, set to the pid of the CGI process, which the caller
+//        must reap; otherwise the CGI process is waited for
+//
+void requestServeDynamic(int fd, char *filename, char *cgiargs, pid_t *child, 
+                         shm_entry *tracker)
 {
+  pid_t pid;
   char buf[MAXLINE], *emptylist[] = {NULL};
 
   // The server does only a little bit of the header.  
@@ -105,88 +253,508 @@ void requestServeDynamic(int fd, char *filename, char *cgiargs)
   sprintf(buf, "%sServer: CS537 Web Server\r\n", buf);
 
   Rio_writen(fd, buf, strlen(buf));
+  tracker->bytes_sent += strlen(buf);  // the rest is written by the CGI program
 
-  if (Fork() == 0) {
+  // a persistent process from the pool writes the rest, if there is a pool
+  if (cgi_pool_enabled() && cgi_pool_serve(filename, cgiargs, fd) == 0)
+    return;
+
+  if ((pid = Fork()) == 0) {
     /* Child process */
     Setenv("QUERY_STRING", cgiargs, 1);
     /* When the CGI process writes to stdout, it will instead go to the socket */
     Dup2(fd, STDOUT_FILENO);
     Execve(filename, emptylist, environ);
   }
-  Wait(NULL);
+  if (child != NULL)
+    *child = pid;
+  else
+    Waitpid(pid, NULL, 0);  // only our own child, never another worker's
 }
 
 
-void requestServeStatic(int fd, char *filename, int filesize) 
+//
+// Fills in the entity tag of a file, which changes whenever the file is
+// replaced (inode), modified (mtime) or resized; an encoded version of the
+// file gets a tag of its own
+//
+void requestEtag(char *etag, struct stat *sbuf, char *encoding)
 {
-  int srcfd;
-  char *srcp, filetype[MAXLINE], buf[MAXBUF];
-
-  requestGetFiletype(filename, filetype);
+  sprintf(etag, "\"%lx-%llx-%llx%s%s\"", (unsigned long) sbuf->st_ino,
+          (long long) sbuf->st_mtim.tv_sec * 1000000000LL + sbuf->st_mtim.tv_nsec,
+          (long long) sbuf->st_size, encoding ? "-" : "", encoding ? encoding : "");
+}
 
-  srcfd = Open(filename, O_RDONLY, 0);
+//
+// Fills in the status line and the headers every static response has
+// encoding: Content-Encoding of the body, or NULL if the file is sent as is
+//
+void requestBaseHeader(char *buf, char *status, struct stat *sbuf, char *encoding,
+                       int keep_alive)
+{
+  char date[64], etag[64];
+  struct tm tm;
 
-  // Rather than call read() to read the file into memory, 
-  // which would require that we allocate a buffer, we memory-map the file
-  srcp = Mmap(0, filesize, PROT_READ, MAP_PRIVATE, srcfd, 0);
-  Close(srcfd);
+  strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&sbuf->st_mtime, &tm));
+  requestEtag(etag, sbuf, encoding);
 
-  // put together response
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");
+  if (keep_alive) {
+    sprintf(buf, "HTTP/1.1 %s\r\n", status);
+    sprintf(buf, "%sConnection: keep-alive\r\n", buf);
+  } else {
+    sprintf(buf, "HTTP/1.0 %s\r\n", status);
+  }
   sprintf(buf, "%sServer: CS537 Web Server\r\n", buf);
-  sprintf(buf, "%sContent-Length: %d\r\n", buf, filesize);
+  sprintf(buf, "%sLast-Modified: %s\r\n", buf, date);
+  sprintf(buf, "%sETag: %s\r\n", buf, etag);
+  sprintf(buf, "%sAccept-Ranges: bytes\r\n", buf);
+  if (encoding)
+    sprintf(buf, "%sContent-Encoding: %s\r\n", buf, encoding);
+}
+
+//
+// Fills in the response header for a static file
+// length: bytes of the body, which differs from the file's size if encoded
+//
+void requestStaticHeader(char *buf, char *filename, struct stat *sbuf, off_t length,
+                         char *encoding, int keep_alive)
+{
+  char filetype[MAXLINE];
+  int compress = requestGetFiletype(filename, filetype);
+
+  requestBaseHeader(buf, "200 OK", sbuf, encoding, keep_alive);
+  if (compress)
+    sprintf(buf, "%sVary: Accept-Encoding\r\n", buf);
+  sprintf(buf, "%sContent-Length: %lld\r\n", buf, (long long) length);
   sprintf(buf, "%sContent-Type: %s\r\n\r\n", buf, filetype);
+}
+
+//
+// Sends a header followed by count bytes of srcfd starting at offset
+//
+void requestSendFile(int fd, char *header, int srcfd, off_t offset, int count,
+                     shm_entry *tracker)
+{
+  // With -u the header and the file go out as one linked io_uring chain
+  int rc = uring_sendfile(fd, header, srcfd, offset, count);
+
+  if (rc < 0) {
+    rio_abort(fd, EIO);  // client went away, file came up short or send stopped halfway
+    return;
+  }
+  if (rc > 0) {
+    // The header is held back (MSG_MORE) so it goes out with the start of the
+    // body, and the body is copied by the kernel straight from the page cache
+    // to the socket rather than being mapped into our address space
+    if (count > 0) {
+      Rio_sendmore(fd, header, strlen(header));
+      Rio_sendfile(fd, srcfd, offset, count);
+    } else {
+      Rio_writen(fd, header, strlen(header));  // nothing to follow, don't hold it back
+    }
+  }
+  tracker->bytes_sent += strlen(header) + count;
+}
+
+//
+// Checks the validators of a conditional GET against the file, or its
+// version with the given encoding
+// Returns 1 if the client's copy is current (answer 304), else 0
+//
+int requestNotModified(char *base, http_request *req, struct stat *sbuf, char *encoding)
+{
+  char etag[64], *tag;
+  struct tm tm;
+  int len;
+
+  // If-None-Match wins over If-Modified-Since; tags compare weakly
+  if (req->if_none_match.len > 0) {
+    requestEtag(etag, sbuf, encoding);
+    tag = http_str(base, req->if_none_match);
+    while (*(tag += strspn(tag, ", \t")) != '\0') {
+      if (!strncmp(tag, "W/", 2))
+        tag += 2;
+      len = strcspn(tag, ", \t");
+      if ((len == 1 && tag[0] == '*') || (len == strlen(etag) && !strncmp(tag, etag, len)))
+        return 1;
+      tag += len;
+    }
+    return 0;
+  }
+
+  if (req->if_modified_since.len > 0) {
+    memset(&tm, 0, sizeof(tm));
+    char *end = strptime(http_str(base, req->if_modified_since), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end != NULL && *end == '\0')
+      return sbuf->st_mtime <= timegm(&tm);
+  }
+  return 0;
+}
 
+//
+// Answers a conditional GET whose copy is current: the validators, no body
+//
+void requestServeNotModified(int fd, char *filename, struct stat *sbuf, char *encoding,
+                             int keep_alive, shm_entry *tracker)
+{
+  char buf[MAXBUF], filetype[MAXLINE];
+
+  requestBaseHeader(buf, "304 Not Modified", sbuf, encoding, keep_alive);
+  if (requestGetFiletype(filename, filetype))
+    strcat(buf, "Vary: Accept-Encoding\r\n");
+  strcat(buf, "\r\n");
   Rio_writen(fd, buf, strlen(buf));
+  tracker->bytes_sent += strlen(buf);
+  tracker->not_modified++;
+}
+
+//
+// Parses the value of a Range header into at most MAX_RANGES byte ranges of
+// a file of the given size, dropping those that start past its end
+// Returns the number of ranges (0 if none is satisfiable), or -1 if the
+// header is malformed or has too many ranges, in which case it is ignored
+//
+int requestParseRanges(char *value, off_t size, off_t *start, off_t *end)
+{
+  int count = 0, parsed = 0;
+  char *spec, *dash, *rest;
+  long long first, last;
+
+  if (strncasecmp(value, "bytes=", 6))
+    return -1;
+  for (spec = strtok_r(value + 6, ", \t", &rest); spec != NULL;
+       spec = strtok_r(NULL, ", \t", &rest)) {
+    if (++parsed > MAX_RANGES || (dash = strchr(spec, '-')) == NULL)
+      return -1;
+    *dash = '\0';
+    if (spec == dash) {  // "-n": the last n bytes
+      if (!isdigit(dash[1]) || (last = strtoll(dash + 1, &dash, 10)) <= 0 || *dash != '\0')
+        return -1;
+      first = last < size ? size - last : 0;
+      last = size - 1;
+    } else {  // "first-" or "first-last"
+      if (!isdigit(spec[0]) || (first = strtoll(spec, &spec, 10)) < 0 || *spec != '\0')
+        return -1;
+      if (dash[1] == '\0') {
+        last = size - 1;
+      } else {
+        if (!isdigit(dash[1]) || (last = strtoll(dash + 1, &dash, 10)) < first ||
+            *dash != '\0')
+          return -1;
+        if (last >= size)
+          last = size - 1;
+      }
+    }
+    if (first < size) {
+      start[count] = first;
+      end[count] = last;
+      count++;
+    }
+  }
+  return parsed > 0 ? count : -1;
+}
+
+//
+// Answers a Range request on an open static file: 206 with the one range,
+// 206 with a multipart/byteranges body for several, or 416 if none is
+// satisfiable
+// Returns 1 if answered, 0 if the Range header is to be ignored and the
+// whole file sent
+//
+int requestServeRanges(int fd, char *range, char *filename, struct stat *sbuf, int srcfd,
+                       int keep_alive, shm_entry *tracker)
+{
+  off_t start[MAX_RANGES], end[MAX_RANGES];
+  char buf[MAXBUF], part[MAXLINE], filetype[MAXLINE], boundary[64];
+  long long length;
+  int count, index;
+
+  if ((count = requestParseRanges(range, sbuf->st_size, start, end)) < 0)
+    return 0;
 
-  //  Writes out to the client socket the memory-mapped file 
-  Rio_writen(fd, srcp, filesize);
-  Munmap(srcp, filesize);
+  if (count == 0) {
+    requestBaseHeader(buf, "416 Range Not Satisfiable", sbuf, NULL, keep_alive);
+    sprintf(buf, "%sContent-Range: bytes */%lld\r\n", buf, (long long) sbuf->st_size);
+    sprintf(buf, "%sContent-Length: 0\r\n\r\n", buf);
+    Rio_writen(fd, buf, strlen(buf));
+    log_printf(LOG_ERRORS, "416 Range Not Satisfiable: %s\n", filename);
+    tracker->bytes_sent += strlen(buf);
+    tracker->unsatisfiable++;
+    tracker->errors++;
+    return 1;
+  }
+
+  requestGetFiletype(filename, filetype);
+  requestBaseHeader(buf, "206 Partial Content", sbuf, NULL, keep_alive);
+
+  if (count == 1) {
+    sprintf(buf, "%sContent-Range: bytes %lld-%lld/%lld\r\n", buf, (long long) start[0],
+            (long long) end[0], (long long) sbuf->st_size);
+    sprintf(buf, "%sContent-Length: %lld\r\n", buf, (long long) (end[0] - start[0] + 1));
+    sprintf(buf, "%sContent-Type: %s\r\n\r\n", buf, filetype);
+    requestSendFile(fd, buf, srcfd, start[0], end[0] - start[0] + 1, tracker);
+    tracker->partial++;
+    return 1;
+  }
 
+  // each part is the boundary, its own Content-Type and Content-Range, then
+  // its bytes; the length of the whole body goes in the header first
+  requestEtag(boundary, sbuf, NULL);
+  boundary[strlen(boundary) - 1] = '\0';  // the tag without its quotes
+  length = strlen(boundary + 1) + 8;  // "\r\n--" boundary "--\r\n"
+  for (index = 0; index < count; index++)
+    length += snprintf(NULL, 0, MULTIPART_HEADER, boundary + 1, filetype, (long long) start[index],
+                       (long long) end[index], (long long) sbuf->st_size) +
+              end[index] - start[index] + 1;
+  sprintf(buf, "%sContent-Length: %lld\r\n", buf, length);
+  sprintf(buf, "%sContent-Type: multipart/byteranges; boundary=%s\r\n\r\n", buf, boundary + 1);
+
+  for (index = 0; index < count; index++) {
+    sprintf(part, MULTIPART_HEADER, boundary + 1, filetype, (long long) start[index],
+            (long long) end[index], (long long) sbuf->st_size);
+    if (index == 0)
+      strcat(buf, part);  // the first part follows the response header
+    else
+      strcpy(buf, part);
+    requestSendFile(fd, buf, srcfd, start[index], end[index] - start[index] + 1, tracker);
+  }
+  sprintf(buf, "\r\n--%s--\r\n", boundary + 1);
+  Rio_writen(fd, buf, strlen(buf));
+  tracker->bytes_sent += strlen(buf);
+  tracker->multipart++;
+  return 1;
 }
 
-// handle a request
-void requestHandle(int fd, shm_entry *tracker)
+//
+// Sends a static file, or the ranges of it asked for if range is not NULL
+// encoding: if not NULL, the file's precompressed sibling filename.gz is
+//           sent with this Content-Encoding, and sbuf is the sibling's
+//
+void requestServeStatic(int fd, char *filename, struct stat *sbuf, char *range, char *encoding,
+                        int keep_alive, shm_entry *tracker) 
 {
+  int srcfd;
+  char buf[2][MAXBUF], path[MAXLINE + 3];
+  cache_entry *entry;
+
+  sprintf(path, encoding ? "%s.gz" : "%s", filename);
+  srcfd = Open(path, O_RDONLY, 0);
+
+  requestStaticHeader(buf[0], filename, sbuf, sbuf->st_size, encoding, 0);
+  requestStaticHeader(buf[1], filename, sbuf, sbuf->st_size, encoding, 1);
+
+  // keep the file open for the next request if it fits in the cache; the
+  // cache is keyed by path, so siblings stay out of it, or a request for
+  // the .gz file itself would get these headers
+  if (cache_enabled() && encoding == NULL) {
+    char *header[2] = {buf[0], buf[1]};
+    if ((entry = cache_put(filename, srcfd, sbuf, header, tracker)) != NULL) {
+      if (range == NULL ||
+          !requestServeRanges(fd, range, filename, sbuf, entry->fd, keep_alive, tracker))
+        requestSendFile(fd, entry->header[keep_alive], entry->fd, 0, entry->size, tracker);
+      cache_release(entry);
+      return;
+    }
+  }
 
-  int is_static;
+  if (range == NULL || !requestServeRanges(fd, range, filename, sbuf, srcfd, keep_alive, tracker))
+    requestSendFile(fd, buf[keep_alive], srcfd, 0, sbuf->st_size, tracker);
+  Close(srcfd);
+
+}
+
+//
+// Sends the gzip version of a static file if the client accepts gzip and
+// there is one: a .gz sibling no older than the file, or with -z the file
+// compressed in memory. Range requests always get the file as it is.
+// cached is the file's cache entry, if it was a hit, which remembers that
+// there is no sibling so later hits do not look for one
+// Returns 1 if a response was sent, 0 if the file is to be sent as it is
+//
+int requestServeEncoded(int fd, char *base, http_request *req, char *filename,
+                        struct stat *sbuf, cache_entry *cached, int keep_alive,
+                        shm_entry *tracker)
+{
+  char buf[MAXBUF], path[MAXLINE + 3], filetype[MAXLINE];
+  struct stat gzbuf;
+  gz_entry *entry;
+  int sibling;
+
+  if (req->accept_encoding.len == 0 || req->range.len > 0 ||
+      !requestGetFiletype(filename, filetype) ||
+      !requestAcceptsGzip(http_str(base, req->accept_encoding)))
+    return 0;
+
+  sibling = cached == NULL || __atomic_load_n(&cached->gz_sibling, __ATOMIC_RELAXED);
+  if (sibling) {
+    sprintf(path, "%s.gz", filename);
+    sibling = stat(path, &gzbuf) == 0 && S_ISREG(gzbuf.st_mode) && (S_IRUSR & gzbuf.st_mode) &&
+      gzbuf.st_mtime >= sbuf->st_mtime;
+    if (cached != NULL && !sibling)
+      __atomic_store_n(&cached->gz_sibling, 0, __ATOMIC_RELAXED);
+  }
+  if (sibling) {
+    if (requestNotModified(base, req, &gzbuf, "gzip"))
+      requestServeNotModified(fd, filename, &gzbuf, "gzip", keep_alive, tracker);
+    else
+      requestServeStatic(fd, filename, &gzbuf, NULL, "gzip", keep_alive, tracker);
+    return 1;
+  }
+
+  if (!gz_cache_enabled())
+    return 0;
+  if (requestNotModified(base, req, sbuf, "gzip")) {
+    requestServeNotModified(fd, filename, sbuf, "gzip", keep_alive, tracker);
+    return 1;
+  }
+  if ((entry = gz_cache_get(filename, sbuf)) == NULL)
+    return 0;  // too large or does not compress
+  requestStaticHeader(buf, filename, sbuf, entry->len, "gzip", keep_alive);
+  Rio_sendmore(fd, buf, strlen(buf));
+  Rio_writen(fd, entry->data, entry->len);
+  tracker->bytes_sent += strlen(buf) + entry->len;
+  gz_cache_release(entry);
+  return 1;
+}
+
+// handle a request read from rio
+// parsed: if not NULL, how far the request at the front of rio has been
+//         parsed already; it is reset for the next request on return
+// keep_alive_ok: 1 if the caller can keep the connection open afterwards
+// child: if not NULL, a CGI process is not waited for; its pid is stored
+//        here instead (0 if none was started) for the caller to reap
+// Returns 1 if the connection may be reused for another request, else 0
+int requestHandle(int fd, rio_t *rio, http_request *parsed, int keep_alive_ok, pid_t *child,
+                  shm_entry *tracker)
+{
+
+  int is_static, connection, keep_alive, eof, rc;
   struct stat sbuf;
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+  char *base, *method, *uri, *version, *range;
   char filename[MAXLINE], cgiargs[MAXLINE];
-  rio_t rio;
+  http_request req;
+
+  if (child != NULL)
+    *child = 0;
+  if (parsed != NULL)
+    req = *parsed;  // pick up where the event loop stopped
+  else
+    http_init(&req);
+  rc = requestReadhdrs(rio, &req, &eof);
+  if (parsed != NULL)
+    http_init(parsed);  // the next request starts after this one
+  if (rc == 0)
+    return 0;
+  if (rc == -2) {  // too slow, close without an answer
+    tracker->header_timeouts++;
+    return 0;
+  }
 
-  Rio_readinitb(&rio, fd);
-  Rio_readlineb(&rio, buf, MAXLINE);
-  sscanf(buf, "%s %s %s", method, uri, version);
+  // the strings below point into the buffer, which is not read again
+  // before this request has been answered
+  base = rio->rio_bufptr;
+  if (rc == -3) {
+    rio->rio_cnt = 0;
+    requestError(fd, "", "431", "Request Header Fields Too Large",
+                 "CS537 Server could not handle a header this large", tracker);
+    return 0;
+  }
+  if (rc < 0) {
+    rio->rio_cnt = 0;  // nothing after a bad request can be trusted
+    requestError(fd, "", "400", "Bad Request", "CS537 Server could not parse this request",
+                 tracker);
+    return 0;
+  }
+  rio->rio_bufptr += req.pos;
+  rio->rio_cnt -= req.pos;
+  method = http_str(base, req.method);
+  uri = http_str(base, req.uri);
+  version = http_str(base, req.version);
 
-  printf("%s %s %s\n", method, uri, version);
+  log_printf(LOG_ACCESS, "%s %s %s\n", method, uri, version);
 
   if (strcasecmp(method, "GET")) {
-    requestError(fd, method, "501", "Not Implemented", "CS537 Server does not implement this method");
-    return;
+    requestError(fd, method, "501", "Not Implemented", "CS537 Server does not implement this method",
+                 tracker);
+    return 0;
+  }
+  if (req.uri.len >= MAXLINE - strlen(".home.html")) {
+    requestError(fd, "", "414", "URI Too Long", "CS537 Server could not handle this URI",
+                 tracker);
+    return 0;
   }
-  requestReadhdrs(&rio);
+
+  if (http_has_token(base, req.connection, "keep-alive"))
+    connection = 1;
+  else if (http_has_token(base, req.connection, "close"))
+    connection = 0;
+  else
+    connection = -1;
+
+  // HTTP/1.1 connections persist unless the client asks to close,
+  // HTTP/1.0 connections only if the client asks to keep them
+  if (connection == -1)
+    keep_alive = !strcasecmp(version, "HTTP/1.1");
+  else
+    keep_alive = connection;
+  keep_alive = keep_alive && keep_alive_ok && !eof;
 
   is_static = requestParseURI(uri, filename, cgiargs);
+
+  range = req.range.len > 0 ? http_str(base, req.range) : NULL;
+
+  // a cached file was a readable regular file when it was opened
+  if (is_static && cache_enabled()) {
+    cache_entry *entry = cache_get(filename, tracker);
+    if (entry != NULL) {
+      memset(&sbuf, 0, sizeof(sbuf));  // what the validators are made from
+      sbuf.st_ino = entry->ino;
+      sbuf.st_size = entry->size;
+      sbuf.st_mtim = entry->mtime;
+      if (!requestServeEncoded(fd, base, &req, filename, &sbuf, entry, keep_alive, tracker)) {
+        if (requestNotModified(base, &req, &sbuf, NULL))
+          requestServeNotModified(fd, filename, &sbuf, NULL, keep_alive, tracker);
+        else if (range == NULL ||
+                 !requestServeRanges(fd, range, filename, &sbuf, entry->fd, keep_alive, tracker))
+          requestSendFile(fd, entry->header[keep_alive], entry->fd, 0, entry->size, tracker);
+      }
+      cache_release(entry);
+      tracker->static_reqs++;  // increment number of static requests handled
+      return keep_alive;
+    }
+  }
+
   if (stat(filename, &sbuf) < 0) {
-    requestError(fd, filename, "404", "Not found", "CS537 Server could not find this file");
-    return;
+    requestError(fd, filename, "404", "Not found", "CS537 Server could not find this file",
+                 tracker);
+    return 0;
   }
 
   if (is_static) {
     if (!(S_ISREG(sbuf.st_mode)) || !(S_IRUSR & sbuf.st_mode)) {
-      requestError(fd, filename, "403", "Forbidden", "CS537 Server could not read this file");
-      return;
+      requestError(fd, filename, "403", "Forbidden", "CS537 Server could not read this file",
+                   tracker);
+      return 0;
+    }
+    if (!requestServeEncoded(fd, base, &req, filename, &sbuf, NULL, keep_alive, tracker)) {
+      if (requestNotModified(base, &req, &sbuf, NULL))
+        requestServeNotModified(fd, filename, &sbuf, NULL, keep_alive, tracker);
+      else
+        requestServeStatic(fd, filename, &sbuf, range, NULL, keep_alive, tracker);
     }
-    requestServeStatic(fd, filename, sbuf.st_size);
     tracker->static_reqs++;  // increment number of static requests handled
+    return keep_alive;
   } else {
     if (!(S_ISREG(sbuf.st_mode)) || !(S_IXUSR & sbuf.st_mode)) {
-      requestError(fd, filename, "403", "Forbidden", "CS537 Server could not run this CGI program");
-      return;
+      requestError(fd, filename, "403", "Forbidden", "CS537 Server could not run this CGI program",
+                   tracker);
+      return 0;
     }
-    requestServeDynamic(fd, filename, cgiargs);
+    // the CGI program writes the rest of the header and the body, so the
+    // server cannot tell where the response ends; close the connection
+    requestServeDynamic(fd, filename, cgiargs, child, tracker);
     tracker->dynamic_reqs++;  // increment number of dynamic reuqests handled
+    return 0;
   }
 }
 
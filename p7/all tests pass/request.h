@@ -1,5 +1,10 @@
 #ifndef __REQUEST_H__
 
-void requestHandle(int fd, shm_entry *tracker);
+#include "parser.h"
+
+int requestClassify(char *buf, int len, off_t *size);
+int requestHandle(int fd, rio_t *rio, http_request *parsed, int keep_alive_ok, pid_t *child,
+                  shm_entry *tracker);
+void requestSetHeaderTimeout(int ms);
 
 #endif
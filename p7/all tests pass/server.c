@@ -1,26 +1,179 @@
 #include "helper.h"
 #include "request.h"
+#include "queue.h"
+#include "event.h"
+#include "cache.h"
+#include "gzcache.h"
+#include "cgipool.h"
+#include "logger.h"
+#include "uring.h"
+#include <sched.h>
+#include <limits.h>
+#include <stddef.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <linux/filter.h>
 
-// 
+//
 // server.c: A very, very simple web server
 //
 // To run:
-//  server <portnum (above 2000)>
+//  server <port> <threads> <buffers> <shm_name> [-q ring|lockfree] [-e idle_ms]
+//         [-u idle_ms] [-a acceptors] [-c cache_kb] [-z gzip_kb] [-g cgi_procs]
+//         [-s fifo|sff|static] [-w min:max[:idle_ms]] [-p rr|depth] [-d slo_ms]
+//         [-t header_ms:write_ms] [-l log_level] [-o log_file]
+//
+//  -q: connection buffer implementation. "ring" (default) is a FIFO guarded
+//      by one mutex and two condition variables, "lockfree" is a lock-free
+//      MPMC ring whose threads park on a futex only when it is empty/full.
+//  -e: serve from an epoll event loop with HTTP keep-alive. Connections are
+//      only queued for a worker once a full request has arrived, and are
+//      closed after idle_ms without one. CGI processes are reaped by the
+//      event thread, so a slow CGI program does not hold up a worker.
+//  -u: like -e, but the event loop runs on io_uring (see event.c) and
+//      workers send static files as one linked send/splice chain (see
+//      uring.c). Falls back to epoll and sendfile where io_uring is missing.
+//  -a: number of acceptor shards (default 1). Each shard has its own
+//      SO_REUSEPORT listening socket, acceptor thread, connection buffer of
+//      <buffers> slots and share of the worker threads, all pinned to one
+//      CPU, so a connection never leaves the shard that accepted it.
+//  -c: keep up to cache_kb KB of static files open in a cache, with their
+//      response headers, so repeat requests skip stat/open/close.
+//  -z: compress static text files for clients that accept gzip and keep up
+//      to gzip_kb KB of the results in memory (see gzcache.c). Without -z
+//      only precompressed .gz siblings of files are sent to such clients.
+//  -g: serve CGI programs from up to cgi_procs persistent processes each
+//      instead of a fork and exec per request (see output.c).
+//  -s: order in which workers take buffered connections. "fifo" (default)
+//      serves them in arrival order, "sff" serves the smallest static file
+//      first and dynamic requests last, "static" serves static requests
+//      before dynamic ones. With -e or -u the request line is read when the
+//      connection is queued; otherwise the worker that takes it peeks at it
+//      and puts it back if it should wait. sff and static need -q ring.
+//  -w: let the pool grow from <threads> up to max workers while requests
+//      back up, and retire workers down to min once some have been idle for
+//      idle_ms (default 5000). A controller thread checks every shard each
+//      POOL_TICK_MS and logs every change with its reason at -l 1 and up. Workers reuse
+//      the shared memory entries of retired ones, so stat_process must be
+//      given max as its thread count; entries no worker holds show tid 0.
+//      Needs -q ring.
+//  -p: give every worker its own queue and pin it to its own CPU. The
+//      shard's acceptor deals connections to the queues in turn ("rr") or
+//      to the shortest one ("depth"); a worker that runs out takes the
+//      newest connection from the longest queue of its shard. The shard
+//      still buffers at most <buffers> connections in all. Workers count
+//      the connections they took from their own queue and stole in shared
+//      memory. Needs -q ring and -s fifo, and cannot be used with -w.
+//  -d: admission control. Instead of waiting for a free buffer slot before
+//      accepting, accept every connection and answer a new one at once with
+//      a canned 503 and Retry-After if the buffer is full, or if requests
+//      are waiting and have recently waited more than slo_ms on average.
+//      Connections already buffered, and keep-alive connections that have
+//      been served before, are never turned away.
+//  -t: deadlines for slow clients. With -e or -u, a request whose first
+//      bytes have arrived must be complete within header_ms, or the event
+//      thread closes the connection (see event.c); no worker waits for it.
+//      Without them the worker reads the request and gives up once
+//      header_ms has passed, checked whenever bytes arrive and enforced by
+//      the socket's receive timeout when none do. Either way a response
+//      whose client stops reading for write_ms is abandoned and the
+//      connection closed; with -u such responses are sent with sendfile
+//      rather than io_uring, which would ignore the timeout. 0 leaves a
+//      deadline off. Timeouts are counted in shared memory.
+//  -l: how much to log: 0 nothing, 1 error responses, 2 also one line per
+//      request (default), 3 also the headers and bodies of error responses.
+//      Records are written by a logger thread (see logger.c) and dropped,
+//      not waited for, if it falls behind.
+//  -o: append the log to log_file instead of writing it to stdout.
 //
 // Repeatedly handles HTTP requests sent to this port number.
 // Most of the work is done within routines written in request.c
 //
 
-pthread_mutex_t lock;  // lock used to in consumer/producer
-pthread_cond_t cons;  // condition variable for consumers (workers)
-pthread_cond_t prod;  // condition variable for producer
-int num_full;  // tracks number of full buffer entries
-int num_empty;  // tracks number of empty buffer entries
+#define POOL_TICK_MS 100  // how often the pool controller looks at the shards
+#define POOL_IDLE_MS 5000  // default idle time before spare workers are retired
+#define POOL_GROW_DEPTH 4  // connections waiting with no idle worker that add workers
+#define POOL_GROW_WAIT_US 2000  // average buffer wait over a tick that adds workers
+
+#define SHED_RETRY_AFTER 1  // seconds a client turned away with -d is asked to wait
+#define WAIT_AVG_SHIFT 3  // the wait average moves 1/8 of the way to each new wait
+
+// how the acceptor deals connections to per-worker queues, set with -p
+#define LOCAL_OFF 0  // no per-worker queues, workers share the shard's buffer
+#define LOCAL_RR 1  // each queue in turn
+#define LOCAL_DEPTH 2  // the queue with the fewest connections
+
+// a worker's own connection queue with -p
+typedef struct {
+    pthread_mutex_t lock;  // protects queue and kicked
+    pthread_cond_t cond;  // the worker sleeps here when there is nothing to take
+    ring_queue queue;  // connections dealt to the worker, oldest first
+    int cpu;  // CPU the worker is pinned to
+    int busy;  // set while the worker is serving a connection
+    int sleeping;  // set once the worker found its queue empty, until it has work
+    int kicked;  // set to make a sleeping worker look for connections to steal
+} local_t;
+
+// one acceptor with its own listening socket, buffer and workers
+typedef struct {
+    int id;  // shard number
+    int listenfd;  // fd to listen on
+    int cpu;  // CPU the shard's threads are pinned to, -1 for none
+    pthread_mutex_t lock;  // lock used to in consumer/producer
+    pthread_cond_t cons;  // condition variable for consumers (workers)
+    pthread_cond_t prod;  // condition variable for producer
+    ring_queue conn_queue;  // FIFO of accepted connections waiting for a worker
+    heap_queue prio_queue;  // used instead of conn_queue with -s sff|static
+    mpmc_queue lockfree_queue;  // used instead of conn_queue with -q lockfree
+    shm_shard *stats;  // shard counters in shared memory
+    int busy;  // workers serving a connection
+    int retire;  // idle workers the pool controller asked to exit, under lock
+    long long wait_us;  // total buffer wait of the connections taken
+    int waits;  // connections taken
+    long long wait_seen;  // wait_us and waits at the controller's last tick
+    int waits_seen;
+    long long window_start;  // start of the controller's current idle window (us)
+    int spare_min;  // fewest idle workers seen during the window
+    local_t *locals;  // per-worker queues with -p, else NULL
+    int nlocals;  // number of locals
+    int next_local;  // next queue to deal to with -p rr
+    int pending;  // connections buffered or being served, at most <buffers>;
+                  // the acceptor waits for a free slot on prod under lock
+} shard_t;
+
+// what a worker thread needs to know about itself
+typedef struct {
+    int index;  // index in shared mem
+    shard_t *shard;  // shard the worker takes connections from
+    local_t *local;  // the worker's own queue with -p, else NULL
+} worker_arg;
+
 int buffers;  // number of buffers
-int listenfd;  // fd to listen on
 char *shm_name;  // name of shared memory region
-int *shared_buf;  // pointer to shared buffer
-shm_entry *shared_mem;  // pointer to shared mem
+int queue_kind;  // QUEUE_RING or QUEUE_LOCKFREE, set with -q
+int idle_ms;  // keep-alive idle timeout with -e or -u, 0 for blocking accept
+int engine;  // EVENT_EPOLL (-e) or EVENT_URING (-u)
+int acceptors;  // number of shards, set with -a
+int policy;  // POLICY_FIFO, POLICY_SFF or POLICY_STATIC, set with -s
+int local_queues;  // LOCAL_OFF, LOCAL_RR or LOCAL_DEPTH, set with -p
+long long slo_us;  // buffer wait over which new connections are shed, 0 without -d
+int header_ms;  // request header deadline with -t, 0 for none
+int write_ms;  // send timeout with -t, 0 for none
+char shed_response[256];  // the 503 sent to shed connections
+int shed_len;  // length of shed_response
+long long *queued_at;  // when each connection fd was last queued (us), by fd
+int max_fds;  // size of queued_at
+shard_t *shards;  // array of acceptors shards
+int min_threads;  // pool bounds, both <threads> unless set with -w
+int max_threads;
+int pool_idle_ms;  // how long spare workers must stay idle before being retired
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;  // protects slot_used and pool_size
+char *slot_used;  // which shared mem entries belong to a live worker
+int pool_size;  // live workers
+int pool_retiring;  // retirements asked for and not yet carried out, under pool_lock
+shm_header *shm_base;  // start of the shared memory region
+shm_entry *shared_mem;  // worker entries, after the header
+size_t shm_size;  // size of the shared memory region
 
 /**
  * Signal handler for SIGINT signal.
@@ -28,12 +181,27 @@ shm_entry *shared_mem;  // pointer to shared mem
  * sig: signal number
  */
 void sigint_handler(int sig) {
-    munmap( shared_mem, getpagesize());  // unmap mem
+    munmap( shm_base, shm_size);  // unmap mem
     shm_unlink(shm_name);  // unlink the shared file
-    Close(listenfd);  // close listenfd to free the port
+    for (int index = 0; index < acceptors; index++) {
+        Close(shards[index].listenfd);  // close listenfds to free the port
+    }
     exit(0);  // exit
 }
 
+/**
+ * Function that prints the usage message and exits.
+ *
+ * name: name the server was run as
+ */
+void usage(char *name) {
+    fprintf(stderr, "Usage: %s <port> <threads> <buffers> <shm_name> [-q ring|lockfree]"
+        " [-e idle_ms] [-u idle_ms] [-a acceptors] [-c cache_kb] [-z gzip_kb] [-g cgi_procs]"
+        " [-s fifo|sff|static] [-w min:max[:idle_ms]] [-p rr|depth] [-d slo_ms]"
+        " [-t header_ms:write_ms] [-l log_level] [-o log_file]\n", name);
+    exit(1);
+}
+
 /**
  * Function that gets arguments from the command line.
  *
@@ -45,9 +213,9 @@ void sigint_handler(int sig) {
  * argv: array of command line arguments
  */
 void getargs(int *port, int *threads, int *buffers, char **shm_name, int argc, char *argv[]) {
-    if (argc != 5) {  // check # args
-        fprintf(stderr, "Usage: %s <port> <threads> <buffers> <shm_name>\n", argv[0]);
-        exit(1);
+    // even number of args: 5 positional plus flag/value pairs
+    if (argc < 5 || argc % 2 == 0) {
+        usage(argv[0]);
     }
 
     // transfer args from argv
@@ -55,179 +223,1154 @@ void getargs(int *port, int *threads, int *buffers, char **shm_name, int argc, c
     *threads = atoi(argv[2]);
     *buffers = atoi(argv[3]);
     *shm_name = argv[4];
+
+    // optional flags, each followed by a value
+    int log_level = LOG_ACCESS;
+    char *log_file = NULL;
+    queue_kind = QUEUE_RING;
+    idle_ms = 0;
+    engine = EVENT_EPOLL;
+    acceptors = 1;
+    policy = POLICY_FIFO;
+    local_queues = LOCAL_OFF;
+    slo_us = 0;
+    header_ms = write_ms = 0;
+    min_threads = max_threads = *threads;
+    pool_idle_ms = POOL_IDLE_MS;
+    for (int index = 5; index < argc; index += 2) {
+        char *flag = argv[index];
+        char *value = argv[index + 1];
+
+        if (strcmp(flag, "-q") == 0) {  // connection buffer implementation
+            if (strcmp(value, "ring") == 0) {
+                queue_kind = QUEUE_RING;
+            } else if (strcmp(value, "lockfree") == 0) {
+                queue_kind = QUEUE_LOCKFREE;
+            } else {
+                usage(argv[0]);
+            }
+        } else if (strcmp(flag, "-e") == 0 || strcmp(flag, "-u") == 0) {  // event loop
+            if (idle_ms > 0 || (idle_ms = atoi(value)) <= 0) {  // one of -e and -u
+                usage(argv[0]);
+            }
+            if (flag[1] == 'u') {
+                engine = EVENT_URING;
+            }
+        } else if (strcmp(flag, "-a") == 0) {  // number of acceptor shards
+            acceptors = atoi(value);
+            if (acceptors <= 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(flag, "-c") == 0) {  // static file cache
+            if (atoi(value) <= 0 || cache_init(atol(value) * 1024) != 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(flag, "-z") == 0) {  // compressed file cache
+            if (atoi(value) <= 0 || gz_cache_init(atol(value) * 1024) != 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(flag, "-g") == 0) {  // persistent CGI processes
+            if (atoi(value) <= 0 || cgi_pool_init(atoi(value)) != 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(flag, "-s") == 0) {  // scheduling policy
+            if (strcmp(value, "fifo") == 0) {
+                policy = POLICY_FIFO;
+            } else if (strcmp(value, "sff") == 0) {
+                policy = POLICY_SFF;
+            } else if (strcmp(value, "static") == 0) {
+                policy = POLICY_STATIC;
+            } else {
+                usage(argv[0]);
+            }
+        } else if (strcmp(flag, "-w") == 0) {  // elastic pool bounds
+            int fields = sscanf(value, "%d:%d:%d", &min_threads, &max_threads, &pool_idle_ms);
+            if (fields < 2 || min_threads <= 0 || min_threads > *threads ||
+                    max_threads < *threads || pool_idle_ms <= 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(flag, "-p") == 0) {  // per-worker queues
+            if (strcmp(value, "rr") == 0) {
+                local_queues = LOCAL_RR;
+            } else if (strcmp(value, "depth") == 0) {
+                local_queues = LOCAL_DEPTH;
+            } else {
+                usage(argv[0]);
+            }
+        } else if (strcmp(flag, "-d") == 0) {  // admission control
+            if (atoi(value) <= 0) {
+                usage(argv[0]);
+            }
+            slo_us = atoll(value) * 1000;
+        } else if (strcmp(flag, "-t") == 0) {  // slow client deadlines
+            if (sscanf(value, "%d:%d", &header_ms, &write_ms) != 2 || header_ms < 0 ||
+                    write_ms < 0) {
+                usage(argv[0]);
+            }
+            requestSetHeaderTimeout(header_ms);
+        } else if (strcmp(flag, "-l") == 0) {  // log verbosity
+            log_level = atoi(value);
+            if (log_level < LOG_OFF || log_level > LOG_HEADERS) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(flag, "-o") == 0) {  // log file
+            log_file = value;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    // io_uring sends ignore SO_SNDTIMEO, so a write deadline needs sendfile
+    if (engine == EVENT_URING && write_ms == 0) {
+        uring_sendfile_enable();
+    }
+
+    if (logger_init(log_level, log_file) != 0) {
+        fprintf(stderr, "Unable to start logging to %s.\n", log_file ? log_file : "stdout");
+        exit(1);
+    }
+
+    // the lock-free ring can only be FIFO
+    if (queue_kind == QUEUE_LOCKFREE && policy != POLICY_FIFO) {
+        usage(argv[0]);
+    }
+
+    // workers parked on the lock-free ring's futex cannot be asked to retire
+    if (queue_kind == QUEUE_LOCKFREE && max_threads > min_threads) {
+        usage(argv[0]);
+    }
+
+    // per-worker queues are FIFO rings, one per worker for good
+    if (local_queues != LOCAL_OFF && (queue_kind != QUEUE_RING || policy != POLICY_FIFO ||
+            max_threads > min_threads)) {
+        usage(argv[0]);
+    }
+}
+
+/**
+ * Function that returns a monotonic timestamp in microseconds.
+ */
+long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Function that turns the start of a request into a scheduling key.
+ *
+ * buf: bytes of the request received so far
+ * len: number of bytes in buf, 0 or less if none
+ * Return: scheduling key, lowest is served first
+ */
+long long request_key(char *buf, int len) {
+    off_t size;
+
+    // unknown requests go after known static ones but before dynamic ones
+    int kind = len > 0 ? requestClassify(buf, len, &size) : -1;
+    if (policy == POLICY_SFF) {
+        return kind == 1 ? size : (kind == 0 ? LLONG_MAX : LLONG_MAX - 1);
+    }
+    return kind == 1 ? 0 : (kind == 0 ? 3 : 2);
+}
+
+/**
+ * Function that works out a connection's place in a priority buffer when it
+ * is added. With -e or -u the request is already buffered. Otherwise the
+ * acceptor does not wait for it: the connection is queued unclassified,
+ * ahead of unknown and dynamic requests, and the worker that takes it
+ * classifies it with peek_key().
+ *
+ * connfd: the connection fd
+ * Return: scheduling key, lowest is served first
+ */
+long long policy_key(int connfd) {
+    if (idle_ms == 0) {
+        return policy == POLICY_SFF ? LLONG_MAX - 2 : 1;
+    }
+
+    rio_t *rio = &event_conn(connfd)->rio;
+    return request_key(rio->rio_bufptr, rio->rio_cnt);
+}
+
+/**
+ * Function that classifies a connection queued unclassified by peeking at
+ * its request line, waiting at most 1ms for it.
+ *
+ * connfd: the connection fd
+ * Return: scheduling key, lowest is served first
+ */
+long long peek_key(int connfd) {
+    char peek[MAXLINE];
+    struct pollfd pfd = { connfd, POLLIN, 0 };
+
+    poll(&pfd, 1, 1);
+    return request_key(peek, recv(connfd, peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT));
+}
+
+/**
+ * Function that finds the histogram bucket of a duration.
+ *
+ * elapsed: duration in microseconds
+ * Return: floor(log2(elapsed)), clamped to the histogram
+ */
+int latency_bucket(long long elapsed) {
+    int bucket = 0;
+
+    while (elapsed >= 2 && bucket < LATENCY_BUCKETS - 1) {
+        elapsed >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/**
+ * Function that records the timings of one request in a worker's entry.
+ *
+ * tracker: worker's private copy of its shared memory entry
+ * queued: when the request was queued (us)
+ * taken: when the worker started on it (us)
+ */
+void record_request(shm_entry *tracker, long long queued, long long taken) {
+    long long done = now_us();
+
+    tracker->total_reqs++;  // increment total reqs
+    tracker->wait_hist[latency_bucket(taken - queued)]++;
+    tracker->service_hist[latency_bucket(done - taken)]++;
+    tracker->latency_hist[latency_bucket(done - queued)]++;
+    tracker->log_drops = log_dropped();
+}
+
+/**
+ * Function that folds the buffer wait of a request just taken into its
+ * shard's moving average.
+ *
+ * shard: shard the request was taken from
+ * wait: how long it waited (us)
+ */
+void record_wait(shard_t *shard, long long wait) {
+    int avg = __atomic_load_n(&shard->stats->wait_avg, __ATOMIC_RELAXED);
+
+    if (wait > INT_MAX) {
+        wait = INT_MAX;
+    }
+    // racing workers may lose each other's updates, which an average can afford
+    avg += (wait - avg) / (1 << WAIT_AVG_SHIFT);
+    __atomic_store_n(&shard->stats->wait_avg, avg, __ATOMIC_RELAXED);
+}
+
+/**
+ * Function that copies a worker's private stats into shared memory under
+ * the entry's seqlock, so stat_process never sees a half-updated entry.
+ *
+ * dst: worker's entry in shared memory
+ * src: worker's private copy
+ */
+void publish_stats(shm_entry *dst, shm_entry *src) {
+    size_t start = offsetof(shm_entry, thread_ID);  // everything after seq
+    unsigned seq = dst->seq;
+
+    __atomic_store_n(&dst->seq, seq + 1, __ATOMIC_RELAXED);  // odd: writing
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((char*) dst + start, (char*) src + start, sizeof(shm_entry) - start);
+    __atomic_store_n(&dst->seq, seq + 2, __ATOMIC_RELEASE);  // even: done
+}
+
+/**
+ * Function that takes the newest connection from the longest queue of a
+ * shard other than the thief's own.
+ *
+ * shard: shard to steal within
+ * thief: the stealing worker's queue
+ * Return: the connection fd, or -1 if the other queues are all empty
+ */
+int local_steal(shard_t *shard, local_t *thief) {
+    for (int tries = 0; tries < shard->nlocals; tries++) {
+        local_t *victim = NULL;
+        int longest = 0;
+
+        // lengths are read unlocked; a stale one only costs a retry
+        for (int id = 0; id < shard->nlocals; id++) {
+            int count = __atomic_load_n(&shard->locals[id].queue.count, __ATOMIC_SEQ_CST);
+            if (&shard->locals[id] != thief && count > longest) {
+                victim = &shard->locals[id];
+                longest = count;
+            }
+        }
+        if (victim == NULL) {
+            return -1;
+        }
+
+        int req = -1;
+        pthread_mutex_lock(&victim->lock);
+        if (!ring_empty(&victim->queue)) {
+            req = ring_steal(&victim->queue);
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (req >= 0) {
+            return req;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Function that takes the next connection for a worker with its own queue:
+ * the oldest one in its queue, else one stolen from a neighbour, else it
+ * sleeps until the acceptor deals it one or kicks it to steal again.
+ *
+ * shard: shard the worker belongs to
+ * local: the worker's queue
+ * tracker: worker's private copy of its shared memory entry
+ * Return: the connection fd
+ */
+int local_take(shard_t *shard, local_t *local, shm_entry *tracker) {
+    int req;
+
+    while (1) {
+        pthread_mutex_lock(&local->lock);
+        if (!ring_empty(&local->queue)) {
+            req = ring_dequeue(&local->queue);
+            pthread_mutex_unlock(&local->lock);
+            tracker->local_reqs++;
+            break;
+        }
+        // announce before looking elsewhere, so a connection dealt to a
+        // busy neighbour after the search below still gets this worker kicked
+        __atomic_store_n(&local->sleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&local->lock);
+
+        if ((req = local_steal(shard, local)) >= 0) {
+            __atomic_store_n(&local->sleeping, 0, __ATOMIC_RELAXED);
+            tracker->stolen_reqs++;
+            break;
+        }
+
+        pthread_mutex_lock(&local->lock);
+        while (ring_empty(&local->queue) && !local->kicked) {
+            pthread_cond_wait(&local->cond, &local->lock);
+        }
+        local->kicked = 0;
+        __atomic_store_n(&local->sleeping, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&local->lock);
+    }
+
+    __atomic_fetch_add(&shard->stats->dequeued, 1, __ATOMIC_RELAXED);
+    return req;
 }
 
 /**
- * Function that finds and returns the value of the first full element in the
- * buffer. Also marks that element in progress and records its index
+ * Function that deals a connection to one of a shard's worker queues. If
+ * that worker is busy, a sleeping neighbour is kicked to steal it.
  *
- * buffer: pointer for buffer array
- * index_ptr: pointer to index of found full element
- * Return: the value of the element
+ * shard: shard to add to
+ * connfd: the connection fd
  */
-int get_full(int *buffer, int *index_ptr) {
-    for (int index = 0; index < buffers; index++) {  // loop over buffer
-        if (buffer[index] != -2 && buffer[index] != -1) {  // if not free or in progress
-            *index_ptr = index;  // record index
-            int temp = buffer[index];  // get temp
-            buffer[index] = -1;  // mark in progress
-            num_full--;  // decrease number full
-            return temp;  // return temp
+void local_add(shard_t *shard, int connfd) {
+    int target = shard->next_local;
+
+    if (local_queues == LOCAL_DEPTH) {  // shortest queue, idle workers first
+        int best = INT_MAX;
+        for (int step = 0; step < shard->nlocals; step++) {
+            int id = (shard->next_local + step) % shard->nlocals;
+            local_t *local = &shard->locals[id];
+            int load = __atomic_load_n(&local->queue.count, __ATOMIC_RELAXED) * 2 +
+                __atomic_load_n(&local->busy, __ATOMIC_RELAXED);
+            if (load < best) {
+                best = load;
+                target = id;
+            }
         }
     }
+    shard->next_local = (target + 1) % shard->nlocals;
+
+    local_t *local = &shard->locals[target];
+    pthread_mutex_lock(&local->lock);
+    ring_enqueue(&local->queue, connfd);
+    pthread_cond_signal(&local->cond);
+    pthread_mutex_unlock(&local->lock);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);  // enqueue before reading the flags
+    if (!__atomic_load_n(&local->busy, __ATOMIC_RELAXED)) {
+        return;
+    }
+    for (int step = 1; step < shard->nlocals; step++) {
+        local_t *idle = &shard->locals[(target + step) % shard->nlocals];
+        if (__atomic_load_n(&idle->sleeping, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&idle->lock);
+            idle->kicked = 1;
+            pthread_cond_signal(&idle->cond);
+            pthread_mutex_unlock(&idle->lock);
+            return;
+        }
+    }
+}
+
+/**
+ * Function that takes the highest priority connection from a shard's heap.
+ * A connection the acceptor queued unclassified is classified here, outside
+ * the lock, and put back in its place if something queued should go first.
+ * Called with the shard lock held and the heap not empty.
+ *
+ * shard: shard to take from
+ * Return: the connection fd
+ */
+int take_prioritized(shard_t *shard) {
+    long long key;
+    int req = heap_dequeue(&shard->prio_queue, &key);
 
-    return -1; // logically should never be reached
+    while (idle_ms == 0 && key == policy_key(req)) {  // queued unclassified
+        heap_reserve(&shard->prio_queue);  // keep its slot to put it back in
+        pthread_mutex_unlock(&shard->lock);
+        key = peek_key(req);
+        pthread_mutex_lock(&shard->lock);
+        heap_unreserve(&shard->prio_queue);
+        if (heap_empty(&shard->prio_queue) || key <= heap_min_key(&shard->prio_queue)) {
+            break;
+        }
+        heap_enqueue(&shard->prio_queue, req, key);
+        req = heap_dequeue(&shard->prio_queue, &key);
+    }
+    return req;
 }
 
 /**
- * Function thatreturns the value of the first free element in the
- * buffer. Also marks that element in progress.
+ * Function that takes the next connection from a shard's buffer, sleeping
+ * until one is available. Its slot stays held until release_slot().
  *
- * buffer: pointer for buffer array
- * Return: index of free element
+ * shard: shard to take from
+ * Return: the connection fd, or -1 if the worker should retire
  */
-int get_empty(int *buffer) {
-    for (int index = 0; index < buffers; index++) {  // loop over buffer
-        if (buffer[index] == -2) {  // if free
-            buffer[index] = -1;  // mark in progress
-            num_empty--;  // decrease number empty
-            return index;  // return index
+int take_connection(shard_t *shard) {
+    int req;
+
+    if (queue_kind == QUEUE_LOCKFREE) {
+        req = mpmc_get(&shard->lockfree_queue);
+    } else {
+        pthread_mutex_lock(&shard->lock);  // get lock
+        // sleep if no available requests
+        while (policy == POLICY_FIFO ? ring_empty(&shard->conn_queue) :
+                heap_empty(&shard->prio_queue)) {
+            if (shard->retire > 0) {  // only idle workers retire
+                shard->retire--;
+                pthread_mutex_unlock(&shard->lock);
+                return -1;
+            }
+            pthread_cond_wait(&shard->cons, &shard->lock);
+        }
+
+        // take oldest (or highest priority) request
+        if (policy == POLICY_FIFO) {
+            req = ring_dequeue(&shard->conn_queue);
+        } else {
+            req = take_prioritized(shard);
         }
+        pthread_mutex_unlock(&shard->lock);  // unlock
+    }
+
+    __atomic_fetch_add(&shard->stats->dequeued, 1, __ATOMIC_RELAXED);
+    return req;
+}
+
+/**
+ * Function that frees the buffer slot of a connection a worker has finished
+ * serving. As before the queue rewrite, a connection holds its slot from
+ * the time it is buffered until its response has been sent, so at most
+ * <buffers> connections per shard are waiting or being served.
+ *
+ * shard: shard the connection was taken from
+ */
+void release_slot(shard_t *shard) {
+    if (queue_kind == QUEUE_LOCKFREE) {
+        __atomic_fetch_sub(&shard->pending, 1, __ATOMIC_SEQ_CST);
+        mpmc_release(&shard->lockfree_queue);
+        return;
+    }
+
+    // only a full shard can have the acceptor waiting
+    if (__atomic_fetch_sub(&shard->pending, 1, __ATOMIC_SEQ_CST) == buffers) {
+        pthread_mutex_lock(&shard->lock);
+        pthread_cond_signal(&shard->prod);  // wake producer
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/**
+ * Function that sleeps until a shard's buffer has a free slot. Only the
+ * shard's acceptor adds connections, so the slot is still free when
+ * add_connection() runs.
+ *
+ * shard: shard to wait on
+ */
+void wait_for_slot(shard_t *shard) {
+    if (queue_kind == QUEUE_LOCKFREE) {
+        mpmc_reserve(&shard->lockfree_queue);
+        return;
     }
 
-    return -1; // logically should never be reached
+    pthread_mutex_lock(&shard->lock);  // get lock
+    // sleep if no free buffer slots; the queues never hold more than
+    // pending, so they cannot be full while a slot is free
+    while (__atomic_load_n(&shard->pending, __ATOMIC_SEQ_CST) == buffers) {
+        pthread_cond_wait(&shard->prod, &shard->lock);
+    }
+    pthread_mutex_unlock(&shard->lock);  // unlock
 }
 
+/**
+ * Function that adds an accepted connection to a shard's buffer and wakes
+ * one of its workers.
+ *
+ * shard: shard to add to
+ * connfd: the connection fd
+ */
+void add_connection(shard_t *shard, int connfd) {
+    long long key = policy == POLICY_FIFO ? 0 : policy_key(connfd);
+
+    int depth = __atomic_add_fetch(&shard->stats->queued, 1, __ATOMIC_RELAXED) -
+        __atomic_load_n(&shard->stats->dequeued, __ATOMIC_RELAXED);
+    if (depth > shard->stats->max_depth) {  // only the shard's acceptor writes it
+        __atomic_store_n(&shard->stats->max_depth, depth, __ATOMIC_RELAXED);
+    }
+    if (connfd < max_fds) {
+        queued_at[connfd] = now_us();
+    }
+    // take the slot wait_for_slot() saw free
+    __atomic_fetch_add(&shard->pending, 1, __ATOMIC_SEQ_CST);
+
+    if (queue_kind == QUEUE_LOCKFREE) {
+        mpmc_put(&shard->lockfree_queue, connfd);
+        return;
+    }
+
+    if (shard->locals != NULL) {
+        local_add(shard, connfd);
+        return;
+    }
+
+    pthread_mutex_lock(&shard->lock);  // get lock
+    if (policy == POLICY_FIFO) {  // add connection fd
+        ring_enqueue(&shard->conn_queue, connfd);
+    } else {
+        heap_enqueue(&shard->prio_queue, connfd, key);
+    }
+    pthread_cond_signal(&shard->cons);  // wake workers
+    pthread_mutex_unlock(&shard->lock);  // unlock
+}
+
+/**
+ * Function that decides whether admission control should turn a new
+ * connection away.
+ *
+ * shard: shard the connection would be buffered in
+ * Return: 1 if every buffer slot is held, or requests are waiting and have
+ *         lately waited longer than the SLO, else 0
+ */
+int overloaded(shard_t *shard) {
+    int held = __atomic_load_n(&shard->pending, __ATOMIC_SEQ_CST);
+    int depth = __atomic_load_n(&shard->stats->queued, __ATOMIC_RELAXED) -
+        __atomic_load_n(&shard->stats->dequeued, __ATOMIC_RELAXED);
+
+    // an empty buffer admits whatever the average says, or a stale average
+    // left by a burst would shed every connection of an idle server
+    return held >= buffers ||
+        (depth > 0 && __atomic_load_n(&shard->stats->wait_avg, __ATOMIC_RELAXED) > slo_us);
+}
+
+/**
+ * Function that sends the canned 503 to a connection being shed. The
+ * caller closes it.
+ *
+ * shard: shard that shed the connection
+ * connfd: the connection fd
+ */
+void shed_connection(shard_t *shard, int connfd) {
+    char drain[MAXBUF];
+
+    send(connfd, shed_response, shed_len, MSG_DONTWAIT | MSG_NOSIGNAL);  // fits the socket buffer
+    shutdown(connfd, SHUT_WR);
+    // unread request bytes would make the close reset the connection,
+    // which can discard the 503 before the client reads it
+    while (recv(connfd, drain, sizeof(drain), MSG_DONTWAIT) > 0) {
+    }
+    __atomic_fetch_add(&shard->stats->shed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Function used by the event loop to queue a connection whose request has
+ * fully arrived.
+ *
+ * arg: shard the event loop belongs to
+ * connfd: the connection fd
+ */
+void dispatch_connection(void *arg, int connfd) {
+    shard_t *shard = (shard_t*) arg;
+    conn_t *conn = event_conn(connfd);
+
+    // admission control only turns away clients that have not been served
+    if (slo_us > 0 && !conn->admitted && overloaded(shard)) {
+        shed_connection(shard, connfd);
+        event_close(conn);
+        return;
+    }
+
+    wait_for_slot(shard);
+    add_connection(shard, connfd);
+}
+
+/**
+ * Function that pins the calling thread to a CPU.
+ *
+ * cpu: CPU to run on, -1 to leave the thread unpinned
+ */
+void pin_to_cpu(int cpu) {
+    if (cpu < 0) {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);  // best effort
+}
+
+/**
+ * Function that checks whether the response just sent was cut short
+ * because the client hung up or stopped reading, and clears the error.
+ *
+ * tracker: worker's private copy of its shared memory entry, whose write
+ *          timeouts are counted
+ * Return: 1 if a send failed, else 0
+ */
+int send_failed(shm_entry *tracker) {
+    int err = rio_send_errno;
+
+    rio_send_errno = 0;
+    if (err == EAGAIN || err == EWOULDBLOCK) {  // SO_SNDTIMEO ran out
+        tracker->write_timeouts++;
+    }
+    return err != 0;
+}
 
 /**
  * Function used by worker threads to handle requests from the buffer
  *
- * arg: pointer to buffer of threads
+ * arg: pointer to the worker's worker_arg, freed by the worker
  * return: 0 to end thread
  */
 void *worker(void *arg) {
-    int index = *((int*) arg);  // get index in shared mem
-    shared_mem[index].thread_ID = pthread_self();  // set tid in mem
-    shared_mem[index].total_reqs = 0;
-    shared_mem[index].static_reqs = 0;
-    shared_mem[index].dynamic_reqs = 0;
+    int index = ((worker_arg*) arg)->index;  // get index in shared mem
+    shard_t *shard = ((worker_arg*) arg)->shard;  // get shard to serve
+    local_t *local = ((worker_arg*) arg)->local;  // own queue with -p
+    shm_entry mine;  // updated while serving, then published to shared mem
 
-    // run infinite loop
+    free(arg);
+
+    // carry on the counters of the entry's last owner so totals never drop
+    memcpy(&mine, &shared_mem[index], sizeof(mine));
+    mine.thread_ID = pthread_self();  // set tid in mem
+    mine.shard = shard->id;
+    publish_stats(&shared_mem[index], &mine);
+
+    pin_to_cpu(local != NULL ? local->cpu : shard->cpu);
+
+    // run until the pool controller retires this worker
     while(1) {
-        pthread_mutex_lock(&lock);  // get lock
-        while (num_full == 0) {  // sleep if no available requests
-            pthread_cond_wait(&cons, &lock);
+        int req;  // wait for a request
+        if (local != NULL) {
+            req = local_take(shard, local, &mine);
+            __atomic_store_n(&local->busy, 1, __ATOMIC_SEQ_CST);
+        } else if ((req = take_connection(shard)) < 0) {
+            break;
+        }
+        long long taken = now_us();
+        long long queued = req < max_fds ? queued_at[req] : taken;
+
+        __atomic_fetch_add(&shard->busy, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&shard->wait_us, taken - queued, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&shard->waits, 1, __ATOMIC_RELAXED);
+        record_wait(shard, taken - queued);
+
+        if (idle_ms == 0) {  // one request per connection
+            rio_t rio;
+            Rio_readinitb(&rio, req);
+            requestHandle(req, &rio, NULL, 0, NULL, &mine);  // handle request
+            send_failed(&mine);
+            record_request(&mine, queued, taken);
+            publish_stats(&shared_mem[index], &mine);
+            Close(req);  // close connection
+            release_slot(shard);
+            __atomic_fetch_sub(&shard->busy, 1, __ATOMIC_RELAXED);
+            if (local != NULL) {
+                __atomic_store_n(&local->busy, 0, __ATOMIC_RELAXED);
+            }
+            continue;
         }
 
-        int req_index;  // index of request for marking complete later
-        int req = get_full(shared_buf, &req_index);  // find request to handle
-        pthread_mutex_unlock(&lock);  // unlock
+        // event loop only queues connections with a full request buffered;
+        // keep serving while the client has pipelined further requests
+        conn_t *conn = event_conn(req);
+        int keep_alive;
+        conn->admitted = 1;
+        pid_t child;
+        do {
+            keep_alive = requestHandle(req, &conn->rio, &conn->req, 1, &child, &mine);
+            if (send_failed(&mine)) {
+                keep_alive = 0;
+            }
+            record_request(&mine, queued, taken);
+            publish_stats(&shared_mem[index], &mine);
+            queued = taken = now_us();  // a pipelined request waits only for this one
+        } while (keep_alive && request_ready(conn));
 
-        requestHandle(req, &shared_mem[index]);  // handle request
-        shared_mem[index].total_reqs++;  // increment total reqs
-        Close(req);  // close connection
+        if (keep_alive) {
+            event_return(conn);  // park until the next request
+        } else if (child > 0) {
+            event_reap(conn, child);  // event thread closes it when the CGI exits
+        } else {
+            event_close(conn);  // close connection
+        }
+        release_slot(shard);
+        __atomic_fetch_sub(&shard->busy, 1, __ATOMIC_RELAXED);
+        if (local != NULL) {
+            __atomic_store_n(&local->busy, 0, __ATOMIC_RELAXED);
+        }
+    }
 
-        pthread_mutex_lock(&lock);  // get lock
-        shared_buf[req_index] = -2;  // mark request slot free
-        num_empty++;  // increment num_empty
-        pthread_cond_signal(&prod);  // wake producer
-        pthread_mutex_unlock(&lock);  // unlock
+    // CGI processes still serving this worker's requests count them in
+    // its thread-local state, so it must outlive them
+    if (cgi_pool_enabled()) {
+        cgi_pool_drain();
     }
 
+    // give up the entry, keeping its counters for the next owner
+    mine.thread_ID = 0;
+    publish_stats(&shared_mem[index], &mine);
+    __atomic_fetch_sub(&shard->stats->workers, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&pool_lock);
+    slot_used[index] = 0;
+    pool_size--;
+    pool_retiring--;
+    pthread_mutex_unlock(&pool_lock);
+
+    // thread-local rings would otherwise outlive the thread
+    uring_sendfile_release();
+    log_release();  // the logger frees it once it is written out
+
     return 0;  // return 0 to end thread
 }
 
 /**
- * Main function of server. Also functions as producer thread
+ * Function that starts a worker for a shard in the first free shared
+ * memory entry.
+ *
+ * shard: shard the worker serves
+ * Return: 0 on success, -1 if the pool is full or the thread could not start
+ */
+int start_worker(shard_t *shard) {
+    worker_arg *arg = malloc(sizeof(worker_arg));
+    pthread_attr_t attr;
+    pthread_t thread;
+    int index;
+
+    if (arg == NULL) {
+        return -1;
+    }
+
+    // claim the lowest free entry
+    pthread_mutex_lock(&pool_lock);
+    for (index = 0; index < max_threads && slot_used[index]; index++) {
+    }
+    if (index == max_threads) {
+        pthread_mutex_unlock(&pool_lock);
+        free(arg);
+        return -1;
+    }
+    slot_used[index] = 1;
+    pool_size++;
+    pthread_mutex_unlock(&pool_lock);
+
+    arg->index = index;
+    arg->shard = shard;
+    int nth = __atomic_fetch_add(&shard->stats->workers, 1, __ATOMIC_RELAXED);
+    arg->local = shard->locals != NULL ? &shard->locals[nth] : NULL;
+
+    // nobody joins workers; retired ones just go away
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&thread, &attr, worker, (void*) arg);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        __atomic_fetch_sub(&shard->stats->workers, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&pool_lock);
+        slot_used[index] = 0;
+        pool_size--;
+        pthread_mutex_unlock(&pool_lock);
+        free(arg);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function that grows a shard's workers when its connections are backing
+ * up, and retires the ones it has had to spare for a whole idle window.
+ *
+ * shard: shard to look at
+ * now: current time (us)
+ */
+void pool_adjust(shard_t *shard, long long now) {
+    int workers = __atomic_load_n(&shard->stats->workers, __ATOMIC_RELAXED);
+    int depth = __atomic_load_n(&shard->stats->queued, __ATOMIC_RELAXED) -
+        __atomic_load_n(&shard->stats->dequeued, __ATOMIC_RELAXED);
+    int idle = workers - __atomic_load_n(&shard->busy, __ATOMIC_RELAXED);
+    long long wait_us = __atomic_load_n(&shard->wait_us, __ATOMIC_RELAXED);
+    int waits = __atomic_load_n(&shard->waits, __ATOMIC_RELAXED);
+
+    // average wait of the connections taken since the last tick
+    long long avg_wait = waits > shard->waits_seen ?
+        (wait_us - shard->wait_seen) / (waits - shard->waits_seen) : 0;
+    shard->wait_seen = wait_us;
+    shard->waits_seen = waits;
+
+    pthread_mutex_lock(&pool_lock);
+    int size = pool_size;
+    pthread_mutex_unlock(&pool_lock);
+
+    if (idle <= 0 && size < max_threads &&
+            (depth >= POOL_GROW_DEPTH || avg_wait >= POOL_GROW_WAIT_US)) {
+        int add = depth / 2 > 1 ? depth / 2 : 1;  // half the backlog, at least one
+        if (add > max_threads - size) {
+            add = max_threads - size;
+        }
+        int added = 0;
+        pthread_mutex_lock(&shard->lock);
+        int cancelled = shard->retire;
+        shard->retire = 0;  // the shard needs the workers it was about to lose
+        pthread_mutex_unlock(&shard->lock);
+        pthread_mutex_lock(&pool_lock);
+        pool_retiring -= cancelled;
+        pthread_mutex_unlock(&pool_lock);
+        while (added < add && start_worker(shard) == 0) {
+            added++;
+        }
+        log_printf(LOG_ERRORS, "pool: shard %d +%d workers (%d total): %d queued, "
+            "%lld us average wait, none idle\n", shard->id, added, size + added, depth, avg_wait);
+        shard->window_start = now;  // the new workers get a full window
+        shard->spare_min = INT_MAX;
+        return;
+    }
+
+    if (idle < shard->spare_min) {
+        shard->spare_min = idle;
+    }
+    if (now - shard->window_start < (long long) pool_idle_ms * 1000) {
+        return;
+    }
+
+    // retire what was spare all window, keeping min overall and one per
+    // shard; workers asked to retire before, by this shard or another, may
+    // still be idle and count as spare until they have gone
+    pthread_mutex_lock(&shard->lock);
+    int pending = shard->retire;
+    pthread_mutex_unlock(&shard->lock);
+    int retire = shard->spare_min - pending;
+    if (retire > workers - pending - 1) {
+        retire = workers - pending - 1;
+    }
+    pthread_mutex_lock(&pool_lock);
+    int remaining = pool_size - pool_retiring;
+    if (retire > remaining - min_threads) {
+        retire = remaining - min_threads;
+    }
+    if (retire > 0) {
+        pool_retiring += retire;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (retire > 0) {
+        pthread_mutex_lock(&shard->lock);
+        shard->retire += retire;
+        pthread_cond_broadcast(&shard->cons);
+        pthread_mutex_unlock(&shard->lock);
+        log_printf(LOG_ERRORS, "pool: shard %d -%d workers (%d total): at least %d idle "
+            "for %d ms\n", shard->id, retire, remaining - retire, shard->spare_min, pool_idle_ms);
+    }
+    shard->window_start = now;
+    shard->spare_min = INT_MAX;
+}
+
+/**
+ * Function run by the pool controller thread with -w.
+ *
+ * arg: unused
+ * Return: 0 (never reached)
+ */
+void *pool_controller(void *arg) {
+    while (1) {
+        usleep(POOL_TICK_MS * 1000);
+        long long now = now_us();
+        for (int id = 0; id < acceptors; id++) {
+            pool_adjust(&shards[id], now);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function that bounds how long the worker serving a connection may block
+ * reading its request (header_ms) and sending its response (write_ms).
+ *
+ * connfd: the connection fd
+ */
+void set_timeouts(int connfd) {
+    if (header_ms > 0) {
+        struct timeval timeout = { header_ms / 1000, header_ms % 1000 * 1000 };
+        setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    if (write_ms > 0) {
+        struct timeval timeout = { write_ms / 1000, write_ms % 1000 * 1000 };
+        setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+}
+
+/**
+ * Function run by each shard's acceptor. Accepts connections on the shard's
+ * own listening socket and feeds them to the shard's workers.
+ *
+ * arg: pointer to the shard
+ * Return: 0 (never reached)
+ */
+void *acceptor(void *arg) {
+    shard_t *shard = (shard_t*) arg;
+    struct sockaddr_in clientaddr;
+    int connfd, clientlen;
+
+    pin_to_cpu(shard->cpu);
+
+    if (idle_ms > 0) {
+        event_loop *loop = event_create(shard->listenfd, idle_ms, header_ms, write_ms, engine,
+            dispatch_connection, shard, shard->stats);
+        event_run(loop);  // never returns
+    }
+
+    while (1) {
+        if (slo_us == 0) {
+            wait_for_slot(shard);  // don't accept until the connection can be buffered
+        }
+
+        clientlen = sizeof(clientaddr);
+        connfd = Accept(shard->listenfd, (SA *)&clientaddr, (socklen_t *) &clientlen);
+        shard->stats->accepted++;
+        set_timeouts(connfd);
+
+        if (slo_us > 0) {  // admission control: shed rather than wait
+            if (overloaded(shard)) {
+                shed_connection(shard, connfd);
+                Close(connfd);
+                continue;
+            }
+            wait_for_slot(shard);  // a slot is free, so this returns at once
+        }
+
+        add_connection(shard, connfd);  // hand connection to the workers
+    }
+
+    return 0;
+}
+
+/**
+ * Function that asks the kernel to hand each new connection to the
+ * listening socket of the shard running on the CPU that received it, so
+ * connections stay CPU-local. Sockets in a SO_REUSEPORT group are numbered
+ * in the order they were bound; shard i is bound i-th and pinned to CPU i.
+ * If the filter cannot be attached the kernel falls back to hashing.
+ *
+ * listenfd: any socket of the group
+ */
+void attach_cpu_steering(int listenfd) {
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },  // A = cpu
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, acceptors },  // A %= acceptors
+        { BPF_RET | BPF_A, 0, 0, 0 },  // socket index = A
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+
+    setsockopt(listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
+/**
+ * Main function of server. Also functions as the acceptor of shard 0
  *
  * argc: number of command line arguments
  * argv: array of command line arguments as strings
  * Return: 0 (never reached)
  */
 int main(int argc, char *argv[]) {
-    int connfd, port, threads, clientlen;  // aded threads, buffers
-    struct sockaddr_in clientaddr;
+    int port, threads;  // aded threads, buffers
 
     signal(SIGINT,  sigint_handler);  // add signal handler
+    signal(SIGPIPE, SIG_IGN);  // a client that hung up fails the send instead
 
     getargs(&port, &threads, &buffers, &shm_name, argc, argv);  // added additional args
 
+    // rendered once, so shedding a connection costs one send
+    char *busy = "The server is overloaded, please try again shortly.\n";
+    shed_len = snprintf(shed_response, sizeof(shed_response),
+        "HTTP/1.0 503 Service Unavailable\r\nServer: CS537 Web Server\r\n"
+        "Retry-After: %d\r\nConnection: close\r\nContent-Type: text/plain\r\n"
+        "Content-Length: %d\r\n\r\n%s", SHED_RETRY_AFTER, (int) strlen(busy), busy);
+
     // make sure the number of worker threads and buffers is greater than 0 and port > 2000
     if (threads <= 0 || buffers <= 0 || port <= 2000) {
         fprintf(stderr, "Number of threads and buffers must be > 0, and the port must be > 2000.\n");
         exit(1);
     }
 
-    num_full = 0;  // 0 full buffers
-    num_empty = buffers;  // all empty buffers
+    // every shard needs at least one worker
+    if (acceptors > threads) {
+        fprintf(stderr, "Number of acceptors must not exceed the number of threads.\n");
+        exit(1);
+    }
 
     // initialize shared memory
     int shmfd = shm_open(shm_name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-    
+
     // make sure memory initialized correctly
     if (shmfd == -1) {  // there was an error
         fprintf(stderr, "shm_open failed.\n");  // print message
         exit(1);  // exit
     }
-    
+
+    // header, worker entries and shard entries, rounded up to whole pages
+    size_t page = getpagesize();
+    shm_size = sizeof(shm_header) + sizeof(shm_entry) * max_threads +
+        sizeof(shm_shard) * acceptors;
+    shm_size = (shm_size + page - 1) / page * page;
+
     // truncate
-    if (ftruncate(shmfd, getpagesize()) == -1) {  // if error
+    if (ftruncate(shmfd, shm_size) == -1) {  // if error
         fprintf(stderr, "ftruncate failed.\n");  // print message
         exit(1);  // exit
     }
 
     // map memory to pointer
-    shared_mem = (shm_entry*) mmap(NULL, getpagesize(), PROT_WRITE, MAP_SHARED, shmfd, 0);
-    if (shared_mem == (shm_entry*) -1) {  // if error
+    shm_base = (shm_header*) mmap(NULL, shm_size, PROT_WRITE, MAP_SHARED, shmfd, 0);
+    if (shm_base == (shm_header*) -1) {  // if error
         fprintf(stderr, "mmap failed.\n");  // print message
         exit(1);  // exit
     }
+    shm_base->num_entries = max_threads;
+    shm_base->num_shards = acceptors;
+    shared_mem = (shm_entry*) (shm_base + 1);
+    memset(shared_mem, 0, sizeof(shm_entry) * max_threads);  // workers inherit their entry
+    shm_shard *shard_stats = (shm_shard*) (shared_mem + max_threads);
 
-    pthread_t thread_pool[threads];  // array of threads
-    int fd_arr[buffers];  // array of files (buffer)
-    shared_buf = fd_arr;  // setup shared buffer
+    pthread_t acceptor_pool[acceptors];  // array of acceptor threads
+    pthread_t controller;  // pool controller with -w
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
 
-    // initialize lock, exit if it fails
-    if (pthread_mutex_init(&lock, NULL) != 0) {
-        fprintf(stderr, "Unable to initialize lock.\n");
+    // queue timestamps, indexed by fd
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur == RLIM_INFINITY) {
+        limit.rlim_cur = 65536;
+    }
+    max_fds = limit.rlim_cur;
+    queued_at = calloc(max_fds, sizeof(long long));
+    if (queued_at == NULL) {
+        fprintf(stderr, "Unable to allocate queue timestamps.\n");
         exit(1);
     }
 
-    // initialize buffers
-    for (int index = 0; index < buffers; index++) {
-        shared_buf[index] = -2;  // -2 indicates a free slot, -1 indicates in progress
+    // set up each shard, exit if it fails
+    shards = calloc(acceptors, sizeof(shard_t));
+    slot_used = calloc(max_threads, 1);
+    if (shards == NULL || slot_used == NULL) {
+        fprintf(stderr, "Unable to allocate shards.\n");
+        exit(1);
     }
+    for (int id = 0; id < acceptors; id++) {
+        shard_t *shard = &shards[id];
+        shard->id = id;
+        shard->cpu = (acceptors > 1 && cpus > 0) ? id % cpus : -1;
+        shard->stats = &shard_stats[id];
+        memset(shard->stats, 0, sizeof(shm_shard));
+        shard->stats->policy = policy;
 
-    int index_array[threads];  // used to pass through the index of each worker thread
+        // allocate the connection buffer
+        int rc;
+        if (queue_kind == QUEUE_LOCKFREE) {
+            rc = mpmc_init(&shard->lockfree_queue, buffers);
+        } else if (policy != POLICY_FIFO) {
+            rc = heap_init(&shard->prio_queue, buffers);
+        } else {
+            rc = ring_init(&shard->conn_queue, buffers);
+        }
+        if (rc != 0) {
+            fprintf(stderr, "Unable to allocate connection buffer.\n");
+            exit(1);
+        }
+
+        // initialize lock
+        if (pthread_mutex_init(&shard->lock, NULL) != 0) {
+            fprintf(stderr, "Unable to initialize lock.\n");
+            exit(1);
+        }
+        pthread_cond_init(&shard->cons, NULL);
+        pthread_cond_init(&shard->prod, NULL);
+        shard->spare_min = INT_MAX;
+        shard->window_start = now_us();
 
-    // initialize threads
+        // one queue per worker dealt to the shard, each pinned to its own CPU
+        if (local_queues != LOCAL_OFF) {
+            shard->nlocals = threads / acceptors + (id < threads % acceptors);
+            shard->locals = calloc(shard->nlocals, sizeof(local_t));
+            if (shard->locals == NULL) {
+                fprintf(stderr, "Unable to allocate worker queues.\n");
+                exit(1);
+            }
+            for (int nth = 0; nth < shard->nlocals; nth++) {
+                local_t *local = &shard->locals[nth];
+                if (ring_init(&local->queue, buffers) != 0) {
+                    fprintf(stderr, "Unable to allocate connection buffer.\n");
+                    exit(1);
+                }
+                pthread_mutex_init(&local->lock, NULL);
+                pthread_cond_init(&local->cond, NULL);
+                local->cpu = cpus > 0 ? (id + nth * acceptors) % cpus : -1;
+            }
+        }
+    }
+
+    // initialize threads, dealing them out to the shards in turn
     for (int index = 0; index < threads; index++) {
-        index_array[index] = index;  // set element to its index
-        if (pthread_create(&thread_pool[index], NULL, worker, (void*) &index_array[index]) != 0) {
+        if (start_worker(&shards[index % acceptors]) != 0) {
             fprintf(stderr, "Unable to create new thread.\n");
             exit(1);  // exit if unable to create thread
         }
     }
+    if (max_threads > min_threads &&
+            pthread_create(&controller, NULL, pool_controller, NULL) != 0) {
+        fprintf(stderr, "Unable to create new thread.\n");
+        exit(1);
+    }
 
-    listenfd = Open_listenfd(port);
-    while (1) {
-        pthread_mutex_lock(&lock);  // get lock
-        while (num_empty == 0) {  // sleep if no free buffer slots
-            pthread_cond_wait(&prod, &lock);
-        }
-
-        int req_index = get_empty(shared_buf);  // find request to handle
-        pthread_mutex_unlock(&lock);  // unlock
-
-        clientlen = sizeof(clientaddr);
-        connfd = Accept(listenfd, (SA *)&clientaddr, (socklen_t *) &clientlen);
+    // open one listening socket per shard; they share the port via SO_REUSEPORT
+    for (int id = 0; id < acceptors; id++) {
+        shards[id].listenfd = Open_listenfd_shared(port, acceptors > 1);
+    }
+    if (acceptors > 1 && cpus >= acceptors) {  // with fewer CPUs some shards would starve
+        attach_cpu_steering(shards[0].listenfd);
+    }
 
-        pthread_mutex_lock(&lock);  // get lock
-        shared_buf[req_index] = connfd;  // add connection fd
-        num_full++;  // increment num_full
-        pthread_cond_signal(&cons);  // wake workers
-        pthread_mutex_unlock(&lock);  // unlock
+    // start the other acceptors; this thread serves as shard 0's acceptor
+    for (int id = 1; id < acceptors; id++) {
+        if (pthread_create(&acceptor_pool[id], NULL, acceptor, (void*) &shards[id]) != 0) {
+            fprintf(stderr, "Unable to create new thread.\n");
+            exit(1);  // exit if unable to create thread
+        }
     }
+    acceptor(&shards[0]);  // never returns
 
     return 0;
 }
@@ -1,6 +1,28 @@
 // Program that reads out worker thread data from a simple web server
-
+//
+// To run:
+//  stat_process <shm_name> <sleeptime_ms> <num_threads> [-v]
+//
+//  -v: after the worker lines, also print one line per acceptor shard with
+//      its worker count, accepted connections, current and largest queue
+//      depth, average queue wait, connections shed with a 503 and requests
+//      served, followed by the load imbalance across shards (busiest shard's
+//      requests per worker over the average), the static file cache's
+//      hits, misses and evictions summed over the workers, the 304, 206
+//      (single and multipart) and 416 answers to conditional and Range
+//      requests, the connections closed for missing the server's idle,
+//      header and write deadlines, with per-worker queues (server -p) one
+//      line per worker with the connections it took from its own queue and
+//      stole and the share that were local, the p50/p90/p99 of the response
+//      latency (under the server's scheduling policy), queue wait and
+//      service time of the requests finished during the last interval, and
+//      how many requests, bytes and errors that interval added.
+//
+// Worker entries are read under their seqlock, so every line is a
+// consistent snapshot even while the workers are updating them.
 #include "helper.h"
+#include "queue.h"
+#include <stddef.h>
 
 /**
  * Function that gets arguments from the command line.
@@ -9,14 +31,18 @@
  * threads: pointer to the number of worker threads to be used by the server
  * buffers: pointer to the size of the input request buffer to be used
  * shm_name: pointer to the name of the shared memory address zone
+ * verbose: set to 1 if per-shard stats were requested with -v
  * argc: number of arguments
  * argv: array of command line arguments
  */
-void getargs(char **shm_name, int *sleeptime_ms, int *num_threads, int argc, char *argv[]) {
-    if (argc != 4) {  // check # args
-        fprintf(stderr, "Usage: %s <shm_name> <sleeptime_ms> <num_threads>\n", argv[0]);
+void getargs(char **shm_name, int *sleeptime_ms, int *num_threads, int *verbose, int argc,
+        char *argv[]) {
+    // check # args, the optional 4th must be -v
+    if ((argc != 4 && argc != 5) || (argc == 5 && strcmp(argv[4], "-v") != 0)) {
+        fprintf(stderr, "Usage: %s <shm_name> <sleeptime_ms> <num_threads> [-v]\n", argv[0]);
         exit(1);
     }
+    *verbose = (argc == 5);
 
     // transfer args from argv
     *shm_name = argv[1];
@@ -34,6 +60,221 @@ void getargs(char **shm_name, int *sleeptime_ms, int *num_threads, int argc, cha
     }
 }
 
+/**
+ * Function that copies a worker's entry out of shared memory, retrying
+ * while the worker is in the middle of publishing it.
+ *
+ * dst: where to put the snapshot
+ * src: the worker's entry in shared memory
+ */
+void read_entry(shm_entry *dst, shm_entry *src) {
+    unsigned before, after;
+
+    do {
+        before = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        memcpy(dst, src, sizeof(shm_entry));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&src->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
+
+/**
+ * Function that prints per-shard counters and the load imbalance.
+ *
+ * workers: snapshot of the worker entries
+ * shards: shard counters in shared memory
+ * num_threads: number of worker entries
+ * num_shards: number of shard counters
+ */
+void print_shards(shm_entry *workers, shm_shard *shards, int num_threads, int num_shards) {
+    double max_load = 0, total_load = 0;
+    for (int shard = 0; shard < num_shards; shard++) {
+        int served = 0;  // requests handled by the shard's workers
+        for (int index = 0; index < num_threads; index++) {
+            if (workers[index].shard == shard) {
+                served += workers[index].total_reqs;
+            }
+        }
+
+        printf("shard %i : workers %i accepted %i depth %i max_depth %i wait_avg %ius "
+            "shed %i served %i\n", shard, shards[shard].workers, shards[shard].accepted,
+            shards[shard].queued - shards[shard].dequeued, shards[shard].max_depth,
+            shards[shard].wait_avg, shards[shard].shed, served);
+
+        // compare requests per worker so uneven worker splits don't count
+        double load = shards[shard].workers > 0 ? (double) served / shards[shard].workers : 0;
+        total_load += load;
+        if (load > max_load) {
+            max_load = load;
+        }
+    }
+
+    if (num_shards > 0 && total_load > 0) {
+        printf("imbalance : %.2f\n", max_load / (total_load / num_shards));
+    }
+}
+
+/**
+ * Function that prints the static file cache counters of all workers.
+ *
+ * workers: snapshot of the worker entries
+ * num_threads: number of worker entries
+ */
+void print_cache(shm_entry *workers, int num_threads) {
+    int hits = 0, misses = 0, evictions = 0;
+
+    for (int index = 0; index < num_threads; index++) {
+        hits += workers[index].cache_hits;
+        misses += workers[index].cache_misses;
+        evictions += workers[index].cache_evictions;
+    }
+    printf("cache : hits %i misses %i evictions %i\n", hits, misses, evictions);
+}
+
+/**
+ * Function that prints how many conditional and range requests were
+ * answered without sending the whole file, summed over the workers.
+ *
+ * workers: snapshot of the worker entries
+ * num_threads: number of worker entries
+ */
+void print_partial(shm_entry *workers, int num_threads) {
+    int not_modified = 0, partial = 0, multipart = 0, unsatisfiable = 0;
+
+    for (int index = 0; index < num_threads; index++) {
+        not_modified += workers[index].not_modified;
+        partial += workers[index].partial;
+        multipart += workers[index].multipart;
+        unsatisfiable += workers[index].unsatisfiable;
+    }
+    printf("partial : not_modified %i ranges %i multipart %i unsatisfiable %i\n", not_modified,
+        partial, multipart, unsatisfiable);
+}
+
+/**
+ * Function that prints how many connections were closed for missing a
+ * deadline: by the event threads (idle, and header with -e or -u) and by
+ * the workers (header without them, and write).
+ *
+ * workers: snapshot of the worker entries
+ * shards: shard counters
+ * num_threads: number of worker entries
+ * num_shards: number of shard counters
+ */
+void print_timeouts(shm_entry *workers, shm_shard *shards, int num_threads, int num_shards) {
+    int idle = 0, header = 0, write = 0;
+
+    for (int shard = 0; shard < num_shards; shard++) {
+        idle += shards[shard].idle_timeouts;
+        header += shards[shard].header_timeouts;
+    }
+    for (int index = 0; index < num_threads; index++) {
+        header += workers[index].header_timeouts;
+        write += workers[index].write_timeouts;
+    }
+    printf("timeouts : idle %i header %i write %i\n", idle, header, write);
+}
+
+/**
+ * Function that prints, for servers with per-worker queues, how many
+ * connections each worker took from its own queue and how many it stole.
+ *
+ * workers: snapshot of the worker entries
+ * num_threads: number of worker entries
+ */
+void print_steals(shm_entry *workers, int num_threads) {
+    for (int index = 0; index < num_threads; index++) {
+        int local = workers[index].local_reqs, stolen = workers[index].stolen_reqs;
+        if (local + stolen == 0) {  // no per-worker queues, or nothing served yet
+            continue;
+        }
+        printf("steal %i : local %i stolen %i local_hits %.1f%%\n", index, local, stolen,
+            100.0 * local / (local + stolen));
+    }
+}
+
+/**
+ * Function that finds the time under which a fraction of the requests in
+ * a histogram completed.
+ *
+ * hist: histogram
+ * total: number of requests in hist
+ * fraction: e.g. 0.99 for p99
+ * Return: upper bound of the bucket holding that request, in microseconds
+ */
+long long percentile(long long *hist, long long total, double fraction) {
+    long long seen = 0;
+
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += hist[bucket];
+        if (seen >= fraction * total) {
+            return 2LL << bucket;
+        }
+    }
+    return 2LL << (LATENCY_BUCKETS - 1);
+}
+
+/**
+ * Function that prints p50/p90/p99 of one histogram over the last interval.
+ *
+ * name: label of the line
+ * workers: snapshot of the worker entries
+ * previous: snapshot taken at the end of the last interval
+ * num_threads: number of worker entries
+ * offset: offset of the histogram in shm_entry
+ */
+void print_histogram(char *name, shm_entry *workers, shm_entry *previous, int num_threads,
+        size_t offset) {
+    long long hist[LATENCY_BUCKETS] = {0};
+    long long total = 0;
+
+    for (int index = 0; index < num_threads; index++) {
+        int *now = (int*) ((char*) &workers[index] + offset);
+        int *then = (int*) ((char*) &previous[index] + offset);
+        for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+            hist[bucket] += now[bucket] - then[bucket];
+            total += now[bucket] - then[bucket];
+        }
+    }
+
+    if (total == 0) {
+        printf("%s : p50 - p90 - p99 -\n", name);
+        return;
+    }
+    printf("%s : p50 %lli us p90 %lli us p99 %lli us\n", name, percentile(hist, total, 0.5),
+        percentile(hist, total, 0.9), percentile(hist, total, 0.99));
+}
+
+/**
+ * Function that prints the timing percentiles and counter deltas of the
+ * last interval.
+ *
+ * workers: snapshot of the worker entries
+ * previous: snapshot taken at the end of the last interval
+ * num_threads: number of worker entries
+ * policy: scheduling policy of the server, -1 if unknown
+ */
+void print_interval(shm_entry *workers, shm_entry *previous, int num_threads, int policy) {
+    char *names[] = {"latency fifo", "latency sff", "latency static"};
+    int reqs = 0, errors = 0, drops = 0;
+    long long bytes = 0;
+
+    print_histogram(policy >= 0 && policy <= 2 ? names[policy] : "latency", workers, previous,
+        num_threads, offsetof(shm_entry, latency_hist));
+    print_histogram("wait", workers, previous, num_threads, offsetof(shm_entry, wait_hist));
+    print_histogram("service", workers, previous, num_threads,
+        offsetof(shm_entry, service_hist));
+
+    for (int index = 0; index < num_threads; index++) {
+        reqs += workers[index].total_reqs - previous[index].total_reqs;
+        errors += workers[index].errors - previous[index].errors;
+        bytes += workers[index].bytes_sent - previous[index].bytes_sent;
+        drops += workers[index].log_drops - previous[index].log_drops;
+    }
+    printf("interval : reqs +%i bytes +%lli errors +%i log_drops +%i\n", reqs, bytes, errors,
+        drops);
+}
+
 /*
  * Main function of program. Infinetly loops to get worker thread info from server.
  *
@@ -45,8 +286,9 @@ int main(int argc, char *argv[]) {
     char *shm_name;  // name of shared region
     int sleep_time;  // how long program should sleep between iterations
     int num_threads;  // number of worker threads in server
+    int verbose;  // print per-shard stats too
 
-    getargs(&shm_name, &sleep_time, &num_threads, argc, argv);  // get arguments
+    getargs(&shm_name, &sleep_time, &num_threads, &verbose, argc, argv);  // get arguments
 
      // initialize shared memory
     int shmfd = shm_open(shm_name, O_RDWR, S_IRUSR | S_IWUSR);
@@ -57,12 +299,45 @@ int main(int argc, char *argv[]) {
         exit(1);  // exit
     }
 
+    // the server sizes the region by its thread and shard counts
+    struct stat shm_stat;
+    if (fstat(shmfd, &shm_stat) == -1 || shm_stat.st_size == 0) {
+        fprintf(stderr, "fstat failed.\n");
+        exit(1);
+    }
+    size_t shm_size = shm_stat.st_size;
+
     // map memory to pointer
-    shm_entry *shared_mem = (shm_entry*) mmap(NULL, getpagesize(), PROT_WRITE, MAP_SHARED, shmfd, 0);
-    if (shared_mem == (shm_entry*) -1) {  // if error
+    shm_header *header = (shm_header*) mmap(NULL, shm_size, PROT_WRITE, MAP_SHARED, shmfd, 0);
+    if (header == (shm_header*) -1) {  // if error
         fprintf(stderr, "mmap failed.\n");  // print message
         exit(1);  // exit
     }
+    if (shm_size < sizeof(shm_header)) {
+        fprintf(stderr, "Shared memory has no header.\n");
+        exit(1);
+    }
+
+    // the header says how many worker entries and shard counters follow it
+    shm_entry *shared_mem = (shm_entry*) (header + 1);
+    shm_shard *shards = (shm_shard*) (shared_mem + header->num_entries);
+    int num_shards = header->num_shards;
+    if ((char*) (shards + num_shards) > (char*) header + shm_size) {
+        fprintf(stderr, "Shared memory is smaller than its header says.\n");
+        exit(1);
+    }
+    if (num_threads > header->num_entries) {  // more threads than the server has
+        fprintf(stderr, "Shared memory is too small for %i threads.\n", num_threads);
+        exit(1);
+    }
+
+    // snapshots of this and the previous iteration
+    shm_entry *workers = calloc(num_threads, sizeof(shm_entry));
+    shm_entry *previous = calloc(num_threads, sizeof(shm_entry));
+    if (workers == NULL || previous == NULL) {
+        fprintf(stderr, "Unable to allocate snapshots.\n");
+        exit(1);
+    }
 
     // time structure for waiting
     struct timespec sleep;
@@ -83,13 +358,28 @@ int main(int argc, char *argv[]) {
 
         // loop over threads, print data
         for (int index = 0; index < num_threads; index++) {
-            printf("%li : %i %i %i\n", shared_mem[index].thread_ID,
-                shared_mem[index].total_reqs, shared_mem[index].static_reqs,
-                    shared_mem[index].dynamic_reqs);
+            read_entry(&workers[index], &shared_mem[index]);
+            printf("%li : %i %i %i\n", workers[index].thread_ID,
+                workers[index].total_reqs, workers[index].static_reqs,
+                    workers[index].dynamic_reqs);
+        }
+
+        if (verbose) {
+            print_shards(workers, shards, num_threads, num_shards);
+            print_cache(workers, num_threads);
+            print_partial(workers, num_threads);
+            print_timeouts(workers, shards, num_threads, num_shards);
+            print_steals(workers, num_threads);
+            print_interval(workers, previous, num_threads, num_shards > 0 ? shards[0].policy : -1);
         }
 
         printf("\n");  // space out with empty line
         iteration_count++;  // increment count
+
+        // this iteration's snapshot is the next one's baseline
+        shm_entry *swap = previous;
+        previous = workers;
+        workers = swap;
     }
 
     return 0;  // Never reached
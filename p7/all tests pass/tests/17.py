@@ -0,0 +1,43 @@
+import http.client
+import socket
+import time
+from tester import Tester, diff, home_page_content
+
+tester = Tester()
+tester.run_server(threads=2, buffers=4, options=["-e", "500"])
+
+# several requests on one persistent connection
+conn = http.client.HTTPConnection("localhost", tester.port, timeout=10)
+conn.request("GET", "/home.html")
+first_sock = None
+for _ in range(3):
+    response = conn.getresponse()
+    if diff(response.read().decode('utf-8'), home_page_content):
+        exit(1)
+    if first_sock is None:
+        first_sock = conn.sock
+    elif conn.sock is not first_sock:
+        print("Fail: server did not keep the connection open")
+        exit(1)
+    conn.request("GET", "/home.html")
+conn.getresponse().read()
+
+# two pipelined requests in one write
+sock = socket.create_connection(("localhost", tester.port), timeout=10)
+sock.sendall(b"GET /home.html HTTP/1.1\r\nHost: x\r\n\r\n" * 2)
+data = b""
+while data.count(b"</html>") < 2:
+    chunk = sock.recv(65536)
+    if not chunk:
+        print("Fail: pipelined requests were not both answered")
+        exit(1)
+    data += chunk
+
+# idle connections are closed after the timeout
+time.sleep(1)
+if sock.recv(1) != b"":
+    print("Fail: idle connection was not closed")
+    exit(1)
+
+tester.kill_server()
+print("Pass")
@@ -0,0 +1,50 @@
+from tester import Tester
+
+threads = 8
+buffers = 16
+num_client = 20
+loops = 20
+item_list = ["/home.html", "/output.cgi?0.3", "/favicon.ico", "/output.cgi?0.2"]
+
+tester = Tester()
+tester.run_server(threads=threads, buffers=buffers, options=["-a", "2"])
+
+clients = [tester.run_client(item_list=item_list, loops=loops)
+           for _ in range(num_client)]
+
+for c in clients:
+    c.start()
+for c in clients:
+    c.join()
+
+# every request is a new connection, and SO_REUSEPORT spreads them over
+# both shards; each shard's counters must account for its own share
+total = num_client * loops * len(item_list)
+report = tester.read_stat(threads, verbose=True)[-1]
+shards = {}
+for line in report:
+    fields = line.split()
+    if fields[0] == "shard":
+        shards[int(fields[1])] = dict(zip(fields[3::2], fields[4::2]))
+tester.kill_server()
+
+if sorted(shards) != [0, 1]:
+    print(f"Fail: expected shard lines for shards 0 and 1, got {sorted(shards)}")
+    exit(1)
+for shard, counters in shards.items():
+    if counters["workers"] != str(threads // 2):
+        print(f"Fail: shard {shard} has {counters['workers']} workers, not {threads // 2}")
+        exit(1)
+    if int(counters["accepted"]) == 0 or int(counters["served"]) == 0:
+        print(f"Fail: shard {shard} accepted {counters['accepted']} and served "
+              f"{counters['served']} connections")
+        exit(1)
+    if counters["depth"] != "0":
+        print(f"Fail: shard {shard} still has {counters['depth']} connections queued")
+        exit(1)
+for name in ["accepted", "served"]:
+    count = sum(int(counters[name]) for counters in shards.values())
+    if count != total:
+        print(f"Fail: shards {name} {count} connections in all, expected {total}")
+        exit(1)
+print("Pass")
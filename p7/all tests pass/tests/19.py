@@ -0,0 +1,47 @@
+import http.client
+import os
+import time
+from tester import Tester, diff, home_page_content
+
+
+def fetch(port, path):
+    conn = http.client.HTTPConnection("localhost", port, timeout=10)
+    conn.request("GET", path)
+    body = conn.getresponse().read().decode('utf-8')
+    conn.close()
+    return body
+
+
+tester = Tester()
+tester.run_server(threads=2, buffers=4, options=["-c", "16"])
+
+# repeated requests for a cached file
+for _ in range(5):
+    if diff(fetch(tester.port, "/home.html"), home_page_content):
+        exit(1)
+
+# a changed file is picked up once the entry is revalidated
+with open("cache_test.txt", "w") as f:
+    f.write("first version\n")
+try:
+    if diff(fetch(tester.port, "/cache_test.txt"), "first version\n"):
+        exit(1)
+    time.sleep(0.1)
+    with open("cache_test.txt", "w") as f:
+        f.write("second, longer version\n")
+    time.sleep(1.1)
+    if diff(fetch(tester.port, "/cache_test.txt"), "second, longer version\n"):
+        exit(1)
+
+    # too large for a 1KB shard, served without the cache
+    big = "x" * 4000 + "\n"
+    with open("cache_test.txt", "w") as f:
+        f.write(big)
+    time.sleep(1.1)
+    if diff(fetch(tester.port, "/cache_test.txt"), big):
+        exit(1)
+finally:
+    os.remove("cache_test.txt")
+
+tester.kill_server()
+print("Pass")
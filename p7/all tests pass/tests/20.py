@@ -0,0 +1,43 @@
+import http.client
+import threading
+import time
+from tester import Tester
+
+# four 1 second CGI requests on two persistent processes take two rounds
+tester = Tester()
+tester.run_server(threads=4, buffers=8, options=["-g", "2"])
+
+bodies = []
+
+
+def fetch():
+    conn = http.client.HTTPConnection("localhost", tester.port, timeout=10)
+    conn.request("GET", "/output.cgi?1")
+    response = conn.getresponse()
+    bodies.append((response.status, response.read().decode('utf-8')))
+    conn.close()
+
+
+for round in range(2):
+    start = time.time()
+    clients = [threading.Thread(target=fetch) for _ in range(4)]
+    for client in clients:
+        client.start()
+    for client in clients:
+        client.join()
+    elapsed = time.time() - start
+    if elapsed < 1.8 or elapsed > 3.5:
+        print(f"Fail: 4 requests on 2 processes took {elapsed:.2f}s")
+        exit(1)
+
+if len(bodies) != 8:
+    print("Fail: missing responses")
+    exit(1)
+for status, body in bodies:
+    if status != 200 or "Welcome to the CGI program" not in body:
+        print("Fail: bad CGI response")
+        print(body)
+        exit(1)
+
+tester.kill_server()
+print("Pass")
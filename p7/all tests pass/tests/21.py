@@ -0,0 +1,47 @@
+import http.client
+import threading
+import time
+from tester import Tester, diff, home_page_content
+
+# the event thread reaps CGI processes, so one worker can start three
+# 1 second CGI requests back to back and they run at the same time
+tester = Tester()
+tester.run_server(threads=1, buffers=4, options=["-e", "2000"])
+
+bodies = []
+
+
+def fetch():
+    conn = http.client.HTTPConnection("localhost", tester.port, timeout=10)
+    conn.request("GET", "/output.cgi?1")
+    bodies.append(conn.getresponse().read().decode('utf-8'))
+    conn.close()
+
+
+start = time.time()
+clients = [threading.Thread(target=fetch) for _ in range(3)]
+for client in clients:
+    client.start()
+
+# a static request is not held up behind the running CGI programs
+time.sleep(0.2)
+conn = http.client.HTTPConnection("localhost", tester.port, timeout=10)
+conn.request("GET", "/home.html")
+if diff(conn.getresponse().read().decode('utf-8'), home_page_content):
+    exit(1)
+if time.time() - start > 0.9:
+    print("Fail: static request waited for the CGI programs")
+    exit(1)
+
+for client in clients:
+    client.join()
+elapsed = time.time() - start
+if elapsed > 2.5:
+    print(f"Fail: 3 CGI requests on one worker took {elapsed:.2f}s")
+    exit(1)
+if len(bodies) != 3 or any("Welcome to the CGI program" not in body for body in bodies):
+    print("Fail: bad CGI response")
+    exit(1)
+
+tester.kill_server()
+print("Pass")
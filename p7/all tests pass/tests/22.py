@@ -0,0 +1,40 @@
+import http.client
+import threading
+import time
+from tester import Tester, diff, home_page_content
+
+# one worker is busy with a 1 second CGI request while two more CGI requests
+# and then a static request queue up; the static one must jump the queue
+for policy in ["sff", "static"]:
+    tester = Tester()
+    tester.run_server(threads=1, buffers=8, options=["-s", policy])
+
+    def fetch_cgi():
+        conn = http.client.HTTPConnection("localhost", tester.port, timeout=10)
+        conn.request("GET", "/output.cgi?1")
+        conn.getresponse().read()
+        conn.close()
+
+    clients = [threading.Thread(target=fetch_cgi) for _ in range(3)]
+    start = time.time()
+    clients[0].start()
+    time.sleep(0.2)
+    clients[1].start()
+    clients[2].start()
+    time.sleep(0.2)
+
+    conn = http.client.HTTPConnection("localhost", tester.port, timeout=10)
+    conn.request("GET", "/home.html")
+    if diff(conn.getresponse().read().decode('utf-8'), home_page_content):
+        exit(1)
+    elapsed = time.time() - start
+    if elapsed > 1.8:
+        print(f"Fail: static request under {policy} took {elapsed:.2f}s")
+        exit(1)
+
+    for client in clients:
+        client.join()
+    tester.kill_server()
+    time.sleep(0.3)
+
+print("Pass")
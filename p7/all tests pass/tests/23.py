@@ -0,0 +1,52 @@
+import http.client
+import os
+import socket
+import time
+from tester import Tester, diff, home_page_content
+
+# a cached file truncated after it was stat'd must not be sent as a full
+# response: the connection is cut short and the server keeps running
+body = "y" * 32768
+for options in [["-c", "1024"], ["-c", "1024", "-e", "2000"]]:
+    tester = Tester()
+    tester.run_server(threads=2, buffers=4, options=options)
+    with open("truncate_test.txt", "w") as f:
+        f.write(body)
+    try:
+        conn = http.client.HTTPConnection("localhost", tester.port, timeout=3)
+        for _ in range(2):  # opened, then served from the cache
+            conn.request("GET", "/truncate_test.txt")
+            if diff(conn.getresponse().read().decode('utf-8'), body):
+                exit(1)
+
+        # within the cache's revalidation interval the old size is still used
+        open("truncate_test.txt", "w").close()
+        conn.request("GET", "/truncate_test.txt")
+        try:
+            response = conn.getresponse()
+            got = response.read()
+            if len(got) != int(response.getheader("Content-Length")):
+                print(f"Fail: short body under {options}")
+                exit(1)
+        except http.client.IncompleteRead:
+            pass  # cut short and closed, as it should be
+        except socket.timeout:
+            print(f"Fail: short response left the connection open under {options}")
+            exit(1)
+        conn.close()
+    finally:
+        os.remove("truncate_test.txt")
+
+    time.sleep(0.1)
+    if not tester.isServerAlive():
+        print(f"Fail: server exited under {options}")
+        exit(1)
+    conn = http.client.HTTPConnection("localhost", tester.port, timeout=10)
+    conn.request("GET", "/home.html")
+    if diff(conn.getresponse().read().decode('utf-8'), home_page_content):
+        exit(1)
+    conn.close()
+    tester.kill_server()
+    time.sleep(0.3)
+
+print("Pass")
@@ -0,0 +1,36 @@
+import socket
+import time
+from tester import Tester, TestFailure
+
+
+def status(port, request):
+    sock = socket.create_connection(("localhost", port), timeout=5)
+    sock.sendall(request)
+    line = sock.recv(4096).split(b"\r\n")[0].decode('utf-8')
+    sock.close()
+    return line
+
+
+# a header that does not fit in the buffer is answered 431 and a malformed
+# request 400, whether a worker or the event thread finds it
+big = b"GET /home.html HTTP/1.1\r\nX-Big: " + b"x" * 9000 + b"\r\n"
+for options in [[], ["-e", "2000"], ["-u", "2000"]]:
+    tester = Tester()
+    try:
+        tester.run_server(threads=2, buffers=4, options=options)
+    except TestFailure:
+        if options[:1] == ["-u"]:
+            continue  # no io_uring here
+        raise
+    got = status(tester.port, big)
+    if not got.endswith(" 431 Request Header Fields Too Large"):
+        print(f"Fail: oversized header got \"{got}\" under {options}")
+        exit(1)
+    got = status(tester.port, b"GARBAGE\r\n\r\n")
+    if not got.endswith(" 400 Bad Request"):
+        print(f"Fail: malformed request got \"{got}\" under {options}")
+        exit(1)
+    tester.kill_server()
+    time.sleep(0.3)
+
+print("Pass")
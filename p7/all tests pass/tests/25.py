@@ -0,0 +1,74 @@
+import gzip
+import http.client
+import os
+import time
+from tester import Tester, diff, home_page_content
+
+
+def fetch(port, item, encoding=None):
+    conn = http.client.HTTPConnection("localhost", port, timeout=10)
+    conn.request("GET", item, headers={"Accept-Encoding": encoding} if encoding else {})
+    response = conn.getresponse()
+    body = response.read()
+    conn.close()
+    return response.getheader("Content-Encoding"), body
+
+
+def expect(port, item, encoding, want_coding, want_body):
+    coding, body = fetch(port, item, encoding)
+    if coding != want_coding:
+        print(f"Fail: {item} with Accept-Encoding {encoding} got Content-Encoding {coding}")
+        exit(1)
+    if coding == "gzip":
+        body = gzip.decompress(body)
+    if body != want_body:
+        print(f"Fail: {item} with Accept-Encoding {encoding} got the wrong body")
+        exit(1)
+
+
+# files are compressed for clients that accept gzip, a precompressed .gz
+# sibling is preferred, files that do not compress are sent as they are,
+# and a changed file is compressed again
+tester = Tester()
+tester.run_server(threads=2, buffers=4, options=["-c", "1024", "-z", "1024"])
+home = home_page_content.encode('utf-8')
+text = b"compress me please\n" * 500
+try:
+    expect(tester.port, "/home.html", None, None, home)
+    expect(tester.port, "/home.html", "gzip", "gzip", home)
+    expect(tester.port, "/home.html", "identity", None, home)
+
+    with open("gzip_test.txt", "wb") as f:
+        f.write(text)
+    expect(tester.port, "/gzip_test.txt", "gzip", "gzip", text)  # cached without a sibling
+
+    # a sibling that appears is used once the cached file is next checked
+    with open("gzip_test.txt.gz", "wb") as f:
+        f.write(gzip.compress(b"from the sibling\n"))
+    time.sleep(1.1)
+    expect(tester.port, "/gzip_test.txt", "gzip", "gzip", b"from the sibling\n")
+    expect(tester.port, "/gzip_test.txt", None, None, text)
+    os.remove("gzip_test.txt.gz")
+    time.sleep(1.1)
+    expect(tester.port, "/gzip_test.txt", "gzip", "gzip", text)
+
+    # a changed file does not get the old compressed copy
+    time.sleep(0.1)
+    text = b"the second version\n" * 400
+    with open("gzip_test.txt", "wb") as f:
+        f.write(text)
+    time.sleep(1.1)
+    expect(tester.port, "/gzip_test.txt", "gzip", "gzip", text)
+
+    noise = os.urandom(20000)
+    with open("gzip_test.txt", "wb") as f:
+        f.write(noise)
+    time.sleep(1.1)
+    expect(tester.port, "/gzip_test.txt", "gzip", None, noise)
+finally:
+    for name in ["gzip_test.txt", "gzip_test.txt.gz"]:
+        if os.path.exists(name):
+            os.remove(name)
+
+tester.kill_server()
+print("Pass")
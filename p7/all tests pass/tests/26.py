@@ -0,0 +1,73 @@
+import http.client
+import time
+from tester import Tester, home_page_content
+
+
+def fetch(port, headers):
+    conn = http.client.HTTPConnection("localhost", port, timeout=10)
+    conn.request("GET", "/home.html", headers=headers)
+    response = conn.getresponse()
+    body = response.read()
+    conn.close()
+    return response, body
+
+
+def check(what, ok):
+    if not ok:
+        print(f"Fail: {what} under {options}")
+        exit(1)
+
+
+# conditional requests get 304, Range requests 206 with one range or a
+# multipart/byteranges body, 416 if nothing is satisfiable, and the whole
+# file if there are more ranges than the server serves
+home = home_page_content.encode('utf-8')
+size = len(home)
+for options in [[], ["-c", "1024"]]:
+    tester = Tester()
+    tester.run_server(threads=2, buffers=4, options=options)
+    for _ in range(2):  # with -c, opened then served from the cache
+        response, body = fetch(tester.port, {})
+        check("plain request", response.status == 200 and body == home)
+        etag = response.getheader("ETag")
+        modified = response.getheader("Last-Modified")
+
+        response, body = fetch(tester.port, {"If-None-Match": etag})
+        check("If-None-Match", response.status == 304 and body == b"")
+        response, body = fetch(tester.port, {"If-None-Match": "\"other\""})
+        check("If-None-Match with another tag", response.status == 200 and body == home)
+        response, body = fetch(tester.port, {"If-Modified-Since": modified})
+        check("If-Modified-Since", response.status == 304 and body == b"")
+        response, body = fetch(tester.port, {"If-Modified-Since": "Thu, 01 Jan 1970 00:00:00 GMT"})
+        check("If-Modified-Since before the file", response.status == 200 and body == home)
+
+        response, body = fetch(tester.port, {"Range": "bytes=10-19"})
+        check("single range", response.status == 206 and body == home[10:20] and
+              response.getheader("Content-Range") == f"bytes 10-19/{size}")
+        response, body = fetch(tester.port, {"Range": "bytes=-5"})
+        check("suffix range", response.status == 206 and body == home[-5:])
+
+        response, body = fetch(tester.port, {"Range": "bytes=0-3,20-29"})
+        kind = response.getheader("Content-Type")
+        check("multiple ranges", response.status == 206 and
+              kind.startswith("multipart/byteranges; boundary="))
+        boundary = kind.split("boundary=")[1].encode('utf-8')
+        parts = body.split(b"--" + boundary)
+        check("multipart body", len(parts) == 4 and parts[3] == b"--\r\n" and
+              parts[1].endswith(b"\r\n\r\n" + home[0:4] + b"\r\n") and
+              f"Content-Range: bytes 0-3/{size}".encode('utf-8') in parts[1] and
+              parts[2].endswith(b"\r\n\r\n" + home[20:30] + b"\r\n") and
+              f"Content-Range: bytes 20-29/{size}".encode('utf-8') in parts[2] and
+              len(body) == int(response.getheader("Content-Length")))
+
+        response, body = fetch(tester.port, {"Range": f"bytes={size}-"})
+        check("unsatisfiable range", response.status == 416 and
+              response.getheader("Content-Range") == f"bytes */{size}")
+
+        many = ",".join(f"{index}-{index}" for index in range(17))  # MAX_RANGES + 1
+        response, body = fetch(tester.port, {"Range": "bytes=" + many})
+        check("too many ranges", response.status == 200 and body == home)
+    tester.kill_server()
+    time.sleep(0.3)
+
+print("Pass")
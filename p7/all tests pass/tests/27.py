@@ -0,0 +1,86 @@
+import ctypes
+import http.client
+import os
+import socket
+import threading
+import time
+from tester import Tester, diff, home_page_content
+
+# the keep-alive, pipelining and CGI scenarios of tests 17 and 21 again,
+# with the event loop on io_uring; the server would quietly fall back to
+# epoll without it, so there is nothing to test then
+libc = ctypes.CDLL(None, use_errno=True)
+params = ctypes.create_string_buffer(120)  # struct io_uring_params
+ring = libc.syscall(425, 1, params)  # io_uring_setup
+if ring < 0:
+    print("Pass")
+    exit(0)
+os.close(ring)
+
+tester = Tester()
+tester.run_server(threads=2, buffers=4, options=["-u", "500"])
+
+# several requests on one persistent connection
+conn = http.client.HTTPConnection("localhost", tester.port, timeout=10)
+first_sock = None
+for _ in range(3):
+    conn.request("GET", "/home.html")
+    response = conn.getresponse()
+    if diff(response.read().decode('utf-8'), home_page_content):
+        exit(1)
+    if first_sock is None:
+        first_sock = conn.sock
+    elif conn.sock is not first_sock:
+        print("Fail: server did not keep the connection open")
+        exit(1)
+conn.close()
+
+# two pipelined requests in one write
+sock = socket.create_connection(("localhost", tester.port), timeout=10)
+sock.sendall(b"GET /home.html HTTP/1.1\r\nHost: x\r\n\r\n" * 2)
+data = b""
+while data.count(b"</html>") < 2:
+    chunk = sock.recv(65536)
+    if not chunk:
+        print("Fail: pipelined requests were not both answered")
+        exit(1)
+    data += chunk
+
+# idle connections are closed after the timeout
+time.sleep(1)
+if sock.recv(1) != b"":
+    print("Fail: idle connection was not closed")
+    exit(1)
+tester.kill_server()
+time.sleep(0.3)
+
+# the event thread reaps CGI processes, so one worker can start three
+# 1 second CGI requests back to back and they run at the same time
+tester = Tester()
+tester.run_server(threads=1, buffers=4, options=["-u", "2000"])
+bodies = []
+
+
+def fetch():
+    conn = http.client.HTTPConnection("localhost", tester.port, timeout=10)
+    conn.request("GET", "/output.cgi?1")
+    bodies.append(conn.getresponse().read().decode('utf-8'))
+    conn.close()
+
+
+start = time.time()
+clients = [threading.Thread(target=fetch) for _ in range(3)]
+for client in clients:
+    client.start()
+for client in clients:
+    client.join()
+elapsed = time.time() - start
+if elapsed > 2.5:
+    print(f"Fail: 3 CGI requests on one worker took {elapsed:.2f}s")
+    exit(1)
+if len(bodies) != 3 or any("Welcome to the CGI program" not in body for body in bodies):
+    print("Fail: bad CGI response")
+    exit(1)
+
+tester.kill_server()
+print("Pass")
@@ -0,0 +1,63 @@
+import http.client
+import os
+import re
+import threading
+import time
+from tester import Tester
+
+
+def fetch():
+    conn = http.client.HTTPConnection("localhost", tester.port, timeout=20)
+    conn.request("GET", "/output.cgi?1")
+    bodies.append(conn.getresponse().read().decode('utf-8'))
+    conn.close()
+
+
+def totals():
+    with open("pool_test.log") as f:
+        return [(sign, int(total)) for sign, total in
+                re.findall(r"pool: shard \d+ ([+-])\d+ workers \((\d+) total\)", f.read())]
+
+
+# one worker with 1 second CGI requests backing up grows the pool, which
+# shrinks back to the minimum once the extra workers have been idle for
+# the idle window
+tester = Tester()
+tester.run_server(threads=1, buffers=16, options=["-w", "1:4:1000", "-l", "1", "-o", "pool_test.log"])
+try:
+    bodies = []
+    start = time.time()
+    clients = [threading.Thread(target=fetch) for _ in range(6)]
+    for client in clients:
+        client.start()
+    for client in clients:
+        client.join()
+    elapsed = time.time() - start
+    if len(bodies) != 6 or any("Welcome to the CGI program" not in body for body in bodies):
+        print("Fail: bad CGI response")
+        exit(1)
+    if elapsed > 4.5:
+        print(f"Fail: 6 CGI requests took {elapsed:.2f}s, the pool did not grow")
+        exit(1)
+
+    time.sleep(2.5)  # a whole idle window, then the logger's next write
+    changes = totals()
+    if not any(sign == "+" and total > 1 for sign, total in changes):
+        print(f"Fail: no growth logged: {changes}")
+        exit(1)
+    if changes[-1] != ("-", 1) or any(total < 1 for _, total in changes):
+        print(f"Fail: the pool did not shrink back to 1 worker: {changes}")
+        exit(1)
+
+    # the pool is at its minimum and still serves
+    bodies = []
+    fetch()
+    if "Welcome to the CGI program" not in bodies[0]:
+        print("Fail: bad CGI response after shrinking")
+        exit(1)
+    tester.kill_server()
+finally:
+    time.sleep(0.3)
+    os.remove("pool_test.log")
+
+print("Pass")
@@ -0,0 +1,36 @@
+import http.client
+import threading
+import time
+from tester import Tester, diff, home_page_content
+
+
+def fetch(item):
+    conn = http.client.HTTPConnection("localhost", tester.port, timeout=10)
+    conn.request("GET", item)
+    body = conn.getresponse().read().decode('utf-8')
+    conn.close()
+    return body
+
+
+# with two workers dealt connections in turn, a 2 second CGI request keeps
+# the first busy; the third connection is dealt to it too, and the idle
+# second worker steals it instead of leaving it to wait
+tester = Tester()
+tester.run_server(threads=2, buffers=8, options=["-p", "rr"])
+slow = threading.Thread(target=fetch, args=("/output.cgi?2",))
+slow.start()
+time.sleep(0.3)
+if diff(fetch("/home.html"), home_page_content):  # dealt to the second worker
+    exit(1)
+
+start = time.time()
+if diff(fetch("/home.html"), home_page_content):  # dealt to the busy first one
+    exit(1)
+elapsed = time.time() - start
+if elapsed > 1:
+    print(f"Fail: a connection queued on a busy worker waited {elapsed:.2f}s")
+    exit(1)
+slow.join()
+
+tester.kill_server()
+print("Pass")
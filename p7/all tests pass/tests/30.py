@@ -0,0 +1,53 @@
+import http.client
+import threading
+import time
+from tester import Tester, diff, home_page_content
+
+
+def fetch(item):
+    conn = http.client.HTTPConnection("localhost", tester.port, timeout=10)
+    conn.request("GET", item)
+    response = conn.getresponse()
+    body = response.read().decode('utf-8')
+    conn.close()
+    return response, body
+
+
+def slow():
+    response, body = fetch("/output.cgi?1")
+    if response.status != 200:
+        failures.append(f"CGI request got {response.status}")
+
+
+# one worker and 1 second CGI requests: the second waits most of a second,
+# which puts the average wait over the 50 ms SLO, so a request arriving
+# while the third is waiting is shed with the canned 503; once nothing is
+# waiting requests are admitted again
+tester = Tester()
+tester.run_server(threads=1, buffers=8, options=["-d", "50"])
+failures = []
+clients = []
+for delay in [0, 0.1, 1.1]:
+    time.sleep(delay)
+    clients.append(threading.Thread(target=slow))
+    clients[-1].start()
+
+time.sleep(0.2)
+response, body = fetch("/home.html")
+if response.status != 503 or response.getheader("Retry-After") != "1" or \
+        "overloaded" not in body:
+    print(f"Fail: request over the SLO got {response.status} instead of the canned 503")
+    exit(1)
+
+for client in clients:
+    client.join()
+if failures:
+    print("Fail: " + failures[0])
+    exit(1)
+response, body = fetch("/home.html")
+if response.status != 200 or diff(body, home_page_content):
+    print(f"Fail: request to an idle server got {response.status}")
+    exit(1)
+
+tester.kill_server()
+print("Pass")
@@ -0,0 +1,61 @@
+import socket
+import time
+from tester import Tester
+
+
+def closed_after(sock, trickle=b""):
+    # seconds until the server closes the connection, sending trickle a
+    # byte at a time every 100 ms meanwhile
+    start = time.time()
+    sock.settimeout(0.1)
+    while True:
+        try:
+            if sock.recv(4096) == b"":
+                return time.time() - start
+        except socket.timeout:
+            pass
+        except ConnectionResetError:
+            return time.time() - start
+        if trickle:
+            sock.send(trickle[:1])
+            trickle = trickle[1:]
+        if time.time() - start > 5:
+            return 5
+
+
+def check(what, elapsed, low, high):
+    if not low <= elapsed <= high:
+        print(f"Fail: {what} was closed after {elapsed:.2f}s under {options}")
+        exit(1)
+
+
+# a request header that has begun must be complete within header_ms, sent
+# all at once or trickled in; a connection with no request in progress is
+# closed after idle_ms instead
+for options in [["-t", "300:0"], ["-e", "1000", "-t", "300:0"]]:
+    tester = Tester()
+    tester.run_server(threads=2, buffers=4, options=options)
+
+    sock = socket.create_connection(("localhost", tester.port))
+    sock.sendall(b"GET /home.html HTTP/1.1\r\n")
+    check("a stalled header", closed_after(sock), 0.2, 0.8)
+    sock.close()
+
+    sock = socket.create_connection(("localhost", tester.port))
+    check("a trickled header", closed_after(sock, b"GET /home.html HTTP/1.1\r\nHost: x\r\n"),
+          0.2, 0.8)
+    sock.close()
+
+    if "-e" in options:
+        sock = socket.create_connection(("localhost", tester.port))
+        sock.sendall(b"GET /home.html HTTP/1.1\r\n\r\n")
+        data = b""
+        while b"</html>" not in data:
+            data += sock.recv(65536)
+        check("an idle keep-alive connection", closed_after(sock), 0.8, 1.6)
+        sock.close()
+
+    tester.kill_server()
+    time.sleep(0.3)
+
+print("Pass")
@@ -0,0 +1,115 @@
+import http.client
+import re
+import time
+from tester import Tester
+
+threads = 2
+buffers = 8
+num_client = 4
+loops = 10
+static_reqs = 20
+dynamic_reqs = 2
+missing_reqs = 2
+
+
+def fetch(port, item):
+    conn = http.client.HTTPConnection("localhost", port, timeout=10)
+    conn.request("GET", item)
+    response = conn.getresponse()
+    response.read()
+    conn.close()
+    return response.status
+
+
+def check(what, ok):
+    if not ok:
+        print(f"Fail: {what}")
+        exit(1)
+
+
+def fields(line):
+    # "name : key value key value ..." -> {key: value}
+    words = line.split(" : ")[1].split()
+    return dict(zip(words[0::2], words[1::2]))
+
+
+def percentiles(line):
+    # "name : p50 N us p90 N us p99 N us" -> {"p50": N, ...}, {} if empty
+    return {name: int(value) for name, value in re.findall(r"(p\d+) (\d+) us", line)}
+
+
+# a known mix of requests, one at a time: static files, 404s, then CGI
+# requests slow enough to land in a much higher latency bucket; concurrent
+# clients after that make workers publish while stat_process reads
+tester = Tester()
+tester.run_server(threads=threads, buffers=buffers)
+tester.run_stat(threads, verbose=True, capture=True)
+time.sleep(0.2)
+for _ in range(static_reqs):
+    check("static request", fetch(tester.port, "/home.html") == 200)
+for _ in range(missing_reqs):
+    check("missing file", fetch(tester.port, "/missing.html") == 404)
+time.sleep(0.2)
+for _ in range(dynamic_reqs):
+    check("dynamic request", fetch(tester.port, "/output.cgi?1") == 200)
+time.sleep(0.2)
+clients = [tester.run_client(item_list=["/home.html"], loops=loops) for _ in range(num_client)]
+for c in clients:
+    c.start()
+for c in clients:
+    c.join()
+time.sleep(0.2)
+reports = tester.stat_reports()
+tester.kill_server()
+
+total = static_reqs + missing_reqs + dynamic_reqs + num_client * loops
+served = 0
+for report in reports:
+    reqs = [[int(word) for word in line.split(" : ")[1].split()]
+            for line in report[1:1 + threads]]
+    # every entry is a snapshot taken under its seqlock, so its counters
+    # agree with each other even while the worker is publishing
+    for total_reqs, static, dynamic in reqs:
+        check(f"torn worker entry {total_reqs} {static} {dynamic}",
+              total_reqs >= static + dynamic and total_reqs - static - dynamic <= missing_reqs)
+    check("worker counts went backwards", sum(r[0] for r in reqs) >= served)
+    served = sum(r[0] for r in reqs)
+
+    lines = {line.split(" : ")[0]: line for line in report}
+    for name in ["latency fifo", "wait", "service", "interval"]:
+        check(f"no {name} line in {report}", name in lines)
+    delta = fields(lines["interval"])
+    latency = lines["latency fifo"].split(" : ")[1]
+    if delta["reqs"] == "+0":
+        check(f"percentiles without requests: {latency}", latency == "p50 - p90 - p99 -")
+        continue
+    p = percentiles(latency)
+    check(f"no percentiles with requests: {latency}", len(p) == 3)
+    p50, p90, p99 = p["p50"], p["p90"], p["p99"]
+    check(f"percentiles out of order: {latency}", 0 < p50 <= p90 <= p99)
+    check(f"percentiles not bucket bounds: {latency}",
+          all(value & (value - 1) == 0 for value in [p50, p90, p99]))
+
+# the last report has everything; the intervals add up to the same
+last = reports[-1]
+reqs = [[int(word) for word in line.split(" : ")[1].split()] for line in last[1:1 + threads]]
+check(f"total requests {sum(r[0] for r in reqs)}, expected {total}",
+      sum(r[0] for r in reqs) == total)
+check(f"static requests {sum(r[1] for r in reqs)}",
+      sum(r[1] for r in reqs) == static_reqs + num_client * loops)
+check(f"dynamic requests {sum(r[2] for r in reqs)}", sum(r[2] for r in reqs) == dynamic_reqs)
+
+deltas = [fields(line) for report in reports for line in report if line.startswith("interval")]
+check("interval requests do not add up", sum(int(d["reqs"]) for d in deltas) == total)
+check("interval errors do not add up", sum(int(d["errors"]) for d in deltas) == missing_reqs)
+check("interval bytes do not cover the static files",
+      sum(int(d["bytes"]) for d in deltas) > (static_reqs + num_client * loops) * 200)
+
+# the CGI requests take a second, so the intervals they finished in put
+# the p99 of the service time in the 2^19-2^20 us bucket or above, while
+# the static requests before them are far quicker
+service = [percentiles(line) for report in reports for line in report
+           if line.startswith("service") and "p99 -" not in line]
+check("no interval saw the slow CGI requests", any(p["p99"] >= 1 << 20 for p in service))
+check(f"static requests were slow: {service[0]}", service[0]["p99"] < 1 << 20)
+print("Pass")
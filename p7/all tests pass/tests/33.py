@@ -0,0 +1,74 @@
+import http.client
+import os
+import time
+from tester import Tester
+
+log_file = "logger_test.log"
+found = 3
+missing = 2
+
+
+def fetch(port, method, item):
+    conn = http.client.HTTPConnection("localhost", port, timeout=10)
+    conn.request(method, item)
+    response = conn.getresponse()
+    response.read()
+    conn.close()
+    return response.status
+
+
+def records(level):
+    # serve a known set of requests at a log level, then read back the log
+    tester = Tester()
+    tester.run_server(threads=2, buffers=4, options=["-o", log_file, "-l", str(level)])
+    try:
+        for _ in range(found):
+            if fetch(tester.port, "GET", "/home.html") != 200:
+                print(f"Fail: bad response at -l {level}")
+                exit(1)
+        for _ in range(missing):
+            if fetch(tester.port, "GET", "/missing.html") != 404:
+                print(f"Fail: missing file not answered with 404 at -l {level}")
+                exit(1)
+        if fetch(tester.port, "POST", "/home.html") != 501:
+            print(f"Fail: POST not answered with 501 at -l {level}")
+            exit(1)
+        time.sleep(0.3)  # the logger writes its rings every LOG_FLUSH_MS
+        tester.kill_server()
+        time.sleep(0.3)
+        with open(log_file) as log:
+            return log.read().splitlines()
+    finally:
+        os.remove(log_file)
+
+
+def count(lines, prefix):
+    return sum(1 for line in lines if line.startswith(prefix))
+
+
+# each level adds to the one before: error responses at 1, one line per
+# request at 2, the headers and bodies of error responses at 3
+for level in range(4):
+    lines = records(level)
+    expect = {
+        "404 Not found: ./missing.html": missing if level >= 1 else 0,
+        "501 Not Implemented: POST": 1 if level >= 1 else 0,
+        "GET /home.html HTTP/1.1": found if level >= 2 else 0,
+        "GET /missing.html HTTP/1.1": missing if level >= 2 else 0,
+        "POST /home.html HTTP/1.1": 1 if level >= 2 else 0,
+        "HTTP/1.0 404 Not found": missing if level >= 3 else 0,
+        "HTTP/1.0 501 Not Implemented": 1 if level >= 3 else 0,
+    }
+    for prefix, wanted in expect.items():
+        if count(lines, prefix) != wanted:
+            print(f"Fail: -l {level} logged {count(lines, prefix)} \"{prefix}\" records, "
+                  f"expected {wanted}")
+            exit(1)
+    if level < 3 and len(lines) != sum(expect.values()):
+        print(f"Fail: -l {level} logged unexpected records: {lines}")
+        exit(1)
+    if any("dropped" in line for line in lines):
+        print(f"Fail: -l {level} dropped records: {lines}")
+        exit(1)
+
+print("Pass")
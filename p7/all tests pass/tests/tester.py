@@ -4,7 +4,7 @@ import time
 import signal
 import os
 import threading
-from typing import Tuple, List
+from typing import Tuple, List, Optional
 
 home_page_content = '<html>\n\n'\
     '<head>\n' \
@@ -50,12 +50,16 @@ class Tester:
         self.server_proc = None
         self.stat_proc = None
 
-    def run_server(self, threads: int, buffers: int) -> subprocess.Popen:
+    def run_server(self, threads: int, buffers: int,
+                   options: Optional[List[str]] = None) -> subprocess.Popen:
         # Run server; expect the server not fail
+        if options is None:
+            options = []
+        args = ["./server", f"{self.port}", f"{threads}", f"{buffers}", self.shm_name] + options
         if self.debug_mode:
-            self.server_proc = subprocess.Popen(["./server", f"{self.port}", f"{threads}", f"{buffers}", self.shm_name])
+            self.server_proc = subprocess.Popen(args)
         else:
-            self.server_proc = subprocess.Popen(["./server", f"{self.port}", f"{threads}", f"{buffers}", self.shm_name], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+            self.server_proc = subprocess.Popen(args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
 
         time.sleep(0.5)  # give the server some time to start
         if not self.isServerAlive():  # the server process exits
@@ -69,13 +73,39 @@ class Tester:
                 f"Server exits unexpectedly with return code {self.server_proc.returncode}")
         self.server_proc.send_signal(signal.SIGINT)
 
-    def run_stat(self, threads: int) -> subprocess.Popen:
-        self.stat_proc = subprocess.Popen(["./stat_process", self.shm_name, "50", f"{threads}"])
+    def run_stat(self, threads: int, verbose: bool = False,
+                 capture: bool = False) -> subprocess.Popen:
+        # With capture, stat_process is line buffered into a pipe so that
+        # stat_reports() gets every report even though SIGINT ends it
+        args = ["./stat_process", self.shm_name, "50", f"{threads}"]
+        if verbose:
+            args.append("-v")
+        if capture:
+            self.stat_proc = subprocess.Popen(["stdbuf", "-oL"] + args,
+                                              stdout=subprocess.PIPE, text=True)
+        else:
+            self.stat_proc = subprocess.Popen(args)
         return self.stat_proc
 
     def kill_stat(self) -> None:
         self.stat_proc.send_signal(signal.SIGINT)
 
+    def stat_reports(self) -> List[List[str]]:
+        # Stop a stat_process started with capture and return the lines of
+        # each report it printed in full
+        self.kill_stat()
+        out, _ = self.stat_proc.communicate()
+        reports = [report.splitlines() for report in out.split("\n\n")[:-1]]
+        if not reports:
+            raise TestFailure("stat_process printed no report")
+        return reports
+
+    def read_stat(self, threads: int, verbose: bool = False) -> List[List[str]]:
+        # Run stat_process for a few intervals and return its reports
+        self.run_stat(threads, verbose=verbose, capture=True)
+        time.sleep(0.3)
+        return self.stat_reports()
+
     def isServerAlive(self) -> bool:
         if self.server_proc is None:
             return False
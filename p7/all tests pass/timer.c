@@ -0,0 +1,219 @@
+//
+// timer.c: Hierarchical timer wheel (Varghese and Lauck) for connection
+// deadlines.
+//
+// Level 0 has one slot per millisecond of the next TIMER_SLOTS; each level
+// above has slots TIMER_SLOTS times as wide. A timer is filed at the lowest
+// level whose current rotation still has the timer's slot ahead of the
+// cursor, so adding one is a shift, a subtraction and a list append, and
+// cancelling one is an unlink. When the cursor of a level reaches a slot,
+// the timers in it are filed again, which moves each to a lower level until
+// it reaches level 0 and is due. Timers further out than the top level are
+// parked in its farthest slot and filed again when that comes round.
+//
+
+#include "helper.h"
+#include "timer.h"
+
+/**
+ * Function that makes a list sentinel empty.
+ */
+static void list_init(timer_node *head) {
+    head->prev = head;
+    head->next = head;
+}
+
+/**
+ * Function that appends a timer to a list.
+ */
+static void list_append(timer_node *head, timer_node *node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+/**
+ * Function that unlinks a timer from whichever list holds it.
+ */
+static void list_remove(timer_node *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = NULL;
+    node->next = NULL;
+}
+
+/**
+ * Function that files a timer in the slot it belongs in as of wheel->now,
+ * or on the expired list if it is already due.
+ *
+ * wheel: the wheel
+ * node: timer with expires set, not on any list
+ */
+static void file_timer(timer_wheel *wheel, timer_node *node) {
+    long long when = node->expires;
+    int level, shift = 0;
+
+    if (when <= wheel->now) {
+        list_append(&wheel->expired, node);
+        return;
+    }
+
+    // lowest level where the slot is less than a rotation ahead of the cursor
+    for (level = 0; level < TIMER_LEVELS - 1; level++) {
+        shift = TIMER_LEVEL_BITS * level;
+        if ((when >> shift) - (wheel->now >> shift) < TIMER_SLOTS) {
+            break;
+        }
+    }
+    shift = TIMER_LEVEL_BITS * level;
+    if ((when >> shift) - (wheel->now >> shift) >= TIMER_SLOTS) {  // past the top level
+        when = ((wheel->now >> shift) + TIMER_SLOTS - 1) << shift;
+    }
+    list_append(&wheel->slots[level][(when >> shift) & (TIMER_SLOTS - 1)], node);
+}
+
+/**
+ * Function that sets up an empty wheel.
+ *
+ * wheel: wheel to initialize
+ * now: current ms timestamp
+ */
+void timer_init(timer_wheel *wheel, long long now) {
+    wheel->now = now;
+    wheel->count = 0;
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_SLOTS; slot++) {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+    list_init(&wheel->expired);
+}
+
+/**
+ * Function that starts a timer.
+ *
+ * wheel: the wheel
+ * node: timer, not pending
+ * expires: ms timestamp to fire at; a past one fires on the next expiry check
+ */
+void timer_add(timer_wheel *wheel, timer_node *node, long long expires) {
+    node->expires = expires;
+    file_timer(wheel, node);
+    wheel->count++;
+}
+
+/**
+ * Function that stops a timer if it is pending, whether or not it is due.
+ *
+ * wheel: the wheel
+ * node: timer to stop
+ */
+void timer_cancel(timer_wheel *wheel, timer_node *node) {
+    if (node->prev != NULL) {
+        list_remove(node);
+        wheel->count--;
+    }
+}
+
+/**
+ * Function that checks whether a timer is pending.
+ *
+ * node: timer to check
+ * Return: 1 if added and not yet cancelled or expired, else 0
+ */
+int timer_pending(timer_node *node) {
+    return node->prev != NULL;
+}
+
+/**
+ * Function that advances the wheel and takes the next timer that is due.
+ * Call it until it returns NULL to take all of them.
+ *
+ * wheel: the wheel
+ * now: current ms timestamp
+ * Return: a due timer, no longer pending, or NULL if none is due
+ */
+timer_node *timer_expire(timer_wheel *wheel, long long now) {
+    while (wheel->expired.next == &wheel->expired && wheel->now < now) {
+        if (wheel->count == 0) {  // nothing to file on the way
+            wheel->now = now;
+            break;
+        }
+        wheel->now++;
+
+        // refile the slots whose cursors moved, top level first, so that
+        // their timers land in slots not yet passed
+        for (int level = TIMER_LEVELS - 1; level > 0; level--) {
+            int shift = TIMER_LEVEL_BITS * level;
+            if ((wheel->now & ((1LL << shift) - 1)) != 0) {
+                continue;
+            }
+            timer_node *head = &wheel->slots[level][(wheel->now >> shift) & (TIMER_SLOTS - 1)];
+            timer_node pending;
+            list_init(&pending);
+            while (head->next != head) {  // detach first, since filing may append here
+                timer_node *node = head->next;
+                list_remove(node);
+                list_append(&pending, node);
+            }
+            while (pending.next != &pending) {
+                timer_node *node = pending.next;
+                list_remove(node);
+                file_timer(wheel, node);
+            }
+        }
+
+        // everything in the level 0 slot is due now
+        timer_node *head = &wheel->slots[0][wheel->now & (TIMER_SLOTS - 1)];
+        while (head->next != head) {
+            timer_node *node = head->next;
+            list_remove(node);
+            list_append(&wheel->expired, node);
+        }
+    }
+
+    if (wheel->expired.next == &wheel->expired) {
+        return NULL;
+    }
+    timer_node *node = wheel->expired.next;
+    list_remove(node);
+    wheel->count--;
+    return node;
+}
+
+/**
+ * Function that works out when timer_expire() next has work to do: when the
+ * earliest timer is due, or sooner if a higher level slot must be filed
+ * again first.
+ *
+ * wheel: the wheel
+ * Return: ms timestamp, or -1 if no timer is pending
+ */
+long long timer_next(timer_wheel *wheel) {
+    long long next = -1;
+
+    if (wheel->expired.next != &wheel->expired) {
+        return wheel->now;
+    }
+    if (wheel->count == 0) {
+        return -1;
+    }
+
+    // the first occupied slot ahead of each cursor; lower levels come sooner
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        int shift = TIMER_LEVEL_BITS * level;
+        long long base = wheel->now >> shift;
+        for (int ahead = 1; ahead < TIMER_SLOTS; ahead++) {
+            timer_node *head = &wheel->slots[level][(base + ahead) & (TIMER_SLOTS - 1)];
+            if (head->next != head) {
+                long long at = (base + ahead) << shift;
+                if (next < 0 || at < next) {
+                    next = at;
+                }
+                break;
+            }
+        }
+    }
+    return next;
+}
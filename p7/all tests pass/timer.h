@@ -0,0 +1,36 @@
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+//
+// timer.h: hierarchical timer wheel with 1ms ticks used by the event loops
+// for connection deadlines. Adding and cancelling a timer are O(1); timers
+// are intrusive nodes embedded in what they time, and the wheel is owned by
+// one thread, so it does no locking.
+//
+
+#define TIMER_LEVEL_BITS 6  // slots per level as a power of two
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS 4  // 64^4 ms, about 4.6 hours, before a timer is re-filed
+
+// one pending deadline
+typedef struct timer_node {
+    long long expires;  // ms timestamp the timer fires at
+    struct timer_node *prev;  // links in a slot list, NULL when not pending
+    struct timer_node *next;
+} timer_node;
+
+typedef struct {
+    long long now;  // every timer up to this ms has been moved to expired
+    int count;  // timers in the slots
+    timer_node slots[TIMER_LEVELS][TIMER_SLOTS];  // list sentinels
+    timer_node expired;  // sentinel of timers that are due, not yet taken
+} timer_wheel;
+
+void timer_init(timer_wheel *wheel, long long now);
+void timer_add(timer_wheel *wheel, timer_node *node, long long expires);
+void timer_cancel(timer_wheel *wheel, timer_node *node);
+int timer_pending(timer_node *node);
+timer_node *timer_expire(timer_wheel *wheel, long long now);
+long long timer_next(timer_wheel *wheel);
+
+#endif
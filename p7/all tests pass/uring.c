@@ -0,0 +1,447 @@
+//
+// uring.c: io_uring on the raw system calls, for the web server's -u mode.
+//
+// uring_init() maps a ring's submission and completion queues. SQEs are
+// handed out with uring_sqe() and all of them go to the kernel with one
+// io_uring_enter() in uring_submit(), which can also wait for completions.
+// uring_provide_buffers() registers a ring of provided buffers so receives
+// pick a buffer only once data has arrived, instead of every idle
+// connection pinning one.
+//
+// uring_sendfile() sends a static response through a ring of the calling
+// worker: the header (MSG_MORE), then the file moved through a pipe of the
+// worker's in 1 MB (or pipe sized) chunks by pairs of splices, all linked
+// so one system call submits the whole response. The pipe ends are
+// registered as fixed files. If a step comes up short the rest is sent the
+// old way, with sendfile(). A worker that retires gives its ring and pipe
+// back with uring_sendfile_release().
+//
+
+#include "helper.h"
+#include "uring.h"
+#include <sys/syscall.h>
+
+#define SEND_ENTRIES 64  // SQEs in a worker's send ring
+#define SEND_PIPE_SIZE (1 << 20)  // pipe size asked for, the kernel may give less
+
+// a worker's send ring and the pipe its splices go through
+typedef struct {
+    uring_t ring;
+    int pipefd[2];  // also registered as fixed files 0 (read) and 1 (write)
+    int pipe_size;  // bytes the pipe holds
+} send_ring;
+
+static int sendfile_enabled;  // uring_sendfile() is used, set with -u
+static __thread send_ring *my_send;  // calling worker's send ring
+static __thread int send_failed;  // 1 if this worker could not set one up
+
+/**
+ * Function that sets up a ring.
+ *
+ * ring: ring to set up
+ * entries: size of the submission queue
+ * Return: 0 on success, -1 if io_uring is not available
+ */
+int uring_init(uring_t *ring, unsigned entries) {
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(uring_t));
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = params.features & IORING_FEAT_SINGLE_MMAP;  // both queues in one mapping
+    if (single && cq_size > sq_size) {
+        sq_size = cq_size;
+    }
+
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_SQ_RING);
+    char *cq = single ? sq : mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    ring->sq_map = sq;
+    ring->sq_map_size = sq_size;
+    ring->cq_map = cq;
+    ring->cq_map_size = cq_size;
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        uring_destroy(ring);
+        return -1;
+    }
+
+    ring->sq_head = (unsigned*) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head = (unsigned*) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    // SQE i always sits in slot i, so the index array never changes
+    unsigned *array = (unsigned*) (sq + params.sq_off.array);
+    for (unsigned index = 0; index < params.sq_entries; index++) {
+        array[index] = index;
+    }
+    ring->sqe_tail = *ring->sq_tail;
+    return 0;
+}
+
+/**
+ * Function that unmaps a ring set up by uring_init(), along with its
+ * provided buffers, and closes it.
+ *
+ * ring: ring to tear down
+ */
+void uring_destroy(uring_t *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map != NULL && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->buf_ring != NULL && ring->buf_ring != MAP_FAILED) {
+        munmap(ring->buf_ring, ring->buf_count * sizeof(struct io_uring_buf));
+    }
+    free(ring->buf_base);
+    close(ring->fd);
+    memset(ring, 0, sizeof(uring_t));
+    ring->fd = -1;
+}
+
+/**
+ * Function that hands out a cleared SQE, submitting what is queued if the
+ * submission queue is full.
+ *
+ * ring: ring to queue on
+ * Return: the SQE to fill in
+ */
+struct io_uring_sqe *uring_sqe(uring_t *ring) {
+    while (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+            ring->sq_entries) {
+        uring_submit(ring, 0);
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+/**
+ * Function that submits every queued SQE. If the kernel refuses them, the
+ * ones it did not take are dropped, so they cannot go out later with
+ * someone else's submission.
+ *
+ * ring: ring to submit on
+ * wait: number of completions to wait for
+ * Return: number of SQEs submitted, or -1 on error
+ */
+int uring_submit(uring_t *ring, unsigned wait) {
+    unsigned tail = *ring->sq_tail;
+    unsigned pending = ring->sqe_tail - tail;
+    int rc;
+
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    while ((rc = syscall(__NR_io_uring_enter, ring->fd, pending, wait,
+            wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0)) < 0 && errno == EINTR) {
+        pending = 0;  // the interrupted call may have submitted them already
+    }
+
+    if (rc < 0 && pending > 0) {  // take back what the kernel left queued
+        unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if ((int) (head - tail) < 0) {  // older SQEs are still queued, keep those
+            head = tail;
+        }
+        __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+        ring->sqe_tail = head;
+    }
+    return rc;
+}
+
+/**
+ * Function that returns the oldest completion not yet seen.
+ *
+ * ring: ring to look at
+ * Return: the completion, or NULL if there is none
+ */
+struct io_uring_cqe *uring_cqe(uring_t *ring) {
+    unsigned head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+/**
+ * Function that gives the completion returned by uring_cqe() back to the
+ * kernel.
+ */
+void uring_cqe_seen(uring_t *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Function that registers a ring of provided buffers for receives that set
+ * IOSQE_BUFFER_SELECT with buf_group = group.
+ *
+ * ring: ring to register with
+ * count: number of buffers, a power of two
+ * size: bytes per buffer
+ * group: buffer group id
+ * Return: 0 on success, -1 if the kernel does not support buffer rings
+ */
+int uring_provide_buffers(uring_t *ring, unsigned count, unsigned size, int group) {
+    struct io_uring_buf_reg reg;
+    size_t ring_bytes = count * sizeof(struct io_uring_buf);
+
+    ring->buf_ring = mmap(NULL, ring_bytes, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->buf_base = malloc((size_t) count * size);
+    if (ring->buf_ring == MAP_FAILED || ring->buf_base == NULL) {
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) ring->buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return -1;
+    }
+
+    ring->buf_count = count;
+    ring->buf_size = size;
+    ring->buf_ring->tail = 0;
+    for (unsigned bid = 0; bid < count; bid++) {
+        uring_recycle_buffer(ring, bid);
+    }
+    return 0;
+}
+
+/**
+ * Function that returns the memory of a provided buffer.
+ */
+char *uring_buffer(uring_t *ring, unsigned bid) {
+    return ring->buf_base + (size_t) bid * ring->buf_size;
+}
+
+/**
+ * Function that gives a provided buffer back to the kernel once its data
+ * has been copied out.
+ */
+void uring_recycle_buffer(uring_t *ring, unsigned bid) {
+    unsigned short tail = ring->buf_ring->tail;
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[tail & (ring->buf_count - 1)];
+
+    buf->addr = (unsigned long) uring_buffer(ring, bid);
+    buf->len = ring->buf_size;
+    buf->bid = bid;
+    __atomic_store_n(&ring->buf_ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Function that turns on uring_sendfile().
+ */
+void uring_sendfile_enable() {
+    sendfile_enabled = 1;
+}
+
+/**
+ * Function that gives the calling worker its send ring and pipe.
+ *
+ * Return: the send ring, or NULL if it cannot have one
+ */
+static send_ring *send_ring_get() {
+    if (my_send != NULL || send_failed) {
+        return my_send;
+    }
+
+    send_ring *send = malloc(sizeof(send_ring));
+    send_failed = 1;
+    if (send == NULL) {
+        return NULL;
+    }
+    if (uring_init(&send->ring, SEND_ENTRIES) < 0) {
+        free(send);
+        return NULL;
+    }
+    if (pipe2(send->pipefd, O_CLOEXEC) < 0) {
+        uring_destroy(&send->ring);
+        free(send);
+        return NULL;
+    }
+    fcntl(send->pipefd[1], F_SETPIPE_SZ, SEND_PIPE_SIZE);  // best effort
+    send->pipe_size = fcntl(send->pipefd[1], F_GETPIPE_SZ);
+    if (send->pipe_size <= 0 || syscall(__NR_io_uring_register, send->ring.fd,
+            IORING_REGISTER_FILES, send->pipefd, 2) < 0) {
+        uring_destroy(&send->ring);
+        Close(send->pipefd[0]);
+        Close(send->pipefd[1]);
+        free(send);
+        return NULL;
+    }
+
+    send_failed = 0;
+    my_send = send;
+    return send;
+}
+
+/**
+ * Function that sends the bytes left in the pipe after a chain came up
+ * short, then the rest of the file, without io_uring.
+ *
+ * send: worker's send ring
+ * fd: client socket
+ * srcfd: file being sent
+ * in_pipe: bytes spliced into the pipe but not out of it
+ * offset: offset in the file up to which it has been spliced into the pipe
+ * end: offset in the file at which to stop
+ * Return: 0 on success, -1 if the client went away
+ */
+static int send_rest(send_ring *send, int fd, int srcfd, long in_pipe, long offset, long end) {
+    while (in_pipe > 0) {
+        ssize_t n = splice(send->pipefd[0], NULL, fd, NULL, in_pipe, SPLICE_F_MOVE);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            // drop what the client will never get so the pipe is empty
+            char sink[4096];
+            while (in_pipe > 0 && (n = read(send->pipefd[0], sink,
+                    in_pipe < (long) sizeof(sink) ? in_pipe : (long) sizeof(sink))) > 0) {
+                in_pipe -= n;
+            }
+            return -1;
+        }
+        in_pipe -= n;
+    }
+    if (offset < end && rio_sendfile(fd, srcfd, offset, end - offset) != end - offset) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function that sends a static response with one linked chain per
+ * SEND_ENTRIES / 2 chunks: send(header) -> splice(file -> pipe) ->
+ * splice(pipe -> client) -> ...
+ *
+ * fd: client socket
+ * header: response header
+ * srcfd: file to send
+ * offset: first byte of srcfd to send
+ * filesize: bytes of srcfd to send
+ * Return: 0 if sent, 1 if the caller must send it (-u is off, the
+ *         worker has no ring or the first chain could not be submitted),
+ *         -1 if the client went away, the file came up short or a later
+ *         chain could not be submitted
+ */
+int uring_sendfile(int fd, char *header, int srcfd, off_t offset, int filesize) {
+    send_ring *send = sendfile_enabled ? send_ring_get() : NULL;
+    long queued = 0, to_pipe = 0, sent = 0;
+    int header_len = strlen(header), header_sent = 0;
+
+    if (send == NULL) {
+        return 1;
+    }
+    uring_t *ring = &send->ring;
+
+    while (!header_sent || queued < filesize) {
+        int sqes = 0;
+
+        if (!header_sent) {
+            struct io_uring_sqe *sqe = uring_sqe(ring);
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = fd;
+            sqe->addr = (unsigned long) header;
+            sqe->len = header_len;
+            sqe->msg_flags = MSG_NOSIGNAL | (filesize > 0 ? MSG_MORE : 0);
+            sqe->flags = IOSQE_IO_LINK;
+            sqes++;
+        }
+        while (queued < filesize && sqes + 2 <= SEND_ENTRIES) {
+            int chunk = filesize - queued < send->pipe_size ? filesize - queued : send->pipe_size;
+            struct io_uring_sqe *sqe = uring_sqe(ring);
+            sqe->opcode = IORING_OP_SPLICE;  // file -> pipe
+            sqe->splice_fd_in = srcfd;
+            sqe->splice_off_in = offset + queued;
+            sqe->fd = 1;  // write end, fixed
+            sqe->off = -1;
+            sqe->len = chunk;
+            sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+            sqe = uring_sqe(ring);
+            sqe->opcode = IORING_OP_SPLICE;  // pipe -> client
+            sqe->splice_fd_in = 0;  // read end, fixed
+            sqe->splice_flags = SPLICE_F_FD_IN_FIXED | SPLICE_F_MOVE;
+            sqe->splice_off_in = -1;
+            sqe->fd = fd;
+            sqe->off = -1;
+            sqe->len = chunk;
+            sqe->flags = IOSQE_IO_LINK;
+            queued += chunk;
+            sqes += 2;
+        }
+        ring->sqes[(ring->sqe_tail - 1) & ring->sq_mask].flags &= ~IOSQE_IO_LINK;  // end of chain
+
+        if (uring_submit(ring, sqes) < 0) {
+            // the chain was dropped; once the header is out the client has
+            // part of a response, so it cannot be sent again from the top
+            return header_sent ? -1 : 1;
+        }
+
+        // completions arrive in chain order; a short step cancels the rest
+        // of the chain (-ECANCELED), so only the totals matter
+        int has_header = !header_sent;
+        for (int index = 0; index < sqes; index++) {
+            struct io_uring_cqe *cqe;
+            while ((cqe = uring_cqe(ring)) == NULL) {
+                uring_submit(ring, 1);
+            }
+            int step = index - has_header;  // -1 for the header
+            if (step < 0 && cqe->res == header_len) {
+                header_sent = 1;
+            } else if (step < 0 && cqe->res > 0) {  // finish the header by hand
+                header_sent = rio_writen(fd, header + cqe->res, header_len - cqe->res) ==
+                    header_len - cqe->res;
+            } else if (step >= 0 && cqe->res > 0) {
+                *(step % 2 == 0 ? &to_pipe : &sent) += cqe->res;
+            }
+            uring_cqe_seen(ring);
+        }
+
+        if (!header_sent) {
+            return -1;
+        }
+        if (sent != to_pipe || to_pipe != queued) {  // send the rest the old way
+            return send_rest(send, fd, srcfd, to_pipe - sent, offset + to_pipe,
+                offset + filesize) == 0 ? 0 : -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function that tears down the calling worker's send ring and pipe before
+ * its thread exits.
+ */
+void uring_sendfile_release() {
+    if (my_send != NULL) {
+        uring_destroy(&my_send->ring);
+        Close(my_send->pipefd[0]);
+        Close(my_send->pipefd[1]);
+        free(my_send);
+        my_send = NULL;
+    }
+    send_failed = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <linux/io_uring.h>
+
+//
+// uring.h: minimal io_uring wrapper built on the raw system calls (there is
+// no liburing here). A ring is used by one thread only. Used with -u by the
+// event loops (accept, receive into provided buffers, close) and by the
+// workers to send static files as one linked send/splice chain.
+//
+
+// one io_uring instance
+typedef struct uring {
+    int fd;  // ring fd from io_uring_setup
+    unsigned *sq_head;  // shared with the kernel
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;  // SQEs handed out, published to sq_tail on submit
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;  // shared with the kernel
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;  // mappings, for uring_destroy()
+    size_t sq_map_size;
+    void *cq_map;  // same as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *buf_ring;  // provided buffers, NULL if none
+    char *buf_base;  // memory of the provided buffers
+    unsigned buf_count;  // number of provided buffers (a power of two)
+    unsigned buf_size;  // bytes per provided buffer
+} uring_t;
+
+int uring_init(uring_t *ring, unsigned entries);
+void uring_destroy(uring_t *ring);
+struct io_uring_sqe *uring_sqe(uring_t *ring);
+int uring_submit(uring_t *ring, unsigned wait);
+struct io_uring_cqe *uring_cqe(uring_t *ring);
+void uring_cqe_seen(uring_t *ring);
+int uring_provide_buffers(uring_t *ring, unsigned count, unsigned size, int group);
+char *uring_buffer(uring_t *ring, unsigned bid);
+void uring_recycle_buffer(uring_t *ring, unsigned bid);
+void uring_sendfile_enable();
+int uring_sendfile(int fd, char *header, int srcfd, off_t offset, int filesize);
+void uring_sendfile_release();
+
+#endif